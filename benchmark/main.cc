@@ -0,0 +1,1511 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include "karl/json.hxx"
+#include "karl.h"
+#include "cJSON.h"
+#include "number.h"
+#include "structural.h"
+#include "text.h"
+using Json = karl::json;
+
+// ------------------------------- helpers -------------------------------
+
+// every heap allocation of the process is counted here, along with
+// the bytes requested by the blocks that are still allocated and the
+// most of them seen at once
+static std::atomic<size_t> g_allocations(0);
+static std::atomic<size_t> g_live_bytes(0);
+static std::atomic<size_t> g_peak_bytes(0);
+
+// the requested size is stored in front of the block,
+// 16 bytes keep the alignment malloc guarantees
+const size_t kBlockHeader = 16;
+
+// every form of operator new and delete goes through these two, so
+// plain, array and sized allocations are counted the same way
+void* counted_alloc(size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    size_t live = g_live_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+    if (live > g_peak_bytes.load(std::memory_order_relaxed)) {
+        g_peak_bytes.store(live, std::memory_order_relaxed);
+    }
+    void* block = malloc(size + kBlockHeader);
+    if (!block) throw std::bad_alloc();
+    memcpy(block, &size, sizeof(size));
+    return static_cast<char*>(block) + kBlockHeader;
+}
+
+void counted_free(void* ptr) noexcept {
+    if (!ptr) return;
+    void* block = static_cast<char*>(ptr) - kBlockHeader;
+    size_t size;
+    memcpy(&size, block, sizeof(size));
+    g_live_bytes.fetch_sub(size, std::memory_order_relaxed);
+    free(block);
+}
+
+void* operator new(size_t size) { return counted_alloc(size); }
+void* operator new[](size_t size) { return counted_alloc(size); }
+void operator delete(void* ptr) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr) noexcept { counted_free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { counted_free(ptr); }
+
+template <typename Fn>
+size_t count_allocations(Fn fn) {
+    size_t before = g_allocations.load();
+    fn();
+    return g_allocations.load() - before;
+}
+
+// bytes allocated on top of what was live before, at the worst moment of fn
+template <typename Fn>
+size_t peak_allocated(Fn fn) {
+    size_t before = g_live_bytes.load();
+    g_peak_bytes.store(before);
+    fn();
+    return g_peak_bytes.load() - before;
+}
+
+template <typename Fn>
+double measure_seconds(int iterations, Fn fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        fn();
+    }
+    std::chrono::duration<double> cost = std::chrono::steady_clock::now() - start;
+    return cost.count() / iterations;
+}
+
+void report_throughput(const std::string& name, size_t bytes, double seconds) {
+    double mb = static_cast<double>(bytes) / (1024.0 * 1024.0);
+    std::cout << "  " << name << ": " << (seconds * 1000.0) << " ms, "
+        << (mb / seconds) << " MB/s" << std::endl;
+}
+
+// an array of mixed records, close to what an api response looks like
+std::string make_records_corpus(size_t count) {
+    std::string s = "[";
+    for (size_t i = 0; i < count; i++) {
+        if (i) s += ",";
+        s += "{\"id\":" + std::to_string(1000000 + i);
+        s += ",\"name\":\"user_" + std::to_string(i) + "\"";
+        s += ",\"active\":" + std::string((i % 3) ? "true" : "false");
+        s += ",\"score\":" + std::to_string(i * 0.25);
+        s += ",\"tags\":[\"alpha\",\"beta\",\"gamma\"]";
+        s += ",\"address\":{\"city\":\"Shenzhen\",\"zip\":\"518000\",\"note\":null}}";
+    }
+    s += "]";
+    return s;
+}
+
+// json lines, one record per line
+std::string make_ndjson_corpus(size_t count) {
+    std::string s;
+    for (size_t i = 0; i < count; i++) {
+        s += "{\"id\":" + std::to_string(1000000 + i);
+        s += ",\"name\":\"user_" + std::to_string(i) + "\"";
+        s += ",\"score\":" + std::to_string(i * 0.25);
+        s += ",\"tags\":[\"alpha\",\"beta\"],\"ok\":true}\n";
+    }
+    return s;
+}
+
+// log lines: long string values, no escapes in most of them
+std::string make_messages_corpus(size_t count) {
+    std::string s = "[";
+    for (size_t i = 0; i < count; i++) {
+        if (i) s += ",";
+        s += "{\"trace\":\"a6f3c2d4e5b6978812345678" + std::to_string(100000 + i) + "\"";
+        s += ",\"level\":\"information\"";
+        s += ",\"message\":\"request handled by upstream server in the primary region\"";
+        s += ",\"path\":\"/api/v1/users/" + std::to_string(i) + "/profile/settings\"";
+        s += ",\"agent\":\"Mozilla/5.0 (X11; Linux x86_64) \\\"bench\\\"\"}";
+    }
+    s += "]";
+    return s;
+}
+
+// polygons of [longitude, latitude] pairs, like canada.json
+std::string make_coordinates_corpus(size_t points) {
+    std::mt19937 rng(2019);
+    std::uniform_real_distribution<double> lon(-141.0, -52.0);
+    std::uniform_real_distribution<double> lat(41.0, 83.0);
+    char buff[64];
+    std::string s = "{\"type\":\"Polygon\",\"coordinates\":[[";
+    for (size_t i = 0; i < points; i++) {
+        if (i) s += ",";
+        snprintf(buff, sizeof(buff), "[%.15g,%.15g]", lon(rng), lat(rng));
+        s += buff;
+    }
+    s += "]]}";
+    return s;
+}
+
+// events made of short string values, most of them below 24 bytes
+std::string make_short_strings_corpus(size_t count) {
+    static const char* kinds[] = {"click", "view", "scroll", "purchase"};
+    static const char* devices[] = {"mobile", "desktop", "tablet"};
+    std::string s = "[";
+    for (size_t i = 0; i < count; i++) {
+        if (i) s += ",";
+        s += "{\"event\":\"ev_" + std::to_string(i) + "\"";
+        s += ",\"kind\":\"" + std::string(kinds[i % 4]) + "\"";
+        s += ",\"device\":\"" + std::string(devices[i % 3]) + "\"";
+        s += ",\"lang\":\"zh-CN\",\"country\":\"CN\"";
+        s += ",\"session\":\"sess-" + std::to_string(1000000000000 + i) + "\"";
+        s += ",\"tags\":[\"t" + std::to_string(i % 7) + "\",\"t" + std::to_string(i % 11) + "\"]}";
+    }
+    s += "]";
+    return s;
+}
+
+// ------------------------- legacy cJSON path ---------------------------
+
+karl::ref_ptr<karl::json_value> legacy_convert(cJSON* ptr) {
+    karl::ref_ptr<karl::json_value> value;
+    switch (ptr->type) {
+    case cJSON_False:
+        return karl::New<karl::json_boolean>(false);
+    case cJSON_True:
+        return karl::New<karl::json_boolean>(true);
+    case cJSON_NULL:
+        return karl::New<karl::json_null>();
+    case cJSON_Number:
+        return karl::json_number::create(ptr->valuedouble);
+    case cJSON_String:
+        return karl::New<karl::json_string>(ptr->valuestring);
+    case cJSON_Array:
+    {
+        auto obj = karl::New<karl::json_array>();
+        for (cJSON* child = ptr->child; child; child = child->next) {
+            obj->append(legacy_convert(child));
+        }
+        return obj;
+    }
+    default:
+    {
+        auto obj = karl::New<karl::json_object>();
+        for (cJSON* child = ptr->child; child; child = child->next) {
+            obj->set_value(child->string, legacy_convert(child));
+        }
+        return obj;
+    }
+    }
+}
+
+Json legacy_parse(const std::string& data) {
+    cJSON* js = cJSON_Parse(data.c_str());
+    assert(js);
+    Json obj(legacy_convert(js));
+    cJSON_Delete(js);
+    return obj;
+}
+
+// string escaping one byte at a time, the way most writers do it
+void escape_per_byte(std::string& out, const char* ptr, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    out.push_back('"');
+    for (size_t i = 0; i < len; i++) {
+        const unsigned char c = static_cast<unsigned char>(ptr[i]);
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\b': out += "\\b"; break;
+        case '\f': out += "\\f"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (c < 0x20) {
+                out += "\\u00";
+                out.push_back(hex[c >> 4]);
+                out.push_back(hex[c & 15]);
+            } else {
+                out.push_back(static_cast<char>(c));
+            }
+        }
+    }
+    out.push_back('"');
+}
+
+// json_value::dump() as it was: a stringstream and a string per node,
+// the children's text copied into their parent's (strings are escaped
+// byte by byte, so the output is the same as the writer's)
+std::string legacy_dump(const karl::json_value* value, int indent, int prefix) {
+    if (!value) {
+        return "null";
+    }
+    std::stringstream ss;
+    switch (value->type()) {
+    case karl::value_type::kArray:
+    {
+        auto arr = static_cast<const karl::json_array*>(value);
+        size_t size = arr->size();
+        if (indent >= 0 && size == 0) {
+            return "[]";
+        }
+        ss << "[";
+        for (size_t i = 0; i < size; i++) {
+            std::string item = arr->is_packed()
+                ? arr->number_at(i).dump() : legacy_dump(arr->at(i), indent, prefix + indent);
+            if (indent >= 0) {
+                ss << "\n" << std::string(prefix + indent, ' ');
+            }
+            ss << item;
+            if (i + 1 != size) {
+                ss << ",";
+            } else if (indent >= 0) {
+                ss << "\n";
+            }
+        }
+        if (indent >= 0) {
+            ss << std::string(prefix, ' ');
+        }
+        ss << "]";
+        return ss.str();
+    }
+    case karl::value_type::kObject:
+    {
+        auto obj = static_cast<const karl::json_object*>(value);
+        size_t size = obj->size();
+        if (indent >= 0 && size == 0) {
+            return "{}";
+        }
+        ss << (indent >= 0 ? "{\n" : "{");
+        for (size_t i = 0; i < size; i++) {
+            if (indent >= 0) {
+                ss << std::string(prefix + indent, ' ');
+            }
+            std::string key;
+            escape_per_byte(key, obj->key_at(i).data(), obj->key_at(i).size());
+            ss << key << (indent >= 0 ? ": " : ":");
+            ss << legacy_dump(obj->value_at(i).get(), indent, prefix + indent);
+            if (i + 1 != size) {
+                ss << (indent >= 0 ? ",\n" : ",");
+            } else if (indent >= 0) {
+                ss << "\n";
+            }
+        }
+        if (indent >= 0) {
+            ss << std::string(prefix, ' ');
+        }
+        ss << "}";
+        return ss.str();
+    }
+    case karl::value_type::kString:
+    {
+        auto str = static_cast<const karl::json_string*>(value);
+        std::string out;
+        escape_per_byte(out, str->data(), str->size());
+        return out;
+    }
+    default:
+        return value->dump();
+    }
+}
+
+// ------------------------------ benchmarks -----------------------------
+
+void bench_parse_throughput() {
+    std::cout << "bench_parse_throughput => " << std::endl;
+    std::string corpus = make_records_corpus(20000);
+    std::cout << "  corpus: " << corpus.size() << " bytes" << std::endl;
+
+    double legacy = measure_seconds(5, [&corpus]() {
+        Json j = legacy_parse(corpus);
+        assert(j.size() == 20000);
+    });
+    report_throughput("cJSON + convert", corpus.size(), legacy);
+
+    double native = measure_seconds(5, [&corpus]() {
+        Json j = Json::parse(corpus);
+        assert(j.size() == 20000);
+    });
+    report_throughput("json::parse", corpus.size(), native);
+    std::cout << " ---------------- " << std::endl;
+}
+
+void bench_structural_index() {
+    std::cout << "bench_structural_index => " << std::endl;
+    std::string corpus = make_records_corpus(50000);
+    std::cout << "  corpus: " << corpus.size() << " bytes, kernel: "
+        << karl::text::structural_kernel_name() << std::endl;
+
+    // cJSON walks the text byte by byte in skip()/parse_value()
+    double scan = measure_seconds(5, [&corpus]() {
+        cJSON* js = cJSON_Parse(corpus.c_str());
+        cJSON_Delete(js);
+    });
+    report_throughput("cJSON_Parse", corpus.size(), scan);
+
+    // the bound for anything that reads every byte once
+    std::string copy(corpus.size(), '\0');
+    double copying = measure_seconds(20, [&corpus, &copy]() {
+        memcpy(&copy[0], corpus.data(), corpus.size());
+    });
+    report_throughput("memcpy", corpus.size(), copying);
+
+    std::vector<uint32_t> index;
+    double stage1 = measure_seconds(20, [&corpus, &index]() {
+        karl::text::build_structural_index(corpus.data(), corpus.size(), index);
+    });
+    report_throughput("stage 1 structural index", corpus.size(), stage1);
+    std::cout << "  structurals: " << index.size() << std::endl;
+
+    double full = measure_seconds(5, [&corpus]() {
+        Json j = Json::parse(corpus);
+    });
+    report_throughput("json::parse (stage 1 + 2)", corpus.size(), full);
+    std::cout << " ---------------- " << std::endl;
+}
+
+void bench_number_parsing() {
+    std::cout << "bench_number_parsing => " << std::endl;
+    std::string corpus = make_coordinates_corpus(200000);
+    std::cout << "  corpus: " << corpus.size() << " bytes" << std::endl;
+
+    double legacy = measure_seconds(5, [&corpus]() {
+        Json j = legacy_parse(corpus);
+    });
+    report_throughput("cJSON + convert", corpus.size(), legacy);
+
+    double native = measure_seconds(5, [&corpus]() {
+        Json j = Json::parse(corpus);
+    });
+    report_throughput("json::parse", corpus.size(), native);
+
+    // 2^53 + 1 and a 64-bit id can not be represented by a double
+    std::string ids = "[9007199254740993,18446744073709551615,-9223372036854775807]";
+    Json a = legacy_parse(ids);
+    Json b = Json::parse(ids);
+    std::cout << "  cJSON + convert: " << a.dump() << std::endl;
+    std::cout << "  json::parse:     " << b.dump() << std::endl;
+    std::cout << " ---------------- " << std::endl;
+}
+
+void bench_parse_borrowed() {
+    std::cout << "bench_parse_borrowed => " << std::endl;
+    std::string corpus = make_messages_corpus(20000);
+    std::cout << "  corpus: " << corpus.size() << " bytes" << std::endl;
+
+    size_t owned_allocs = count_allocations([&corpus]() {
+        Json j = Json::parse(corpus);
+    });
+    size_t borrowed_allocs = count_allocations([&corpus]() {
+        Json j = Json::parse_borrowed(corpus.data(), corpus.size());
+    });
+    std::cout << "  allocations: json::parse " << owned_allocs
+        << ", json::parse_borrowed " << borrowed_allocs << std::endl;
+
+    double owned = measure_seconds(5, [&corpus]() {
+        Json j = Json::parse(corpus);
+        assert(j.size() == 20000);
+    });
+    report_throughput("json::parse", corpus.size(), owned);
+
+    double borrowed = measure_seconds(5, [&corpus]() {
+        Json j = Json::parse_borrowed(corpus.data(), corpus.size());
+        assert(j.size() == 20000);
+    });
+    report_throughput("json::parse_borrowed", corpus.size(), borrowed);
+    std::cout << " ---------------- " << std::endl;
+}
+
+void bench_push_parser() {
+    std::cout << "bench_push_parser => " << std::endl;
+    std::string corpus = make_records_corpus(20000);
+    std::cout << "  corpus: " << corpus.size() << " bytes" << std::endl;
+
+    // what json::parse(std::istream*) used to do: slurp, then parse
+    double slurp = measure_seconds(5, [&corpus]() {
+        std::istringstream is(corpus);
+        std::stringstream ss;
+        ss << is.rdbuf();
+        Json j = Json::parse(ss.str());
+        assert(j.size() == 20000);
+    });
+    report_throughput("stringstream + json::parse", corpus.size(), slurp);
+
+    double stream = measure_seconds(5, [&corpus]() {
+        std::istringstream is(corpus);
+        Json j = Json::parse(&is);
+        assert(j.size() == 20000);
+    });
+    report_throughput("json::parse(std::istream*)", corpus.size(), stream);
+
+    double chunked = measure_seconds(5, [&corpus]() {
+        karl::parser p;
+        for (size_t pos = 0; pos < corpus.size(); pos += 4096) {
+            p.feed(corpus.data() + pos, std::min<size_t>(4096, corpus.size() - pos));
+        }
+        Json j = p.finish();
+        assert(j.size() == 20000);
+    });
+    report_throughput("parser::feed, 4KB chunks", corpus.size(), chunked);
+    std::cout << " ---------------- " << std::endl;
+}
+
+// sums "score" and counts the active records, nothing else is kept
+class score_handler : public karl::sax_handler {
+public:
+    double total = 0;
+    size_t active = 0;
+
+    bool on_key(const char* ptr, size_t len) override {
+        _key.assign(ptr, len);
+        return true;
+    }
+    bool on_bool(bool value) override {
+        if (value && _key == "active") active++;
+        return true;
+    }
+    bool on_double(double value) override {
+        if (_key == "score") total += value;
+        return true;
+    }
+
+private:
+    std::string _key;
+};
+
+void bench_sax_aggregate() {
+    std::cout << "bench_sax_aggregate => " << std::endl;
+    std::string corpus = make_records_corpus(20000);
+    std::cout << "  corpus: " << corpus.size() << " bytes" << std::endl;
+
+    double dom_total = 0;
+    double dom = measure_seconds(5, [&corpus, &dom_total]() {
+        Json j = Json::parse(corpus);
+        dom_total = 0;
+        for (size_t i = 0; i < j.size(); i++) {
+            dom_total += j[i]["score"].get<double>();
+        }
+    });
+    report_throughput("json::parse + walk", corpus.size(), dom);
+
+    score_handler handler;
+    size_t dom_allocs = count_allocations([&corpus]() {
+        Json j = Json::parse(corpus);
+    });
+    size_t sax_allocs = count_allocations([&corpus, &handler]() {
+        Json::parse(corpus, &handler);
+    });
+
+    double sax = measure_seconds(5, [&corpus, &handler]() {
+        handler.total = 0;
+        handler.active = 0;
+        Json::parse(corpus, &handler);
+    });
+    report_throughput("json::parse(sax_handler)", corpus.size(), sax);
+    std::cout << "  total: " << dom_total << " / " << handler.total
+        << ", allocations: " << dom_allocs << " / " << sax_allocs << std::endl;
+    std::cout << " ---------------- " << std::endl;
+}
+
+void bench_parse_many() {
+    std::cout << "bench_parse_many => " << std::endl;
+    std::string corpus = make_ndjson_corpus(200000);
+    std::cout << "  corpus: " << corpus.size() << " bytes, hardware threads: "
+        << std::thread::hardware_concurrency() << std::endl;
+
+    // what callers had to do before: split the lines, parse one by one
+    double lines = measure_seconds(3, [&corpus]() {
+        std::istringstream is(corpus);
+        std::string line;
+        size_t count = 0;
+        while (std::getline(is, line)) {
+            Json j = Json::parse(line);
+            count++;
+        }
+        assert(count == 200000);
+    });
+    report_throughput("getline + json::parse", corpus.size(), lines);
+
+    const size_t threads[] = {1, 2, 4, 8};
+    for (size_t n : threads) {
+        double many = measure_seconds(3, [&corpus, n]() {
+            auto docs = Json::parse_many(corpus.data(), corpus.size(), n);
+            assert(docs.size() == 200000);
+        });
+        report_throughput("parse_many, " + std::to_string(n) + " threads", corpus.size(), many);
+    }
+
+    double stream = measure_seconds(3, [&corpus]() {
+        size_t count = Json::parse_many(corpus.data(), corpus.size(), [](Json&) {
+            return true;
+        });
+        assert(count == 200000);
+        (void)count;
+    });
+    report_throughput("parse_many, callback", corpus.size(), stream);
+    std::cout << " ---------------- " << std::endl;
+}
+
+void bench_parse_lazy() {
+    std::cout << "bench_parse_lazy => " << std::endl;
+    // a request body of about 200KB of which five fields are read
+    std::string corpus = "{\"request\":{\"id\":\"7f3a\",\"user\":42},\"items\":"
+        + make_records_corpus(1000) + ",\"trailer\":{\"count\":1000}}";
+    std::cout << "  corpus: " << corpus.size() << " bytes" << std::endl;
+
+    auto read_fields = [](Json& j) {
+        int64_t sum = j["request"]["user"].get<int64_t>();
+        sum += j["items"][10]["id"].get<int64_t>();
+        sum += j["items"][500]["address"]["zip"].get<std::string>().size();
+        sum += j["items"][999]["active"].get<bool>() ? 1 : 0;
+        sum += j["trailer"]["count"].get<int64_t>();
+        return sum;
+    };
+
+    size_t eager_allocs = count_allocations([&corpus, &read_fields]() {
+        Json j = Json::parse(corpus);
+        read_fields(j);
+    });
+    size_t lazy_allocs = count_allocations([&corpus, &read_fields]() {
+        Json j = Json::parse_lazy(corpus.data(), corpus.size());
+        read_fields(j);
+    });
+    std::cout << "  allocations: json::parse " << eager_allocs
+        << ", json::parse_lazy " << lazy_allocs << std::endl;
+
+    double eager = measure_seconds(50, [&corpus, &read_fields]() {
+        Json j = Json::parse(corpus);
+        read_fields(j);
+    });
+    report_throughput("json::parse + 5 fields", corpus.size(), eager);
+
+    double lazy = measure_seconds(50, [&corpus, &read_fields]() {
+        Json j = Json::parse_lazy(corpus.data(), corpus.size());
+        read_fields(j);
+    });
+    report_throughput("json::parse_lazy + 5 fields", corpus.size(), lazy);
+    std::cout << " ---------------- " << std::endl;
+}
+
+void bench_parse_projection() {
+    std::cout << "bench_parse_projection => " << std::endl;
+    std::string corpus = make_records_corpus(20000);
+    std::cout << "  corpus: " << corpus.size() << " bytes" << std::endl;
+    karl::projection proj = {"/*/id", "/*/address/city"};
+
+    size_t full_allocs = count_allocations([&corpus]() {
+        Json j = Json::parse(corpus);
+    });
+    size_t proj_allocs = count_allocations([&corpus, &proj]() {
+        Json j = Json::parse(corpus, proj);
+    });
+    std::cout << "  allocations: json::parse " << full_allocs
+        << ", with projection " << proj_allocs << std::endl;
+
+    double full = measure_seconds(5, [&corpus]() {
+        Json j = Json::parse(corpus);
+        assert(j.size() == 20000);
+    });
+    report_throughput("json::parse", corpus.size(), full);
+
+    double projected = measure_seconds(5, [&corpus, &proj]() {
+        Json j = Json::parse(corpus, proj);
+        assert(j.size() == 20000);
+    });
+    report_throughput("json::parse(/*/id, /*/address/city)", corpus.size(), projected);
+    std::cout << " ---------------- " << std::endl;
+}
+
+void bench_parse_parallel() {
+    std::cout << "bench_parse_parallel => " << std::endl;
+    std::string corpus = make_records_corpus(100000);
+    std::cout << "  corpus: " << corpus.size() << " bytes, hardware threads: "
+        << std::thread::hardware_concurrency() << std::endl;
+
+    double serial = measure_seconds(3, [&corpus]() {
+        Json j = Json::parse(corpus);
+        assert(j.size() == 100000);
+    });
+    report_throughput("json::parse", corpus.size(), serial);
+
+    const size_t threads[] = {1, 2, 4, 8, 16};
+    for (size_t n : threads) {
+        double parallel = measure_seconds(3, [&corpus, n]() {
+            Json j = Json::parse_parallel(corpus.data(), corpus.size(), n);
+            assert(j.size() == 100000);
+        });
+        report_throughput("parse_parallel, " + std::to_string(n) + " threads", corpus.size(), parallel);
+    }
+    std::cout << " ---------------- " << std::endl;
+}
+
+// counts the values of a document
+class value_counter : public karl::sax_handler {
+public:
+    size_t values = 0;
+
+    bool on_null() override { values++; return true; }
+    bool on_bool(bool) override { values++; return true; }
+    bool on_int64(int64_t) override { values++; return true; }
+    bool on_uint64(uint64_t) override { values++; return true; }
+    bool on_double(double) override { values++; return true; }
+    bool on_string(const char*, size_t) override { values++; return true; }
+    bool on_start_object() override { values++; return true; }
+    bool on_start_array() override { values++; return true; }
+};
+
+// bytes held by the json returned from 'parse', per value of the corpus
+template <typename Fn>
+void report_memory(const std::string& name, const std::string& corpus, Fn parse) {
+    value_counter counter;
+    Json::parse(corpus, &counter);
+    size_t before = g_live_bytes.load();
+    Json j = parse();
+    size_t bytes = g_live_bytes.load() - before;
+    std::cout << "  " << name << ": " << bytes / 1024 << " KB, "
+        << static_cast<double>(bytes) / counter.values << " bytes per value ("
+        << counter.values << " values)" << std::endl;
+}
+
+// read every field of every record through the json api
+double walk_records(Json& j) {
+    double sum = 0;
+    for (auto it = j.begin(); it != j.end(); ++it) {
+        Json& record = *it;
+        sum += record["id"].get<int64_t>();
+        sum += record["score"].get<double>();
+        sum += record["active"].get<bool>() ? 1 : 0;
+        sum += record["name"].get<std::string>().size();
+        sum += record["tags"].size();
+        sum += record["address"]["city"].get<std::string>().size();
+    }
+    return sum;
+}
+
+void bench_compact_storage() {
+    std::cout << "bench_compact_storage => " << std::endl;
+    std::string records = make_records_corpus(20000);
+    std::string coordinates = make_coordinates_corpus(100000);
+    std::cout << "  corpus: records " << records.size() << " bytes, coordinates "
+        << coordinates.size() << " bytes" << std::endl;
+
+    report_memory("records, json::parse", records, [&records]() {
+        return Json::parse(records);
+    });
+    report_memory("records, json::parse_compact", records, [&records]() {
+        return Json::parse_compact(records.data(), records.size());
+    });
+    report_memory("coordinates, json::parse", coordinates, [&coordinates]() {
+        return Json::parse(coordinates);
+    });
+    report_memory("coordinates, json::parse_compact", coordinates, [&coordinates]() {
+        return Json::parse_compact(coordinates.data(), coordinates.size());
+    });
+
+    double parse = measure_seconds(5, [&records]() {
+        Json j = Json::parse(records);
+        assert(j.size() == 20000);
+    });
+    report_throughput("json::parse", records.size(), parse);
+    double compact = measure_seconds(5, [&records]() {
+        Json j = Json::parse_compact(records.data(), records.size());
+        assert(j.size() == 20000);
+    });
+    report_throughput("json::parse_compact", records.size(), compact);
+
+    Json tree = Json::parse(records);
+    Json tape = Json::parse_compact(records.data(), records.size());
+    double tree_sum = 0, tape_sum = 0;
+    size_t tree_allocs = count_allocations([&tree, &tree_sum]() {
+        tree_sum = walk_records(tree);
+    });
+    size_t tape_allocs = count_allocations([&tape, &tape_sum]() {
+        tape_sum = walk_records(tape);
+    });
+    assert(tree_sum == tape_sum);
+    double tree_walk = measure_seconds(10, [&tree]() { walk_records(tree); });
+    report_throughput("walk, json::parse", records.size(), tree_walk);
+    double tape_walk = measure_seconds(10, [&tape]() { walk_records(tape); });
+    report_throughput("walk, json::parse_compact", records.size(), tape_walk);
+    std::cout << "  walk allocations: " << tree_allocs << " / " << tape_allocs << std::endl;
+    std::cout << " ---------------- " << std::endl;
+}
+
+void bench_arena_allocation() {
+    std::cout << "bench_arena_allocation => " << std::endl;
+    std::string corpus = make_records_corpus(20000);
+    std::cout << "  corpus: " << corpus.size() << " bytes" << std::endl;
+
+    size_t heap_allocs = count_allocations([&corpus]() {
+        Json j = Json::parse(corpus);
+    });
+    size_t arena_allocs = count_allocations([&corpus]() {
+        Json j = Json::parse_arena(corpus.data(), corpus.size());
+    });
+    std::cout << "  allocations, parse and destroy: json::parse " << heap_allocs
+        << ", json::parse_arena " << arena_allocs << std::endl;
+
+    // parse and teardown are timed apart, the worst teardown is reported too
+    auto run = [&corpus](const std::string& name, std::function<Json()> parse) {
+        const int iterations = 5;
+        double parse_seconds = 0, destroy_seconds = 0, destroy_worst = 0;
+        for (int i = 0; i < iterations; i++) {
+            auto start = std::chrono::steady_clock::now();
+            Json* j = new Json(parse());
+            auto parsed = std::chrono::steady_clock::now();
+            assert(j->size() == 20000);
+            delete j;
+            auto destroyed = std::chrono::steady_clock::now();
+            std::chrono::duration<double> p = parsed - start;
+            std::chrono::duration<double> d = destroyed - parsed;
+            parse_seconds += p.count();
+            destroy_seconds += d.count();
+            destroy_worst = std::max(destroy_worst, d.count());
+        }
+        report_throughput(name, corpus.size(), parse_seconds / iterations);
+        std::cout << "  " << name << " destroy: " << destroy_seconds / iterations * 1000.0
+            << " ms, worst " << destroy_worst * 1000.0 << " ms" << std::endl;
+    };
+    run("json::parse", [&corpus]() { return Json::parse(corpus); });
+    run("json::parse_arena", [&corpus]() { return Json::parse_arena(corpus.data(), corpus.size()); });
+    std::cout << " ---------------- " << std::endl;
+}
+
+void bench_get_loop() {
+    std::cout << "bench_get_loop => " << std::endl;
+    std::string corpus = make_coordinates_corpus(200000);
+    Json doc = Json::parse(corpus);
+    Json points = doc["coordinates"][0];
+    size_t count = points.size();
+
+    double sum = 0;
+    double seconds = measure_seconds(5, [&points, &sum]() {
+        for (auto it = points.begin(); it != points.end(); ++it) {
+            Json& point = *it;
+            sum += point[0].get<double>() + point[1].get<double>();
+        }
+    });
+    std::cout << "  iterator, " << count * 2 << " get<double>(): " << seconds * 1000.0
+        << " ms, " << seconds * 1e9 / (count * 2) << " ns per value" << std::endl;
+
+    seconds = measure_seconds(5, [&points, &sum, count]() {
+        for (size_t i = 0; i < count; i++) {
+            sum += points[i][0].get<double>() + points[i][1].get<double>();
+        }
+    });
+    std::cout << "  operator[], " << count * 2 << " get<double>(): " << seconds * 1000.0
+        << " ms, " << seconds * 1e9 / (count * 2) << " ns per value" << std::endl;
+
+    Json records = Json::parse(make_records_corpus(20000));
+    seconds = measure_seconds(5, [&records, &sum]() {
+        sum += walk_records(records);
+    });
+    std::cout << "  records walk, 20000 records: " << seconds * 1000.0 << " ms" << std::endl;
+
+    size_t chain_allocs = count_allocations([&records, &sum]() {
+        for (size_t i = 0; i < 20000; i++) {
+            sum += records[i]["address"]["zip"].get<std::string>().size();
+        }
+    });
+    std::cout << "  allocations, 20000 x j[i][\"address\"][\"zip\"].get<std::string>(): "
+        << chain_allocs << " (sizeof(json) " << sizeof(Json) << ")" << std::endl;
+    std::cout << "  (checksum " << sum << ")" << std::endl;
+    std::cout << " ---------------- " << std::endl;
+}
+
+// member storage of json_object against the unordered_map it replaced,
+// both hold the same value nodes
+void bench_object_layout() {
+    std::cout << "bench_object_layout => " << std::endl;
+    using member_map = std::unordered_map<std::string, karl::ref_ptr<karl::json_value>>;
+    const std::vector<std::string> keys = {"id", "name", "active", "score", "tags", "address"};
+    const size_t records = 20000;
+    const size_t large = 10000;
+
+    std::vector<karl::ref_ptr<karl::json_value>> values;
+    for (size_t i = 0; i < large; i++) {
+        values.push_back(karl::New<karl::json_number>(static_cast<int64_t>(i)));
+    }
+    std::vector<std::string> large_keys;
+    for (size_t i = 0; i < large; i++) {
+        large_keys.push_back("member_" + std::to_string(i));
+    }
+
+    std::vector<karl::ref_ptr<karl::json_object>> objects(records);
+    size_t before = g_live_bytes.load();
+    for (size_t i = 0; i < records; i++) {
+        objects[i] = karl::New<karl::json_object>();
+        for (size_t k = 0; k < keys.size(); k++) {
+            objects[i]->set_value(keys[k], values[i % large]);
+        }
+    }
+    size_t object_bytes = g_live_bytes.load() - before;
+    std::vector<member_map> maps(records);
+    before = g_live_bytes.load();
+    for (size_t i = 0; i < records; i++) {
+        for (size_t k = 0; k < keys.size(); k++) {
+            maps[i][keys[k]] = values[i % large];
+        }
+    }
+    size_t map_bytes = g_live_bytes.load() - before;
+    std::cout << "  memory, " << records << " objects of " << keys.size() << " members: json_object "
+        << object_bytes / 1024 << " KB, unordered_map " << map_bytes / 1024 << " KB" << std::endl;
+
+    size_t found = 0;
+    double object_find = measure_seconds(10, [&]() {
+        for (size_t i = 0; i < records; i++) {
+            for (const std::string& key : keys) {
+                found += objects[i]->find(key) != nullptr;
+            }
+        }
+    });
+    double map_find = measure_seconds(10, [&]() {
+        for (size_t i = 0; i < records; i++) {
+            for (const std::string& key : keys) {
+                found += maps[i].find(key) != maps[i].end();
+            }
+        }
+    });
+    std::cout << "  lookup, small objects: json_object " << object_find * 1000.0
+        << " ms, unordered_map " << map_find * 1000.0 << " ms" << std::endl;
+
+    size_t key_bytes = 0;
+    double object_iterate = measure_seconds(10, [&]() {
+        for (size_t i = 0; i < records; i++) {
+            for (auto it = objects[i]->begin(); it != objects[i]->end(); ++it) {
+                key_bytes += it->first.size() + (it->second ? 1 : 0);
+            }
+        }
+    });
+    double map_iterate = measure_seconds(10, [&]() {
+        for (size_t i = 0; i < records; i++) {
+            for (auto it = maps[i].begin(); it != maps[i].end(); ++it) {
+                key_bytes += it->first.size() + (it->second ? 1 : 0);
+            }
+        }
+    });
+    std::cout << "  iteration, small objects: json_object " << object_iterate * 1000.0
+        << " ms, unordered_map " << map_iterate * 1000.0 << " ms" << std::endl;
+
+    auto big = karl::New<karl::json_object>();
+    member_map big_map;
+    for (size_t i = 0; i < large; i++) {
+        big->set_value(large_keys[i], values[i]);
+        big_map[large_keys[i]] = values[i];
+    }
+    double big_find = measure_seconds(10, [&]() {
+        for (const std::string& key : large_keys) {
+            found += big->find(key) != nullptr;
+        }
+    });
+    double big_map_find = measure_seconds(10, [&]() {
+        for (const std::string& key : large_keys) {
+            found += big_map.find(key) != big_map.end();
+        }
+    });
+    std::cout << "  lookup, one object of " << large << " members: json_object " << big_find * 1000.0
+        << " ms, unordered_map " << big_map_find * 1000.0 << " ms" << std::endl;
+
+    Json ordered = Json::parse("{\"b\":1,\"a\":2,\"c\":3}");
+    std::cout << "  dump keeps key order: " << ordered.dump()
+        << " (checksum " << found + key_bytes << ")" << std::endl;
+    std::cout << " ---------------- " << std::endl;
+}
+
+void bench_string_interning() {
+    std::cout << "bench_string_interning => " << std::endl;
+    std::string records = make_records_corpus(20000);
+    std::string messages = make_messages_corpus(20000);
+    std::cout << "  corpus: records " << records.size() << " bytes, messages "
+        << messages.size() << " bytes" << std::endl;
+
+    report_memory("records, json::parse", records, [&records]() {
+        return Json::parse(records);
+    });
+    report_memory("records, json::parse_interned", records, [&records]() {
+        return Json::parse_interned(records.data(), records.size());
+    });
+    report_memory("messages, json::parse", messages, [&messages]() {
+        return Json::parse(messages);
+    });
+    report_memory("messages, json::parse_interned", messages, [&messages]() {
+        return Json::parse_interned(messages.data(), messages.size());
+    });
+
+    double parse = measure_seconds(5, [&records]() {
+        Json j = Json::parse(records);
+        assert(j.size() == 20000);
+    });
+    report_throughput("json::parse", records.size(), parse);
+    double interned = measure_seconds(5, [&records]() {
+        Json j = Json::parse_interned(records.data(), records.size());
+        assert(j.size() == 20000);
+    });
+    report_throughput("json::parse_interned", records.size(), interned);
+
+    // one pool shared by several documents, as a service would keep it
+    const int documents = 10;
+    std::string small = make_records_corpus(2000);
+    karl::string_pool pool;
+    std::vector<Json> plain_docs, pooled_docs;
+    size_t before = g_live_bytes.load();
+    for (int i = 0; i < documents; i++) {
+        plain_docs.push_back(Json::parse(small));
+    }
+    size_t plain_bytes = g_live_bytes.load() - before;
+    before = g_live_bytes.load();
+    for (int i = 0; i < documents; i++) {
+        pooled_docs.push_back(Json::parse_interned(small.data(), small.size(), &pool));
+    }
+    size_t pooled_bytes = g_live_bytes.load() - before;
+    assert(plain_docs.back().dump() == pooled_docs.back().dump());
+    std::cout << "  " << documents << " documents, shared pool: json::parse " << plain_bytes / 1024
+        << " KB, json::parse_interned " << pooled_bytes / 1024 << " KB (pool "
+        << pool.size() << " strings, " << pool.bytes() << " bytes)" << std::endl;
+    std::cout << " ---------------- " << std::endl;
+}
+
+// read every string value of every event
+size_t walk_strings(Json& j) {
+    static const char* fields[] = {"event", "kind", "device", "lang", "country", "session"};
+    size_t bytes = 0;
+    for (auto it = j.begin(); it != j.end(); ++it) {
+        Json& event = *it;
+        for (const char* field : fields) {
+            bytes += event[field].get<std::string>().size();
+        }
+        Json tags = event["tags"];
+        for (auto tag = tags.begin(); tag != tags.end(); ++tag) {
+            bytes += (*tag).get<std::string>().size();
+        }
+    }
+    return bytes;
+}
+
+void bench_short_strings() {
+    std::cout << "bench_short_strings => " << std::endl;
+    std::string corpus = make_short_strings_corpus(50000);
+    std::cout << "  corpus: " << corpus.size() << " bytes" << std::endl;
+
+    value_counter counter;
+    Json::parse(corpus, &counter);
+    size_t allocs = count_allocations([&corpus]() {
+        Json j = Json::parse(corpus);
+    });
+    std::cout << "  allocations, parse and destroy: " << allocs << " ("
+        << static_cast<double>(allocs) / counter.values << " per value, "
+        << counter.values << " values)" << std::endl;
+    report_memory("json::parse", corpus, [&corpus]() {
+        return Json::parse(corpus);
+    });
+
+    double parse = measure_seconds(5, [&corpus]() {
+        Json j = Json::parse(corpus);
+        assert(j.size() == 50000);
+    });
+    report_throughput("json::parse", corpus.size(), parse);
+
+    Json j = Json::parse(corpus);
+    size_t bytes = walk_strings(j);
+    double walk = measure_seconds(10, [&j]() { walk_strings(j); });
+    report_throughput("walk strings", corpus.size(), walk);
+    std::cout << "  string bytes read: " << bytes << std::endl;
+    std::cout << " ---------------- " << std::endl;
+}
+
+void bench_copy_on_write() {
+    std::cout << "bench_copy_on_write => " << std::endl;
+    // a template of 5000 records, every request changes two fields
+    std::string corpus = "{\"meta\":{\"request\":0,\"user\":\"\"},\"records\":"
+        + make_records_corpus(5000) + "}";
+    Json tmpl = Json::parse(corpus);
+    std::cout << "  template: " << corpus.size() << " bytes" << std::endl;
+
+    const int requests = 200;
+    auto per_request = [&tmpl](bool shared, int i) {
+        Json r = shared ? tmpl.copy_on_write() : tmpl.copy();
+        r["meta"]["request"] = i;
+        r["records"][i]["name"] = "changed";
+        return r;
+    };
+    size_t deep_allocs = count_allocations([&]() { per_request(false, 1); });
+    size_t cow_allocs = count_allocations([&]() { per_request(true, 1); });
+    std::cout << "  allocations per request: copy() " << deep_allocs
+        << ", copy_on_write() " << cow_allocs << std::endl;
+
+    double deep = measure_seconds(requests, [&]() { per_request(false, 1); });
+    double cow = measure_seconds(requests, [&]() { per_request(true, 1); });
+    std::cout << "  per request: copy() " << deep * 1e6 << " us, copy_on_write() "
+        << cow * 1e6 << " us" << std::endl;
+
+    Json r = per_request(true, 7);
+    assert(tmpl["records"][7]["name"].get<std::string>() == "user_7");
+    std::cout << "  template unchanged: " << tmpl["records"][7]["name"].get<std::string>()
+        << ", copy: " << r["records"][7]["name"].get<std::string>() << std::endl;
+    std::cout << " ---------------- " << std::endl;
+}
+
+// a telemetry frame: one sensor with a long run of samples
+std::string make_telemetry_corpus(size_t samples) {
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> reading(-40.0, 120.0);
+    char buff[32];
+    std::string s = "{\"sensor\":\"thermal-07\",\"unit\":\"celsius\",\"ticks\":[";
+    for (size_t i = 0; i < samples; i++) {
+        if (i) s += ",";
+        s += std::to_string(1700000000000 + i * 20);
+    }
+    s += "],\"samples\":[";
+    for (size_t i = 0; i < samples; i++) {
+        if (i) s += ",";
+        snprintf(buff, sizeof(buff), "%.6f", reading(rng));
+        s += buff;
+    }
+    s += "]}";
+    return s;
+}
+
+// the same array with one node per element
+karl::ref_ptr<karl::json_array> node_array(const std::vector<double>& values) {
+    auto arr = karl::New<karl::json_array>();
+    for (double v : values) {
+        arr->append(karl::json_number::create(v));
+    }
+    return arr;
+}
+
+void bench_packed_arrays() {
+    std::cout << "bench_packed_arrays => " << std::endl;
+    const size_t samples = 500000;
+    std::string corpus = make_telemetry_corpus(samples);
+    std::cout << "  corpus: " << corpus.size() << " bytes, " << samples * 2 << " numbers" << std::endl;
+
+    report_memory("json::parse", corpus, [&corpus]() {
+        return Json::parse(corpus);
+    });
+    double parse = measure_seconds(5, [&corpus]() {
+        Json j = Json::parse(corpus);
+        assert(j["samples"].size() == samples);
+    });
+    report_throughput("json::parse", corpus.size(), parse);
+
+    Json j = Json::parse(corpus);
+    double dump = measure_seconds(5, [&j]() { j.dump(); });
+    report_throughput("dump", corpus.size(), dump);
+    double cbor = measure_seconds(5, [&j]() { j.to_cbor(); });
+    report_throughput("to_cbor", corpus.size(), cbor);
+
+    Json arr = j["samples"];
+    double sum = 0;
+    double read = measure_seconds(5, [&arr, &sum]() {
+        for (size_t i = 0; i < samples; i++) {
+            sum += arr[i].get<double>();
+        }
+    });
+    std::cout << "  read by index: " << read * 1e9 / samples << " ns per element" << std::endl;
+
+    std::vector<double> values(samples);
+    for (size_t i = 0; i < samples; i++) {
+        values[i] = arr[i].get<double>();
+    }
+    size_t node_allocs = count_allocations([&values]() { node_array(values); });
+    size_t packed_allocs = count_allocations([&values]() { Json p(values); });
+    size_t before = g_live_bytes.load();
+    auto nodes = node_array(values);
+    size_t node_bytes = g_live_bytes.load() - before;
+    before = g_live_bytes.load();
+    Json packed(values);
+    size_t packed_bytes = g_live_bytes.load() - before;
+    std::cout << "  std::vector<double> of " << samples << ": one node each " << node_allocs
+        << " allocations, " << node_bytes / 1024 << " KB; packed " << packed_allocs
+        << " allocations, " << packed_bytes / 1024 << " KB" << std::endl;
+    std::cout << " ---------------- " << std::endl;
+}
+
+// access log records, every one with the same keys in the same order
+std::string make_access_log_corpus(size_t count) {
+    static const char* methods[] = {"GET", "POST", "PUT", "DELETE"};
+    std::string s = "[";
+    for (size_t i = 0; i < count; i++) {
+        if (i) s += ",";
+        s += "{\"ts\":" + std::to_string(1700000000 + i);
+        s += ",\"method\":\"" + std::string(methods[i % 4]) + "\"";
+        s += ",\"status\":" + std::to_string(i % 7 ? 200 : 404);
+        s += ",\"latency_ms\":" + std::to_string(i % 250);
+        s += ",\"upstream\":\"pod-" + std::to_string(i % 32) + "\"}";
+    }
+    s += "]";
+    return s;
+}
+
+// objects sharing one shape against objects holding their own members,
+// both with the same value nodes
+void bench_object_shapes() {
+    std::cout << "bench_object_shapes => " << std::endl;
+    const size_t records = 1000000;
+    std::string corpus = make_access_log_corpus(records);
+    std::cout << "  corpus: " << corpus.size() << " bytes, " << records << " records" << std::endl;
+    report_memory("json::parse", corpus, [&corpus]() {
+        return Json::parse(corpus);
+    });
+    double parse = measure_seconds(1, [&corpus]() {
+        Json j = Json::parse(corpus);
+        assert(j.size() == records);
+    });
+    report_throughput("json::parse", corpus.size(), parse);
+
+    const std::vector<std::string> keys = {"ts", "method", "status", "latency_ms", "upstream"};
+    std::vector<karl::ref_ptr<karl::json_value>> values;
+    for (size_t i = 0; i < 1000; i++) {
+        values.push_back(karl::New<karl::json_number>(static_cast<int64_t>(i)));
+    }
+
+    std::vector<karl::ref_ptr<karl::json_object>> members(records);
+    size_t before = g_live_bytes.load();
+    for (size_t i = 0; i < records; i++) {
+        members[i] = karl::New<karl::json_object>();
+        for (size_t k = 0; k < keys.size(); k++) {
+            members[i]->set_value(keys[k], values[(i + k) % values.size()]);
+        }
+    }
+    size_t member_bytes = g_live_bytes.load() - before;
+
+    std::vector<karl::ref_ptr<karl::json_object>> shaped(records);
+    karl::shape_table shapes;
+    before = g_live_bytes.load();
+    for (size_t i = 0; i < records; i++) {
+        karl::object_key names[5];
+        karl::ref_ptr<karl::json_value> slots[5];
+        for (size_t k = 0; k < keys.size(); k++) {
+            names[k] = karl::object_key(keys[k]);
+            slots[k] = values[(i + k) % values.size()];
+        }
+        shaped[i] = karl::New<karl::json_object>();
+        shaped[i]->adopt(shapes.find_or_add(names, keys.size()), slots);
+    }
+    size_t shaped_bytes = g_live_bytes.load() - before;
+    std::cout << "  memory, " << records << " objects of " << keys.size() << " members: own members "
+        << member_bytes / 1024 << " KB, shared shape " << shaped_bytes / 1024 << " KB" << std::endl;
+
+    size_t found = 0;
+    double member_find = measure_seconds(3, [&]() {
+        for (size_t i = 0; i < records; i++) {
+            found += members[i]->find("upstream") != nullptr;
+        }
+    });
+    double shaped_find = measure_seconds(3, [&]() {
+        for (size_t i = 0; i < records; i++) {
+            found += shaped[i]->find("upstream") != nullptr;
+        }
+    });
+    double cached_find = measure_seconds(3, [&]() {
+        const karl::object_shape* shape = nullptr;
+        size_t slot = 0;
+        for (size_t i = 0; i < records; i++) {
+            if (shaped[i]->shape() != shape) {
+                shape = shaped[i]->shape();
+                slot = shape->find("upstream", 8);
+            }
+            found += shaped[i]->value_at(slot) != nullptr;
+        }
+    });
+    std::cout << "  lookup of the last key: own members " << member_find * 1e9 / records
+        << " ns, shared shape " << shaped_find * 1e9 / records << " ns, slot cached by the caller "
+        << cached_find * 1e9 / records << " ns (checksum " << found << ")" << std::endl;
+    std::cout << " ---------------- " << std::endl;
+}
+
+// one output buffer for the whole tree against a string per node
+void bench_serializer() {
+    std::cout << "bench_serializer => " << std::endl;
+    const std::pair<std::string, std::string> corpora[] = {
+        {"records", make_records_corpus(20000)},
+        {"messages", make_messages_corpus(20000)},
+        {"coordinates", make_coordinates_corpus(100000)},
+    };
+    for (const auto& corpus : corpora) {
+        const std::string& text = corpus.second;
+        auto root = karl::text::parse_into_json_value(text.data(), text.size(), nullptr);
+        assert(root);
+        Json j(root);
+        std::string out = j.dump();
+        assert(legacy_dump(root.get(), -1, 0) == out);
+        for (int indent : {-1, 2}) {
+            std::string mode = corpus.first + (indent < 0 ? ", compact" : ", indent 2");
+            double legacy = measure_seconds(3, [&root, indent]() { legacy_dump(root.get(), indent, 0); });
+            double writer = measure_seconds(3, [&j, indent]() { j.dump(indent); });
+            report_throughput(mode + ", string per node", out.size(), legacy);
+            report_throughput(mode + ", one buffer", out.size(), writer);
+        }
+        size_t legacy_allocs = count_allocations([&root]() { legacy_dump(root.get(), -1, 0); });
+        size_t writer_allocs = count_allocations([&j]() { j.dump(); });
+        std::cout << "  " << corpus.first << ", allocations: string per node " << legacy_allocs
+            << ", one buffer " << writer_allocs << std::endl;
+    }
+    std::cout << " ---------------- " << std::endl;
+}
+
+// json_number text: shortest doubles and integers written into the
+// output buffer, against std::to_string
+void bench_number_formatting() {
+    std::cout << "bench_number_formatting => " << std::endl;
+    const size_t count = 1000000;
+    std::mt19937_64 rng(22);
+    std::uniform_real_distribution<double> coordinate(-180.0, 180.0);
+    std::vector<double> doubles(count);
+    std::vector<int64_t> integers(count);
+    for (size_t i = 0; i < count; i++) {
+        doubles[i] = coordinate(rng);
+        integers[i] = static_cast<int64_t>(rng() >> (rng() % 64));
+    }
+
+    size_t bytes = 0;
+    double to_string_doubles = measure_seconds(3, [&]() {
+        for (double d : doubles) {
+            bytes += std::to_string(d).size();
+        }
+    });
+    double format_doubles = measure_seconds(3, [&]() {
+        char buff[karl::numeric::max_number_size];
+        for (double d : doubles) {
+            bytes += karl::numeric::format_double(d, buff);
+        }
+    });
+    double to_string_integers = measure_seconds(3, [&]() {
+        for (int64_t v : integers) {
+            bytes += std::to_string(v).size();
+        }
+    });
+    double format_integers = measure_seconds(3, [&]() {
+        char buff[karl::numeric::max_number_size];
+        for (int64_t v : integers) {
+            bytes += karl::numeric::format_int64(v, buff);
+        }
+    });
+    std::cout << "  " << count << " doubles: std::to_string " << to_string_doubles * 1e9 / count
+        << " ns, format_double " << format_doubles * 1e9 / count << " ns each" << std::endl;
+    std::cout << "  " << count << " integers: std::to_string " << to_string_integers * 1e9 / count
+        << " ns, format_int64 " << format_integers * 1e9 / count << " ns each (checksum "
+        << bytes << ")" << std::endl;
+
+    // what std::to_string kept of the doubles
+    size_t exact = 0;
+    for (double d : doubles) {
+        exact += strtod(std::to_string(d).c_str(), nullptr) == d;
+    }
+    Json packed(doubles);
+    Json back = Json::parse(packed.dump());
+    size_t same = 0;
+    for (size_t i = 0; i < count; i++) {
+        same += back[i].get<double>() == doubles[i];
+    }
+    std::cout << "  exact after dump and parse: std::to_string " << exact << " of " << count
+        << ", json::dump " << same << " of " << count << std::endl;
+
+    std::string corpus = make_coordinates_corpus(200000);
+    Json j = Json::parse(corpus);
+    double dump = measure_seconds(5, [&j]() { j.dump(); });
+    report_throughput("coordinates, json::dump", corpus.size(), dump);
+    std::cout << " ---------------- " << std::endl;
+}
+
+// log lines of 40 to 400 bytes, one in four has a quote, a backslash
+// or a tab somewhere in it
+std::string make_log_lines_corpus(size_t count) {
+    static const char* words[] = {"request", "handled", "upstream", "server", "primary",
+        "region", "latency", "retry", "connection", "pool", "timeout", "cache"};
+    std::mt19937 rng(23);
+    std::string s = "[";
+    for (size_t i = 0; i < count; i++) {
+        if (i) s += ",";
+        s += "\"";
+        size_t n = 5 + rng() % 45;
+        for (size_t w = 0; w < n; w++) {
+            if (w) s += " ";
+            s += words[rng() % 12];
+        }
+        if (i % 4 == 0) {
+            static const char* escapes[] = {"\\\"quoted\\\"", "C:\\\\logs", "\\tcolumn"};
+            s += " ";
+            s += escapes[rng() % 3];
+        }
+        s += "\"";
+    }
+    s += "]";
+    return s;
+}
+
+// json_string text: runs that need no escaping found 16 or 32 bytes at a
+// time and copied at once, against a byte by byte escaper and a plain copy
+void bench_string_escaping() {
+    std::cout << "bench_string_escaping => kernel " << karl::text::structural_kernel_name() << std::endl;
+    std::string text = make_log_lines_corpus(100000);
+    Json j = Json::parse(text);
+    std::vector<std::string> lines;
+    for (auto it = j.begin(); it != j.end(); ++it) {
+        lines.push_back((*it).to_string());
+    }
+    std::string out = j.dump();
+    std::cout << "  strings: " << lines.size() << ", text: " << out.size() << " bytes" << std::endl;
+
+    double copy = measure_seconds(5, [&lines]() {
+        std::string buff;
+        for (const std::string& line : lines) {
+            buff.push_back('"');
+            buff.append(line);
+            buff.push_back('"');
+        }
+    });
+    double per_byte = measure_seconds(5, [&lines, &out]() {
+        std::string buff = "[";
+        for (size_t i = 0; i < lines.size(); i++) {
+            if (i) buff.push_back(',');
+            escape_per_byte(buff, lines[i].data(), lines[i].size());
+        }
+        buff.push_back(']');
+        assert(buff == out);
+    });
+    double writer = measure_seconds(5, [&j]() { j.dump(); });
+    report_throughput("copy, no escaping", out.size(), copy);
+    report_throughput("escape byte by byte", out.size(), per_byte);
+    report_throughput("json::dump", out.size(), writer);
+    std::cout << " ---------------- " << std::endl;
+}
+
+// json::dump_to: the text goes out through a fixed size buffer, against
+// json::dump building all of it in a string first
+void bench_streaming_dump() {
+    std::cout << "bench_streaming_dump => " << std::endl;
+    std::string corpus = make_records_corpus(200000);
+    Json j = Json::parse(corpus);
+    size_t size = j.dump().size();
+    std::cout << "  text: " << size << " bytes" << std::endl;
+
+    int fd = open("/dev/null", O_WRONLY);
+    assert(fd >= 0);
+    std::ofstream stream("/dev/null", std::ios::binary);
+    size_t received = 0;
+    Json::sink_callback count = [&received](const char*, size_t len) {
+        received += len;
+        return true;
+    };
+    size_t dump_peak = peak_allocated([&j, fd]() {
+        std::string text = j.dump();
+        ssize_t n = write(fd, text.data(), text.size());
+        (void)n;
+    });
+    size_t fd_peak = peak_allocated([&j, fd]() { j.dump_to(fd); });
+    size_t stream_peak = peak_allocated([&j, &stream]() { j.dump_to(stream); });
+    size_t sink_peak = peak_allocated([&j, &count]() { j.dump_to(count); });
+    assert(received == size);
+
+    double dump = measure_seconds(3, [&j, fd]() {
+        std::string text = j.dump();
+        ssize_t n = write(fd, text.data(), text.size());
+        (void)n;
+    });
+    double to_fd = measure_seconds(3, [&j, fd]() { j.dump_to(fd); });
+    double to_stream = measure_seconds(3, [&j, &stream]() { j.dump_to(stream); });
+    double to_sink = measure_seconds(3, [&j, &count]() { j.dump_to(count); });
+    report_throughput("json::dump, then write", size, dump);
+    report_throughput("json::dump_to(fd)", size, to_fd);
+    report_throughput("json::dump_to(ostream)", size, to_stream);
+    report_throughput("json::dump_to(callback)", size, to_sink);
+    std::cout << "  peak memory: json::dump " << dump_peak / 1024 << " KB, dump_to(fd) "
+        << fd_peak / 1024 << " KB, dump_to(ostream) " << stream_peak / 1024
+        << " KB, dump_to(callback) " << sink_peak / 1024 << " KB" << std::endl;
+    close(fd);
+    std::cout << " ---------------- " << std::endl;
+}
+
+// json::dump_size / cbor_size and writing into a buffer the caller owns,
+// against a new string or vector per call
+void bench_output_buffers() {
+    std::cout << "bench_output_buffers => " << std::endl;
+    std::string corpus = make_records_corpus(20000);
+    auto root = karl::text::parse_into_json_value(corpus.data(), corpus.size(), nullptr);
+    assert(root);
+    Json j(root);
+    size_t text_size = j.dump_size();
+    size_t cbor_size = j.cbor_size();
+    assert(text_size == j.dump().size() && cbor_size == root->to_cbor().size());
+    std::cout << "  text: " << text_size << " bytes, cbor: " << cbor_size << " bytes" << std::endl;
+
+    std::vector<char> text(text_size);
+    std::string reused;
+    double dump = measure_seconds(5, [&j]() { j.dump(); });
+    double measure = measure_seconds(5, [&j]() { j.dump_size(); });
+    double into = measure_seconds(5, [&j, &text]() { j.dump_into(text.data(), text.size()); });
+    double append = measure_seconds(5, [&j, &reused]() {
+        reused.clear();
+        j.dump_append(reused);
+    });
+    report_throughput("json::dump", text_size, dump);
+    report_throughput("json::dump_size", text_size, measure);
+    report_throughput("json::dump_into", text_size, into);
+    report_throughput("json::dump_append, reused string", text_size, append);
+
+    std::vector<uint8_t> bin(cbor_size);
+    std::vector<uint8_t> reused_bin;
+    double per_node = measure_seconds(5, [&root]() { root->to_cbor(); });
+    double to_cbor = measure_seconds(5, [&j]() { j.to_cbor(); });
+    double cbor_measure = measure_seconds(5, [&j]() { j.cbor_size(); });
+    double cbor_into = measure_seconds(5, [&j, &bin]() { j.to_cbor_into(bin.data(), bin.size()); });
+    double cbor_append = measure_seconds(5, [&j, &reused_bin]() {
+        reused_bin.clear();
+        j.to_cbor_append(reused_bin);
+    });
+    report_throughput("to_cbor, vector per node", cbor_size, per_node);
+    report_throughput("json::to_cbor", cbor_size, to_cbor);
+    report_throughput("json::cbor_size", cbor_size, cbor_measure);
+    report_throughput("json::to_cbor_into", cbor_size, cbor_into);
+    report_throughput("json::to_cbor_append, reused vector", cbor_size, cbor_append);
+
+    std::cout << "  allocations: dump " << count_allocations([&j]() { j.dump(); })
+        << ", dump_into " << count_allocations([&j, &text]() { j.dump_into(text.data(), text.size()); })
+        << ", dump_append " << count_allocations([&j, &reused]() { reused.clear(); j.dump_append(reused); })
+        << ", to_cbor per node " << count_allocations([&root]() { root->to_cbor(); })
+        << ", to_cbor " << count_allocations([&j]() { j.to_cbor(); })
+        << ", to_cbor_into " << count_allocations([&j, &bin]() { j.to_cbor_into(bin.data(), bin.size()); })
+        << std::endl;
+    std::cout << " ---------------- " << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    bench_parse_throughput();
+    bench_structural_index();
+    bench_number_parsing();
+    bench_parse_borrowed();
+    bench_push_parser();
+    bench_sax_aggregate();
+    bench_parse_many();
+    bench_parse_lazy();
+    bench_parse_projection();
+    bench_parse_parallel();
+    bench_compact_storage();
+    bench_arena_allocation();
+    bench_get_loop();
+    bench_object_layout();
+    bench_string_interning();
+    bench_short_strings();
+    bench_copy_on_write();
+    bench_packed_arrays();
+    bench_object_shapes();
+    bench_serializer();
+    bench_number_formatting();
+    bench_string_escaping();
+    bench_streaming_dump();
+    bench_output_buffers();
+    return 0;
+}
@@ -424,6 +424,502 @@ void test_json_parse_nlohmann_cbor_data() {
     std::cout << " ---------------- " << std::endl;
 }
 
+void test_json_parse_borrowed() {
+    std::cout << "test_json_parse_borrowed => " << std::endl;
+    // the buffer must outlive 'js', its strings point into it
+    std::string buff = "{\"session\":\"fee89343d998407a0dbc7e9b2ca16abf\",\"say\":\"\\\"hi\\\"\"}";
+    Json js = Json::parse_borrowed(buff.data(), buff.size());
+    Json bak = js.copy();  // owns its strings, independent of 'buff'
+    std::cout << js.dump() << std::endl;
+
+    if (js["session"].get<std::string>() == "fee89343d998407a0dbc7e9b2ca16abf" &&
+        js["say"].get<std::string>() == "\"hi\"" &&
+        bak["session"].get<std::string>() == js["session"].get<std::string>()) {
+        std::cout << "test_json_parse_borrowed success" << std::endl;
+    } else {
+        std::cout << "test_json_parse_borrowed failed" << std::endl;
+    }
+    std::cout << " ---------------- " << std::endl;
+}
+
+void test_json_push_parser() {
+    std::cout << "test_json_push_parser => " << std::endl;
+    // the document arrives in pieces, a token may be cut anywhere
+    const char* chunks[] = { "{\"na", "me\":\"ka", "rl\",\"ver", "sion\":10", "0,\"ok\":tr", "ue}" };
+    karl::parser p;
+    for (const char* chunk : chunks) {
+        p.feed(chunk, strlen(chunk));
+    }
+    Json js = p.finish();
+    std::cout << js.dump() << std::endl;
+
+    if (js["name"].get<std::string>() == "karl" && js["version"].get<int>() == 100 &&
+        js["ok"].get<bool>()) {
+        std::cout << "test_json_push_parser success" << std::endl;
+    } else {
+        std::cout << "test_json_push_parser failed" << std::endl;
+    }
+    std::cout << " ---------------- " << std::endl;
+}
+
+// counts the values of a document without building it
+class count_handler : public karl::sax_handler {
+public:
+    int numbers = 0;
+    int strings = 0;
+    int objects = 0;
+    bool on_int64(int64_t) override { numbers++; return true; }
+    bool on_uint64(uint64_t) override { numbers++; return true; }
+    bool on_double(double) override { numbers++; return true; }
+    bool on_string(const char*, size_t) override { strings++; return true; }
+    bool on_start_object() override { objects++; return true; }
+};
+
+void test_json_sax_handler() {
+    std::cout << "test_json_sax_handler => " << std::endl;
+    std::string s = "[{\"id\":1,\"name\":\"a\"},{\"id\":-2,\"name\":\"b\",\"score\":0.5}]";
+    count_handler handler;
+    bool ok = Json::parse(s, &handler);
+    std::cout << "numbers: " << handler.numbers << ", strings: " << handler.strings
+        << ", objects: " << handler.objects << std::endl;
+
+    if (ok && handler.numbers == 3 && handler.strings == 2 && handler.objects == 2) {
+        std::cout << "test_json_sax_handler success" << std::endl;
+    } else {
+        std::cout << "test_json_sax_handler failed" << std::endl;
+    }
+    std::cout << " ---------------- " << std::endl;
+}
+
+void test_json_parse_many() {
+    std::cout << "test_json_parse_many => " << std::endl;
+    std::string lines = "{\"id\":1}\n{\"id\":2}\n[3, \"a b\"]  {\"id\":\"}{\"}\n";
+    std::vector<Json> docs = Json::parse_many(lines.data(), lines.size());
+    for (auto& doc : docs) {
+        std::cout << doc.dump() << std::endl;
+    }
+
+    size_t ids = 0;
+    Json::parse_many(lines.data(), lines.size(), [&ids](Json& doc) {
+        if (doc.is_object()) ids++;
+        return true;
+    });
+
+    if (docs.size() == 4 && docs[1]["id"].get<int>() == 2 &&
+        docs[3]["id"].get<std::string>() == "}{" && ids == 3) {
+        std::cout << "test_json_parse_many success" << std::endl;
+    } else {
+        std::cout << "test_json_parse_many failed" << std::endl;
+    }
+    std::cout << " ---------------- " << std::endl;
+}
+
+void test_json_parse_many_broken_record() {
+    std::cout << "test_json_parse_many_broken_record => " << std::endl;
+    // a truncated record fails on its own, the records after it are read
+    std::string lines = "{\"id\":1}\n{\"id\":2,\"tags\":[\"a\"\n{\"id\":3}\n"
+        "{\"id\":4,\"name\":\"cut\n{\"id\":5}\n{\n  \"id\": 6\n}\n";
+    std::vector<Json> docs = Json::parse_many(lines.data(), lines.size());
+    int sum = 0;
+    size_t broken = 0;
+    for (auto& doc : docs) {
+        std::cout << doc.dump() << std::endl;
+        if (doc.is_object()) {
+            sum += doc["id"].get<int>();
+        } else {
+            broken++;
+        }
+    }
+
+    if (docs.size() == 6 && broken == 2 && sum == 1 + 3 + 5 + 6) {
+        std::cout << "test_json_parse_many_broken_record success" << std::endl;
+    } else {
+        std::cout << "test_json_parse_many_broken_record failed" << std::endl;
+    }
+    std::cout << " ---------------- " << std::endl;
+}
+
+void test_json_parse_lazy() {
+    std::cout << "test_json_parse_lazy => " << std::endl;
+    std::string s = "{\"user\":{\"id\":7,\"name\":\"karl\"},\"logs\":[[1,2,3],[4,5,6]],\"tags\":[\"a\"]}";
+    // nothing but the structural index is built here
+    Json js = Json::parse_lazy(s.data(), s.size());
+    // expands the root and "user", "logs" and "tags" stay untouched
+    int id = js["user"]["id"].get<int>();
+    std::cout << "id: " << id << ", dump: " << js.dump() << std::endl;
+
+    if (id == 7 && js["logs"][1][2].get<int>() == 6 && js["tags"].size() == 1) {
+        std::cout << "test_json_parse_lazy success" << std::endl;
+    } else {
+        std::cout << "test_json_parse_lazy failed" << std::endl;
+    }
+    std::cout << " ---------------- " << std::endl;
+}
+
+void test_json_parse_projection() {
+    std::cout << "test_json_parse_projection => " << std::endl;
+    std::string s = "{\"user\":{\"id\":7,\"name\":\"karl\"},\"items\":[{\"price\":1.5,\"sku\":\"a\"},"
+        "{\"price\":2,\"sku\":\"b\"}],\"blob\":[[1,2],{\"x\":null}]}";
+    Json js = Json::parse(s, {"/user/id", "/items/*/price"});
+    std::cout << js.dump() << std::endl;
+
+    if (js["user"]["id"].get<int>() == 7 && !js["user"].has_key("name") &&
+        js["items"][1]["price"].get<int>() == 2 && !js.has_key("blob")) {
+        std::cout << "test_json_parse_projection success" << std::endl;
+    } else {
+        std::cout << "test_json_parse_projection failed" << std::endl;
+    }
+    std::cout << " ---------------- " << std::endl;
+}
+
+void test_json_parse_parallel() {
+    std::cout << "test_json_parse_parallel => " << std::endl;
+    std::string s = "{\"count\":3,\"data\":[{\"id\":1},{\"id\":2},{\"id\":3}]}";
+    // split the "data" array (one level down) across 2 threads,
+    // arrays this small are simply read on the calling thread
+    Json js = Json::parse_parallel(s.data(), s.size(), 2, 1);
+    std::cout << js.dump() << std::endl;
+
+    if (js["data"].size() == 3 && js["data"][2]["id"].get<int>() == 3) {
+        std::cout << "test_json_parse_parallel success" << std::endl;
+    } else {
+        std::cout << "test_json_parse_parallel failed" << std::endl;
+    }
+    std::cout << " ---------------- " << std::endl;
+}
+
+void test_json_parse_compact() {
+    std::cout << "test_json_parse_compact => " << std::endl;
+    std::string s = "{\"user\":{\"id\":7,\"name\":\"karl\"},\"scores\":[1.5,2,3],"
+        "\"motto\":\"strings over fourteen bytes live outside the tape\"}";
+    Json js = Json::parse_compact(s.data(), s.size());
+    double total = 0;
+    for (auto it = js["scores"].begin(); it != js["scores"].end(); ++it) {
+        total += it->get<double>();
+    }
+    std::cout << "total: " << total << ", dump: " << js.dump() << std::endl;
+
+    // the document is read-only, copy() gives a json that can be changed
+    bool read_only = false;
+    try {
+        js["user"]["id"] = 8;
+    } catch (karl::other_error&) {
+        read_only = true;
+    }
+    Json copy = js.copy();
+    copy["user"]["id"] = 8;
+
+    if (total == 6.5 && js["user"]["name"].get<std::string>() == "karl" && read_only &&
+        js["user"]["id"].get<int>() == 7 && copy["user"]["id"].get<int>() == 8) {
+        std::cout << "test_json_parse_compact success" << std::endl;
+    } else {
+        std::cout << "test_json_parse_compact failed" << std::endl;
+    }
+    std::cout << " ---------------- " << std::endl;
+}
+
+void test_json_parse_arena() {
+    std::cout << "test_json_parse_arena => " << std::endl;
+    std::string s = "{\"servers\":[{\"host\":\"alpha.example.com\",\"port\":8080},"
+        "{\"host\":\"beta.example.com\",\"port\":8081}]}";
+    Json server;
+    {
+        // every node of the document comes from the same few blocks
+        Json js = Json::parse_arena(s.data(), s.size());
+        js["servers"][0]["port"] = 9090;
+        server = js["servers"][1];
+    }
+    // a value taken from the document keeps its arena alive
+    std::cout << server.dump() << std::endl;
+
+    if (server["host"].get<std::string>() == "beta.example.com" && server["port"].get<int>() == 8081) {
+        std::cout << "test_json_parse_arena success" << std::endl;
+    } else {
+        std::cout << "test_json_parse_arena failed" << std::endl;
+    }
+    std::cout << " ---------------- " << std::endl;
+}
+
+void test_json_copy_on_write() {
+    std::cout << "test_json_copy_on_write => " << std::endl;
+    Json js = Json::parse("{\"name\":\"karl\",\"tags\":[\"a\",\"b\"],\"inner\":{\"level\":1,\"list\":[1,2]}}");
+    Json before = js["inner"]["list"];
+    Json cow = js.copy_on_write();
+    cow["inner"]["level"] = 2;
+    cow["tags"][0] = "z";
+    cow["extra"] = true;
+    // the original can still be changed on its own
+    js["name"] = "shadow";
+    std::cout << "original: " << js.dump() << std::endl;
+    std::cout << "copy: " << cow.dump() << std::endl;
+
+    // a json copied from either side changes that side
+    Json handle = cow;
+    handle["count"] = 3;
+    Json original = js;
+    original["count"] = 4;
+    // a json taken two levels down before the call is read-only
+    bool read_only = false;
+    try {
+        before[0] = 99;
+    } catch (karl::other_error&) {
+        read_only = true;
+    }
+
+    if (js.dump() == "{\"name\":\"shadow\",\"tags\":[\"a\",\"b\"],\"inner\":{\"level\":1,\"list\":[1,2]},\"count\":4}" &&
+        cow.dump() == "{\"name\":\"karl\",\"tags\":[\"z\",\"b\"],\"inner\":{\"level\":2,\"list\":[1,2]},"
+            "\"extra\":true,\"count\":3}" && read_only) {
+        std::cout << "test_json_copy_on_write success" << std::endl;
+    } else {
+        std::cout << "test_json_copy_on_write failed" << std::endl;
+    }
+    std::cout << " ---------------- " << std::endl;
+}
+
+void test_json_packed_array() {
+    std::cout << "test_json_packed_array => " << std::endl;
+    Json js = Json::parse("{\"d\":[1.5,2.5,3.5],\"i\":[1,2,3]}");
+    // numbers are changed in place, anything else unpacks the array
+    js["d"][0] = 9.5;
+    js["i"][1] = 20;
+    js["i"][2] = "three";
+    js["i"][4] = 5;
+    std::cout << "dump: " << js.dump() << std::endl;
+
+    Json built = std::vector<int>{1, 2, 3};
+    built[0] = 0.5;
+
+    // a json assigned from an element refers to it whether the parser
+    // packed the array or not
+    std::string s = "{\"k\":[30,-2]}";
+    Json packed = Json::parse(s);
+    Json nodes = Json::parse_lazy(s.data(), s.size());
+    Json element;
+    element = packed["k"][0];
+    element = 37;
+    element = nodes["k"][0];
+    element = 37;
+    std::cout << "packed: " << packed.dump() << ", nodes: " << nodes.dump() << std::endl;
+
+    if (js.dump() == "{\"d\":[9.5,2.5,3.5],\"i\":[1,20,\"three\",null,5]}" &&
+        js["i"][2].is_string() && js["i"][3].is_null() && js["d"][0].get<double>() == 9.5 &&
+        built.dump() == "[0.5,2,3]" && packed.dump() == "{\"k\":[37,-2]}" &&
+        nodes.dump() == packed.dump()) {
+        std::cout << "test_json_packed_array success" << std::endl;
+    } else {
+        std::cout << "test_json_packed_array failed" << std::endl;
+    }
+    std::cout << " ---------------- " << std::endl;
+}
+
+void test_json_parse_interned() {
+    std::cout << "test_json_parse_interned => " << std::endl;
+    karl::string_pool pool;
+    std::string first = "{\"a_key_longer_than_inline_storage\":\"ok\",\"status\":\"ok\"}";
+    std::string second = "{\"a_key_longer_than_inline_storage\":\"ok\",\"status\":\"error\"}";
+    Json one = Json::parse_interned(first.data(), first.size(), &pool);
+    Json two = Json::parse_interned(second.data(), second.size(), &pool);
+    // a shared string is replaced, the other document keeps its value
+    two["a_key_longer_than_inline_storage"] = "changed";
+    std::cout << "pool strings: " << pool.size() << std::endl;
+    std::cout << one.dump() << std::endl << two.dump() << std::endl;
+
+    // assigning through a json that holds the value works like for parse()
+    Json plain = Json::parse(first);
+    Json value;
+    value = plain["status"];
+    value = "done";
+    value = one["status"];
+    value = "done";
+
+    if (pool.size() > 0 && one["a_key_longer_than_inline_storage"].get<std::string>() == "ok" &&
+        two["a_key_longer_than_inline_storage"].get<std::string>() == "changed" &&
+        two["status"].get<std::string>() == "error" && plain["status"].get<std::string>() == "done" &&
+        one.dump() == plain.dump()) {
+        std::cout << "test_json_parse_interned success" << std::endl;
+    } else {
+        std::cout << "test_json_parse_interned failed" << std::endl;
+    }
+    std::cout << " ---------------- " << std::endl;
+}
+
+void test_json_big_integers() {
+    std::cout << "test_json_big_integers => " << std::endl;
+    // integers above 2^53 do not fit in a double, they are kept exactly
+    std::string s = "{\"odd\":9007199254740993,\"max\":18446744073709551615,"
+        "\"min\":-9223372036854775807,\"zero\":-0,\"tiny\":5e-324,\"big\":1.7976931348623157e308}";
+    Json js = Json::parse(s);
+    std::cout << "dump: " << js.dump() << std::endl;
+
+    Json again = Json::parse(js.dump());
+    if (js["odd"].get<uint64_t>() == 9007199254740993ULL &&
+        js["max"].get<uint64_t>() == 18446744073709551615ULL &&
+        js["min"].get<int64_t>() == -9223372036854775807LL &&
+        js["zero"].get<int>() == 0 && js["tiny"].get<double>() == 5e-324 &&
+        js["big"].get<double>() == 1.7976931348623157e308 &&
+        again["odd"].get<uint64_t>() == 9007199254740993ULL &&
+        again["max"].get<uint64_t>() == 18446744073709551615ULL &&
+        again["min"].get<int64_t>() == -9223372036854775807LL &&
+        again.dump() == js.dump()) {
+        std::cout << "test_json_big_integers success" << std::endl;
+    } else {
+        std::cout << "test_json_big_integers failed" << std::endl;
+    }
+    std::cout << " ---------------- " << std::endl;
+}
+
+void test_json_number_edge_cases() {
+    std::cout << "test_json_number_edge_cases => " << std::endl;
+    // numbers json does not allow give an empty json
+    bool rejected = true;
+    const char* invalid[] = {"[01]", "[1.]", "[.5]", "[-]", "[1e]", "[+1]", "[0x10]"};
+    for (auto text : invalid) {
+        if (!Json::parse(text).empty()) {
+            rejected = false;
+            std::cout << "accepted: " << text << std::endl;
+        }
+    }
+
+    // the nearest double, including the forms at the edges of the range
+    Json js = Json::parse("[1E2,-0.0,2.2250738585072014e-308,0.1e1,123456789012345678901234567890]");
+    std::cout << "dump: " << js.dump() << std::endl;
+
+    if (rejected && js[0].get<double>() == 100 && js[1].get<double>() == 0 &&
+        js[2].get<double>() == 2.2250738585072014e-308 && js[3].get<double>() == 1 &&
+        js[4].get<double>() == 1.2345678901234568e29) {
+        std::cout << "test_json_number_edge_cases success" << std::endl;
+    } else {
+        std::cout << "test_json_number_edge_cases failed" << std::endl;
+    }
+    std::cout << " ---------------- " << std::endl;
+}
+
+void test_json_shaped_object() {
+    std::cout << "test_json_shaped_object => " << std::endl;
+    // the records share their key set until one of them changes it
+    Json js = Json::parse("[{\"id\":1,\"name\":\"a\"},{\"id\":2,\"name\":\"b\"},{\"id\":3,\"name\":\"c\"}]");
+    js[0]["email"] = "a@example.com";
+    js[1].erase("name");
+    js[2]["id"] = 30;
+    std::cout << "dump: " << js.dump() << std::endl;
+
+    if (js.dump() == "[{\"id\":1,\"name\":\"a\",\"email\":\"a@example.com\"},{\"id\":2},"
+            "{\"id\":30,\"name\":\"c\"}]" &&
+        js[0].size() == 3 && js[1].size() == 1 && !js[1].has_key("name") &&
+        !js[2].has_key("email") && js[2]["name"].get<std::string>() == "c") {
+        std::cout << "test_json_shaped_object success" << std::endl;
+    } else {
+        std::cout << "test_json_shaped_object failed" << std::endl;
+    }
+    std::cout << " ---------------- " << std::endl;
+}
+
+void test_json_format_double() {
+    std::cout << "test_json_format_double => " << std::endl;
+    // doubles are written with the fewest digits that read back the same
+    Json js = Json::parse("[0.1,1e300,-2.5e-8,123456.789,5e-324,0.30000000000000004]");
+    std::cout << "dump: " << js.dump() << std::endl;
+    bool round_trip = true;
+    Json again = Json::parse(js.dump());
+    for (size_t i = 0; i < js.size(); i++) {
+        if (again[i].get<double>() != js[i].get<double>()) {
+            round_trip = false;
+        }
+    }
+
+    if (round_trip && js[0].dump() == "0.1" && js[5].dump() == "0.30000000000000004") {
+        std::cout << "test_json_format_double success" << std::endl;
+    } else {
+        std::cout << "test_json_format_double failed" << std::endl;
+    }
+    std::cout << " ---------------- " << std::endl;
+}
+
+void test_json_string_escaping() {
+    std::cout << "test_json_string_escaping => " << std::endl;
+    Json js;
+    js["text"] = std::string("quote\" backslash\\ newline\n tab\t control\x01 end");
+    js["key\"with\\escapes"] = "plain text that is long enough to take the vector path";
+    std::string out = js.dump();
+    std::cout << "dump: " << out << std::endl;
+
+    Json again = Json::parse(out);
+    if (out == "{\"text\":\"quote\\\" backslash\\\\ newline\\n tab\\t control\\u0001 end\","
+            "\"key\\\"with\\\\escapes\":\"plain text that is long enough to take the vector path\"}" &&
+        again["text"].get<std::string>() == js["text"].get<std::string>() &&
+        again.has_key("key\"with\\escapes")) {
+        std::cout << "test_json_string_escaping success" << std::endl;
+    } else {
+        std::cout << "test_json_string_escaping failed" << std::endl;
+    }
+    std::cout << " ---------------- " << std::endl;
+}
+
+void test_json_dump_to() {
+    std::cout << "test_json_dump_to => " << std::endl;
+    Json js;
+    for (int i = 0; i < 20000; i++) {
+        js[i] = "element " + std::to_string(i);
+    }
+    std::string text;
+    bool complete = js.dump_to([&text](const char* ptr, size_t len) {
+        text.append(ptr, len);
+        return true;
+    });
+    // the writer stops at the first piece the sink refuses
+    size_t calls = 0;
+    bool stopped = !js.dump_to([&calls](const char*, size_t) {
+        calls++;
+        return false;
+    });
+    std::cout << "bytes: " << text.size() << ", calls before stop: " << calls << std::endl;
+
+    if (complete && text == js.dump() && stopped && calls == 1) {
+        std::cout << "test_json_dump_to success" << std::endl;
+    } else {
+        std::cout << "test_json_dump_to failed" << std::endl;
+    }
+    std::cout << " ---------------- " << std::endl;
+}
+
+void test_json_output_size() {
+    std::cout << "test_json_output_size => " << std::endl;
+    std::string s = "{\"name\":\"karl\\n\",\"values\":[1,-2,3.25,18446744073709551615],"
+        "\"nested\":{\"ok\":true,\"none\":null,\"text\":\"a string over fourteen bytes\"}}";
+    Json tree = Json::parse(s);
+    Json compact = Json::parse_compact(s.data(), s.size());
+    bool sizes = true;
+    Json docs[] = {tree, compact};
+    for (auto& js : docs) {
+        for (int indent = -1; indent <= 4; indent += 5) {
+            std::string text = js.dump(indent);
+            std::vector<char> buff(text.size());
+            // the text fits exactly, one byte less is refused
+            if (js.dump_size(indent) != text.size() ||
+                js.dump_into(buff.data(), buff.size(), indent) != text.size() ||
+                std::string(buff.data(), buff.size()) != text ||
+                js.dump_into(buff.data(), buff.size() - 1, indent) != 0) {
+                sizes = false;
+            }
+        }
+        std::vector<uint8_t> cbor = js.to_cbor();
+        std::vector<uint8_t> bin(cbor.size());
+        if (js.cbor_size() != cbor.size() ||
+            js.to_cbor_into(bin.data(), bin.size()) != cbor.size() || bin != cbor ||
+            js.to_cbor_into(bin.data(), bin.size() - 1) != 0) {
+            sizes = false;
+        }
+    }
+    std::cout << "dump_size: " << tree.dump_size() << ", cbor_size: " << tree.cbor_size() << std::endl;
+
+    if (sizes) {
+        std::cout << "test_json_output_size success" << std::endl;
+    } else {
+        std::cout << "test_json_output_size failed" << std::endl;
+    }
+    std::cout << " ---------------- " << std::endl;
+}
+
 int main(int argc, char* argv[]) {
     test_json_object_parse();
     test_json_array_parse();
@@ -442,6 +938,26 @@ int main(int argc, char* argv[]) {
     test_json_object_deep_copy();
     test_json_cbor_encode_and_decode();
     test_json_parse_nlohmann_cbor_data();
+    test_json_parse_borrowed();
+    test_json_push_parser();
+    test_json_sax_handler();
+    test_json_parse_many();
+    test_json_parse_many_broken_record();
+    test_json_parse_lazy();
+    test_json_parse_projection();
+    test_json_parse_parallel();
+    test_json_parse_compact();
+    test_json_parse_arena();
+    test_json_parse_interned();
+    test_json_copy_on_write();
+    test_json_packed_array();
+    test_json_big_integers();
+    test_json_number_edge_cases();
+    test_json_shaped_object();
+    test_json_format_double();
+    test_json_string_escaping();
+    test_json_dump_to();
+    test_json_output_size();
     getchar();
     return 0;
 }
@@ -24,7 +24,9 @@
 #include <stdint.h>
 #include <string.h>
 #include <algorithm>
+#include <atomic>
 #include <exception>
+#include <functional>
 #include <iostream>
 #include <initializer_list>
 #include <memory>
@@ -130,9 +132,123 @@ private:
 
 // ---------------------------------------------------------------------------------
 
+// ---------------------------  reference counting  ---------------------------------
+
+// Base of the objects owned through ref_ptr: the reference count lives in
+// the object itself. It is atomic unless the library and all of its users
+// are built with KARL_NONATOMIC_REFCOUNT, which is only safe when a json
+// value is never shared by threads running at the same time (parse_many
+// and parse_parallel hand their values over after the workers finish).
+class ref_counted {
+public:
+    void add_ref() const noexcept {
+#ifdef KARL_NONATOMIC_REFCOUNT
+        ++_refs;
+#else
+        _refs.fetch_add(1, std::memory_order_relaxed);
+#endif
+    }
+    void release() const noexcept {
+#ifdef KARL_NONATOMIC_REFCOUNT
+        if (--_refs == 0) {
+            destroy();
+        }
+#else
+        if (_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            destroy();
+        }
+#endif
+    }
+
+protected:
+    ref_counted() noexcept : _refs(0) {}
+    // a copy starts without references
+    ref_counted(const ref_counted&) noexcept : _refs(0) {}
+    ref_counted& operator= (const ref_counted&) noexcept { return *this; }
+    virtual ~ref_counted() = default;
+
+    // called when the last reference is gone
+    virtual void destroy() const noexcept { delete this; }
+
+private:
+#ifdef KARL_NONATOMIC_REFCOUNT
+    mutable size_t _refs;
+#else
+    mutable std::atomic<size_t> _refs;
+#endif
+};
+
+// Smart pointer to a ref_counted object, one pointer wide. It only needs
+// the complete type of T where the pointee is accessed.
+template <typename T>
+class ref_ptr {
+public:
+    ref_ptr() noexcept : _ptr(nullptr) {}
+    ref_ptr(std::nullptr_t) noexcept : _ptr(nullptr) {}
+    explicit ref_ptr(T* ptr) noexcept : _ptr(ptr) {
+        if (_ptr) _ptr->add_ref();
+    }
+    ref_ptr(const ref_ptr& other) noexcept : _ptr(other._ptr) {
+        if (_ptr) _ptr->add_ref();
+    }
+    ref_ptr(ref_ptr&& other) noexcept : _ptr(other._ptr) {
+        other._ptr = nullptr;
+    }
+    template <typename U, typename = typename std::enable_if<std::is_convertible<U*, T*>::value>::type>
+    ref_ptr(const ref_ptr<U>& other) noexcept : _ptr(other.get()) {
+        if (_ptr) _ptr->add_ref();
+    }
+    template <typename U, typename = typename std::enable_if<std::is_convertible<U*, T*>::value>::type>
+    ref_ptr(ref_ptr<U>&& other) noexcept : _ptr(other.detach()) {}
+    ~ref_ptr() {
+        if (_ptr) _ptr->release();
+    }
+
+    ref_ptr& operator= (const ref_ptr& other) noexcept {
+        ref_ptr(other).swap(*this);
+        return *this;
+    }
+    ref_ptr& operator= (ref_ptr&& other) noexcept {
+        ref_ptr(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    void reset() noexcept { ref_ptr().swap(*this); }
+    void swap(ref_ptr& other) noexcept { std::swap(_ptr, other._ptr); }
+
+    // give up the reference without releasing it
+    T* detach() noexcept {
+        T* ptr = _ptr;
+        _ptr = nullptr;
+        return ptr;
+    }
+
+    T* get() const noexcept { return _ptr; }
+    T* operator-> () const noexcept { return _ptr; }
+    T& operator* () const noexcept { return *_ptr; }
+    explicit operator bool() const noexcept { return _ptr != nullptr; }
+
+private:
+    T* _ptr;
+};
+
+template <typename T, typename U>
+inline bool operator== (const ref_ptr<T>& a, const ref_ptr<U>& b) { return a.get() == b.get(); }
+template <typename T, typename U>
+inline bool operator!= (const ref_ptr<T>& a, const ref_ptr<U>& b) { return a.get() != b.get(); }
+template <typename T>
+inline bool operator== (const ref_ptr<T>& a, std::nullptr_t) { return !a; }
+template <typename T>
+inline bool operator!= (const ref_ptr<T>& a, std::nullptr_t) { return static_cast<bool>(a); }
+
+// Downcast of a json value that is checked against its type tag
+// instead of RTTI, nullptr if the value is of another type.
 template <typename X, typename Y>
-inline std::shared_ptr<X> As(const std::shared_ptr<Y>& ptr) {
-    return std::dynamic_pointer_cast<X>(ptr);
+inline ref_ptr<X> As(const ref_ptr<Y>& ptr) {
+    if (ptr && ptr->type() == X::kType) {
+        return ref_ptr<X>(static_cast<X*>(ptr.get()));
+    }
+    return ref_ptr<X>();
 }
 
 template<class _Ty>
@@ -189,14 +305,181 @@ struct check_integer_type
 
 // ---------------------------------------------------------------------------------
 
-class json_value;
-using sequence = std::vector<std::shared_ptr<json_value>>;
-using array_iterator = sequence::iterator;
-
-enum class value_type {
+enum class value_type : uint8_t {
     kNull, kBoolean, kNumber, kString, kArray, kObject
 };
 
+// Base of the nodes of a json tree (see src/karl.h). The type is stored in
+// the node, reading it is neither a virtual call nor RTTI.
+class json_value : public ref_counted {
+public:
+    value_type type() const { return _type; }
+    // changes whenever an array or object gains or loses entries,
+    // the addresses of its slots stay valid until then
+    uint32_t version() const { return _version; }
+    // A shared node is held by more than one document (json::copy_on_write,
+    // string_pool) and is never modified again: a change replaces it by a
+    // clone in its own document. Sharing cannot be undone.
+    bool is_shared() const { return _shared.load(std::memory_order_relaxed); }
+    void share() const { _shared.store(true, std::memory_order_relaxed); }
+    virtual std::string dump() const = 0;
+    virtual std::string dump(int indent, int prefix) const = 0;
+    virtual bool empty() const = 0;
+    virtual ref_ptr<json_value> copy() const = 0;
+    virtual std::vector<uint8_t> to_cbor() const = 0;
+
+protected:
+    explicit json_value(value_type type) : _type(type), _shared(false), _version(0) {}
+    // a copy is not shared
+    json_value(const json_value& other) noexcept
+        : ref_counted(other), _type(other._type), _shared(false), _version(0) {}
+    json_value& operator= (const json_value&) noexcept { return *this; }
+
+    value_type _type;
+    mutable std::atomic<bool> _shared;
+    mutable uint32_t _version;
+};
+
+class shared_string;
+
+// Key of an object member, also held by a json that refers to a member.
+// Keys of up to 15 bytes are stored inline, longer ones in a shared_string
+// (see src/karl.h) which copies share and which remembers its hash.
+class object_key final {
+public:
+    static const size_t max_inline = 15;
+
+    object_key() noexcept : _tag(kNone) {}
+    object_key(const char* ptr, size_t len);
+    explicit object_key(const std::string& key) : object_key(key.data(), key.size()) {}
+    // takes the reference of a string that is shared, e.g. by a string_pool
+    explicit object_key(ref_ptr<shared_string> key);
+    object_key(const object_key& other);
+    object_key(object_key&& other) noexcept : _tag(kNone) {
+        copy_bytes(other);
+        other._tag = kNone;
+    }
+    object_key& operator= (const object_key& other);
+    object_key& operator= (object_key&& other) noexcept;
+    ~object_key() { reset(); }
+    void swap(object_key& other) noexcept;
+
+    bool empty() const { return _tag == kNone; }
+    const char* data() const;
+    size_t size() const;
+    size_t hash() const;
+    std::string str() const { return std::string(data(), size()); }
+    bool equals(const char* ptr, size_t len) const {
+        return size() == len && memcmp(data(), ptr, len) == 0;
+    }
+
+private:
+    void reset();
+    shared_string* shared() const;
+    // the bytes in use and the tag of 'other', no reference is taken
+    void copy_bytes(const object_key& other) noexcept {
+        if (other._tag == kShared) {
+            memcpy(_buf, other._buf, sizeof(shared_string*));
+        } else if (other._tag != kNone) {
+            memcpy(_buf, other._buf, other._tag);
+        }
+        _tag = other._tag;
+    }
+
+    static const uint8_t kShared = 0xff;
+    static const uint8_t kNone = 0xfe;
+
+    char _buf[15];
+    uint8_t _tag;   // length of an inline key, kShared or kNone
+};
+
+class json_string;
+
+// Pool of strings shared by the documents parsed with it (json::parse_interned):
+// object keys longer than object_key::max_inline share their bytes, string
+// values of up to max_value_size bytes share one read-only node. Parsed
+// values keep their strings after the pool is cleared or destroyed. It is
+// thread safe; documents sharing a pool must not be built with
+// KARL_NONATOMIC_REFCOUNT if they are used by several threads.
+class string_pool final {
+public:
+    static const size_t max_value_size = 32;
+
+    // once 'capacity' distinct strings are held, new ones are not shared
+    explicit string_pool(size_t capacity = 65536);
+    ~string_pool();
+
+    string_pool(const string_pool&) = delete;
+    string_pool& operator= (const string_pool&) = delete;
+
+    // distinct strings held, and the bytes of their text
+    size_t size() const;
+    size_t bytes() const;
+    void clear();
+
+    // used by the parser, nullptr when the string is not shared
+    ref_ptr<shared_string> key(const char* ptr, size_t len);
+    ref_ptr<json_string> value(const char* ptr, size_t len);
+
+private:
+    struct impl;
+    std::unique_ptr<impl> _impl;
+};
+
+namespace text { class PushReader; }
+namespace tape { class Document; }
+namespace memory { class Arena; }
+
+void* arena_allocate(memory::Arena* arena, size_t size, size_t align);
+
+// Allocator of the element and member storage of arrays and objects.
+// The containers of a json::parse_arena document take their memory from
+// its arena, all others from the heap. Copies always go to the heap.
+template <typename T>
+class arena_allocator {
+public:
+    typedef T value_type;
+
+    arena_allocator() noexcept : _arena(nullptr) {}
+    explicit arena_allocator(memory::Arena* arena) noexcept : _arena(arena) {}
+    template <typename U>
+    arena_allocator(const arena_allocator<U>& other) noexcept : _arena(other.arena()) {}
+
+    T* allocate(size_t n) {
+        if (_arena) {
+            return static_cast<T*>(arena_allocate(_arena, n * sizeof(T), alignof(T)));
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    void deallocate(T* ptr, size_t) noexcept {
+        if (!_arena) {
+            ::operator delete(ptr);
+        }
+    }
+    arena_allocator select_on_container_copy_construction() const {
+        return arena_allocator();
+    }
+
+    memory::Arena* arena() const noexcept { return _arena; }
+
+private:
+    memory::Arena* _arena;
+};
+
+template <typename T, typename U>
+inline bool operator== (const arena_allocator<T>& a, const arena_allocator<U>& b) {
+    return a.arena() == b.arena();
+}
+template <typename T, typename U>
+inline bool operator!= (const arena_allocator<T>& a, const arena_allocator<U>& b) {
+    return a.arena() != b.arena();
+}
+
+using sequence = std::vector<ref_ptr<json_value>, arena_allocator<ref_ptr<json_value>>>;
+using array_iterator = sequence::iterator;
+
+class json_array;
+
 // ---------------------------------------------------------------------------------
 
 class key_value_pair final {
@@ -232,25 +515,148 @@ public:
 
     key_value_pair(const std::string& key, const std::vector<std::string>& value);
     key_value_pair(const std::string& key, const std::vector<double>& value);
+    key_value_pair(const std::string& key, const std::vector<float>& value);
     key_value_pair(const std::string& key, const std::vector<bool>& value);
 
     const std::string& key() const;
-    std::shared_ptr<json_value> value() const;
+    ref_ptr<json_value> value() const;
 
 private:
     std::string _key;
-    std::shared_ptr<json_value> _value;
+    ref_ptr<json_value> _value;
+};
+
+// ---------------------------  sax_handler  ---------------------------------
+
+// Receives the events of json::parse(ptr, size, handler) while the text is
+// scanned, no tree is built. Every callback returns true to go on, false to
+// stop parsing. Override the ones you need, the others ignore their event.
+//
+// The string passed to on_string / on_key is only valid during the call.
+// Each object member is reported as on_key followed by its value.
+class sax_handler {
+public:
+    virtual ~sax_handler() = default;
+
+    virtual bool on_null() { return true; }
+    virtual bool on_bool(bool) { return true; }
+    virtual bool on_int64(int64_t) { return true; }
+    virtual bool on_uint64(uint64_t) { return true; }
+    virtual bool on_double(double) { return true; }
+    virtual bool on_string(const char*, size_t) { return true; }
+    virtual bool on_key(const char*, size_t) { return true; }
+    virtual bool on_start_object() { return true; }
+    virtual bool on_end_object() { return true; }
+    virtual bool on_start_array() { return true; }
+    virtual bool on_end_array() { return true; }
+};
+
+// ---------------------------  projection  ---------------------------------
+
+// The paths kept by json::parse(data, projection), in json pointer syntax
+// ("/user/id", "~1" and "~0" escape '/' and '~'). A "*" segment matches
+// every member of an object or element of an array, a number segment
+// matches that element of an array.
+class projection final {
+public:
+    projection(std::initializer_list<std::string> paths) : _paths(paths) {}
+    projection(const std::vector<std::string>& paths) : _paths(paths) {}
+
+    const std::vector<std::string>& paths() const { return _paths; }
+
+private:
+    std::vector<std::string> _paths;
 };
 
 // ---------------------------  json  ---------------------------------
 
 class json_iterator;
+class parser;
 class json final {
     friend json_iterator;
 public:
     static json parse(const std::string& data);
     static json parse(const char* ptr, size_t size);
     static json parse(std::istream* stream);
+
+    // Parse keeping only the values selected by 'proj', together with the
+    // objects and arrays that lead to them; arrays keep the selected
+    // elements in order. Every other subtree is skipped at scan speed, it
+    // is neither allocated nor validated beyond its brackets.
+    //   json::parse(data, {"/user/id", "/items/*/price"})
+    static json parse(const std::string& data, const projection& proj);
+    static json parse(const char* ptr, size_t size, const projection& proj);
+
+    // Event driven parse, see sax_handler. Any json value is accepted at the
+    // top level. Returns false if the text is invalid or the handler stopped.
+    static bool parse(const std::string& data, sax_handler* handler);
+    static bool parse(const char* ptr, size_t size, sax_handler* handler);
+
+    // Zero-copy variant of parse(ptr, size). String values without escape
+    // sequences are not copied, they point into [ptr, ptr + size).
+    // The caller pins the buffer: it must stay valid and unchanged for as
+    // long as the returned json, or any json taken from it, is in use.
+    // Object keys, escaped strings and anything produced by copy() or
+    // assigned later own their memory and are not bound to the buffer.
+    static json parse_borrowed(const char* ptr, size_t size);
+
+    // On-demand variant of parse(ptr, size). Only the structural index of
+    // (a private copy of) the text is built. A container is expanded one
+    // level when it is first accessed; subtrees that are never touched are
+    // skipped through precomputed matching bracket offsets and allocate
+    // nothing. Syntax errors inside a subtree throw parse_error when that
+    // subtree is expanded. Reading from several threads at once is only
+    // safe after the parts they read have been expanded.
+    static json parse_lazy(const char* ptr, size_t size);
+
+    // Same result as parse(ptr, size) for one large document, built on
+    // 'threads' threads (0 means one per core). The arrays nested
+    // 'split_depth' levels deep (0: the top level array, 1: e.g. the
+    // "data" array of {"data":[...]}) are cut into element ranges at
+    // structural boundaries; the ranges are parsed concurrently and
+    // stitched back in order. Arrays under 256KB are read on one thread.
+    static json parse_parallel(const char* ptr, size_t size, size_t threads = 0, int split_depth = 0);
+
+    // Read-only variant of parse(ptr, size) with a compact storage: every
+    // value takes 16 bytes in one contiguous tape instead of a heap node,
+    // scalars and strings up to 14 bytes are stored inline. The returned
+    // json and the values taken from it are read through the usual api
+    // (operator[], get<T>(), size(), iterators, dump()...), nothing is
+    // allocated per value; dump*() and to_cbor*() write straight from the
+    // tape. Modifying a value inside the document throws other_error;
+    // copy() returns a regular, mutable json. A key repeated within one
+    // object is counted by size() for each occurrence, lookups find the
+    // last one like parse() keeps it, and that object is written through
+    // its tree so the output is the same as parse()'s.
+    static json parse_compact(const char* ptr, size_t size);
+
+    // Same result as parse(ptr, size), with the long keys and the short
+    // string values shared through 'pool', or through a pool of its own
+    // when it is nullptr (repeats within the document are shared). String
+    // values taken from the pool are replaced, not modified, on assignment.
+    static json parse_interned(const char* ptr, size_t size, string_pool* pool = nullptr);
+
+    // Same result as parse(ptr, size), with every value, string and
+    // container of the document allocated from one arena: a few large
+    // blocks instead of an allocation per node, and destroying the
+    // document returns the blocks at once. The arena is released with
+    // the last value of the document still referenced, so keeping one
+    // small value keeps the whole arena. It is not synchronized: change
+    // the containers of one document from one thread at a time.
+    static json parse_arena(const char* ptr, size_t size);
+
+    // Parse a stream of json texts separated by whitespace (json lines or
+    // concatenated documents) on 'threads' threads, 0 means one per core.
+    // Documents are returned in input order, any json value is accepted as
+    // a document and one that is not valid json becomes an empty json.
+    static std::vector<json> parse_many(const char* ptr, size_t size, size_t threads = 0);
+
+    // Same as above, but the documents are handed to 'callback' in input
+    // order instead of being collected, only a window of parsed documents
+    // is held at a time. Return false from the callback to stop early.
+    // Returns the number of documents delivered.
+    static size_t parse_many(const char* ptr, size_t size,
+        const std::function<bool(json&)>& callback, size_t threads = 0);
     static json from_cbor(const uint8_t* ptr, size_t len, size_t* tranfer_bytes = nullptr);
     static json from_cbor(const std::vector<uint8_t>& bin, size_t* tranfer_bytes = nullptr);
     static std::vector<uint8_t> to_cbor(json js);
@@ -258,7 +664,7 @@ public:
     static json object();
     static const char* type_name(value_type ty);
 
-    json(std::shared_ptr<json_value> item);
+    json(ref_ptr<json_value> item);
     json();
     ~json() = default;
     json(const json& j);
@@ -267,9 +673,55 @@ public:
     json(std::initializer_list<key_value_pair> init);
 
     std::string dump(int indent = -1) const;
+
+    // Same text as dump(), written out while it is made instead of being
+    // returned: it goes through a fixed size buffer that is handed over
+    // each time it fills up, so the memory used does not grow with the
+    // size of the output. Returns false once the destination fails, the
+    // rest of the text is not written.
+    typedef std::function<bool(const char* ptr, size_t len)> sink_callback;
+    // the callback receives the text in order, returns false to stop
+    bool dump_to(const sink_callback& sink, int indent = -1) const;
+    // false when the stream goes bad
+    bool dump_to(std::ostream& stream, int indent = -1) const;
+    // write(2) to 'fd', short writes are continued; errno tells the error
+    bool dump_to(int fd, int indent = -1) const;
+
+    // Exact size of dump(indent) and to_cbor() in bytes, worked out in one
+    // pass over the values without writing the output.
+    size_t dump_size(int indent = -1) const;
+    size_t cbor_size() const;
+
+    // Write dump(indent) or to_cbor() straight into the caller's memory.
+    // Returns the number of bytes written, or 0 when they do not fit in
+    // 'capacity' (what is in 'buff' is unusable then). The text is not
+    // NUL terminated.
+    size_t dump_into(char* buff, size_t capacity, int indent = -1) const;
+    size_t to_cbor_into(uint8_t* buff, size_t capacity) const;
+
+    // Append dump(indent) or to_cbor() to 'out'. A buffer that is cleared
+    // and reused keeps its capacity, so after the first call nothing is
+    // allocated unless the output gets bigger.
+    void dump_append(std::string& out, int indent = -1) const;
+    void to_cbor_append(std::vector<uint8_t>& out) const;
+
     value_type get_type() const;
     bool empty() const;
     json copy() const;
+
+    // Copy sharing the nodes with this json: both become copy-on-write.
+    // The copy gets a root of its own and the values below it are marked
+    // shared, in one pass the first time and without allocating. Changing
+    // a value through operator[] clones the arrays and objects on the way
+    // down to it (one level each, their children stay shared), so the
+    // other side never sees the change and a small edit of a large
+    // template costs the depth of the edit rather than the whole document.
+    // Every json holding either root, or copied from one, keeps seeing its
+    // own document. The values met by an iterator of a shared array are
+    // read-only, and so is a json taken two or more levels inside this one
+    // before the call: changing it throws other_error, step down from the
+    // root again.
+    json copy_on_write() const;
     std::vector<uint8_t> to_cbor() const;
 
     bool is_null() const;
@@ -287,6 +739,10 @@ public:
     // remove the entry of the specified index from JsonArray
     void erase(size_t index);
 
+    // The json of an element or a member refers to it inside its array or
+    // object: nothing is allocated, reads go to the slot found when it was
+    // created (looked up again once entries are added or removed), and an
+    // assignment replaces the value in the container.
     json operator[] (size_t index);
     json operator[] (const std::string& key);
 
@@ -339,13 +795,13 @@ public:
     json_iterator begin();
     json_iterator end();
 
-    // construct from array
+    // construct a packed array (see src/karl.h) from integers or floating
+    // point numbers
     template<typename Ty>
-    json(const std::vector<Ty>& value) {
-        if (check_integer_type<Ty>::value) {
+    json(const std::vector<Ty>& value) : json() {
+        if (check_integer_type<Ty>::value || std::is_floating_point<Ty>::value) {
             key_value_pair jkv("temp", value);
-            _data = jkv.value();
-            _depth = 0;
+            _ref = jkv.value();
             return;
         }
         THROW_TYPE_ERROR("The type of json constructed by vector should be integer or double, but is " +
@@ -359,8 +815,27 @@ public:
     bool to_bool() const;
 
 private:
-    std::shared_ptr<json_value> current_value() const;
-    void fill_current_value(std::shared_ptr<json_value> obj);
+    ref_ptr<json_value> current_value() const;
+    // the node operator= makes another json hold, changing it changes
+    // this value in its document
+    ref_ptr<json_value> assigned_value() const;
+    // same without taking a reference, valid as long as this json;
+    // nullptr inside a compact document
+    json_value* current_node() const;
+    // where _ref keeps the value of a json below the root, nullptr if
+    // it is missing. The slot is cached until data()->version() changes.
+    const ref_ptr<json_value>* current_slot() const;
+    const ref_ptr<json_value>* find_slot() const;
+    void cache_slot();
+    // the array or object operator[] steps into, it replaces a missing
+    // or null value; nullptr if the value has another type
+    ref_ptr<json_value> container(value_type type);
+    // current_node() made safe to change: a shared node is replaced by a
+    // clone of its own first
+    json_value* writable_node();
+    // the packed array this json is an element of, nullptr otherwise
+    json_array* packed_parent() const;
+    void fill_current_value(ref_ptr<json_value> obj);
     const char* current_type() const;
 
     json& assign(const std::string& s);
@@ -370,10 +845,29 @@ private:
     json& assign(bool v);
     json& set_json_number(json_value* number);
 
-    int _depth;
-    std::shared_ptr<json_value> _data;
-    std::shared_ptr<size_t> _index;     // for array
-    std::shared_ptr<std::string> _key;  // for object
+    // compact documents (parse_compact)
+    const tape::Document* tape() const;
+    // the value is at _pos in tape(), the serializers read it from there
+    bool has_tape_value() const { return _compact && _pos != static_cast<size_t>(-1); }
+    void release_tape();
+    json tape_child(size_t at) const;
+
+    // the node _ref holds, nullptr in a compact document
+    json_value* data() const {
+        return _compact ? nullptr : static_cast<json_value*>(_ref.get());
+    }
+
+    // A root json (depth 0) holds its value in _ref. Below the root,
+    // _ref is the array or object holding the value, which is found at
+    // index _pos or at _key. The values of a compact document are the
+    // position _pos in the tape::Document _ref holds instead (_compact).
+    uint32_t _depth : 31;
+    uint32_t _compact : 1;
+    mutable uint32_t _version = 0;  // data()->version() when _slot was found
+    ref_ptr<ref_counted> _ref;
+    size_t _pos = 0;
+    object_key _key;
+    mutable const ref_ptr<json_value>* _slot = nullptr;
 };
 
 template<>
@@ -394,24 +888,21 @@ inline float json::get<float>() const {
 }
 
 template<>
-inline json::json(const std::vector<std::string>& value) {
+inline json::json(const std::vector<std::string>& value) : json() {
     key_value_pair jkv("temp", value);
-    _data = jkv.value();
-    _depth = 0;
+    _ref = jkv.value();
 }
 
 template<>
-inline json::json(const std::vector<double>& value) {
+inline json::json(const std::vector<double>& value) : json() {
     key_value_pair jkv("temp", value);
-    _data = jkv.value();
-    _depth = 0;
+    _ref = jkv.value();
 }
 
 template<>
-inline json::json(const std::vector<bool>& value) {
+inline json::json(const std::vector<bool>& value) : json() {
     key_value_pair jkv("temp", value);
-    _data = jkv.value();
-    _depth = 0;
+    _ref = jkv.value();
 }
 
 // ------------ json iterator ------------
@@ -448,7 +939,42 @@ private:
     bool equal(const json_iterator& rhs) const;
     void increment();
     std::shared_ptr<json> _js_obj;
-    std::shared_ptr<json_value> _value;
-    array_iterator _iter;
+    ref_ptr<json_value> _value;
+    size_t _tape_end = 0;   // end of the array in a compact document
+};
+
+// Push parser for input that arrives in chunks (socket, file, pipe).
+//
+//   karl::parser p;
+//   while ((n = read(fd, buff, sizeof(buff))) > 0) {
+//       if (!p.feed(buff, n)) break;  // invalid json
+//   }
+//   karl::json js = p.finish();
+//
+// The tree is built while the chunks come in, only a token split across
+// two chunks is buffered. Like json::parse, finish() returns an empty json
+// for invalid or truncated input and throws parse_error if the document is
+// not an array or object.
+class parser final {
+public:
+    parser();
+    ~parser();
+    parser(const parser&) = delete;
+    parser& operator= (const parser&) = delete;
+
+    // returns false once the input is known to be invalid
+    bool feed(const char* ptr, size_t len);
+    bool feed(const std::string& data);
+
+    // all of the document has been fed, bytes after it are ignored
+    bool done() const;
+
+    json finish();
+
+    // start over with a new document
+    void reset();
+
+private:
+    std::unique_ptr<text::PushReader> _reader;
 };
 }  // namespace karl
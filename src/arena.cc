@@ -0,0 +1,95 @@
+// Copyright (c) 2019 shadow-yuan. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "LICENSE");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// An easy to use c++ json library
+// Version 1.0.0
+// https://github.com/shadow-yuan/karl
+//
+// Authors: Shadow Yuan (shadow_yuan@qq.com)
+//
+
+#include "arena.h"
+#include <stdint.h>
+#include <string.h>
+#include <cstddef>
+#include <new>
+
+namespace karl {
+
+void* arena_allocate(memory::Arena* arena, size_t size, size_t align) {
+    return arena->allocate(size, align);
+}
+
+namespace memory {
+namespace {
+const size_t kMinBlockSize = 4 * 1024;
+const size_t kMaxBlockSize = 64 * 1024 * 1024;
+
+// room for the link to the previous block, keeping the block aligned
+const size_t kBlockHeader = alignof(std::max_align_t) > sizeof(char*)
+    ? alignof(std::max_align_t) : sizeof(char*);
+}  // namespace
+
+Arena::Arena(size_t initial)
+    : _last(nullptr)
+    , _current(nullptr)
+    , _end(nullptr)
+    , _next_size(initial < kMinBlockSize ? kMinBlockSize : initial)
+    , _blocks(0) {}
+
+Arena::~Arena() {
+    while (_last) {
+        char* prev;
+        memcpy(&prev, _last, sizeof(prev));
+        ::operator delete(_last);
+        _last = prev;
+    }
+}
+
+void* Arena::allocate(size_t size, size_t align) {
+    uintptr_t p = (reinterpret_cast<uintptr_t>(_current) + align - 1) & ~(uintptr_t(align) - 1);
+    if (!_current || p + size > reinterpret_cast<uintptr_t>(_end)) {
+        // the rest of the current block is given up
+        add_block(size + align);
+        p = (reinterpret_cast<uintptr_t>(_current) + align - 1) & ~(uintptr_t(align) - 1);
+    }
+    _current = reinterpret_cast<char*>(p + size);
+    return reinterpret_cast<void*>(p);
+}
+
+const char* Arena::copy_string(const char* ptr, size_t len) {
+    char* s = static_cast<char*>(allocate(len ? len : 1, 1));
+    memcpy(s, ptr, len);
+    return s;
+}
+
+void Arena::add_block(size_t size) {
+    size_t block = _next_size;
+    if (block < size) {
+        block = size;
+    }
+    if (_next_size < kMaxBlockSize) {
+        _next_size *= 2;
+    }
+
+    char* ptr = static_cast<char*>(::operator new(kBlockHeader + block));
+    memcpy(ptr, &_last, sizeof(_last));
+    _last = ptr;
+    _current = ptr + kBlockHeader;
+    _end = _current + block;
+    _blocks++;
+}
+
+}  // namespace memory
+}  // namespace karl
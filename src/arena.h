@@ -0,0 +1,92 @@
+// Copyright (c) 2019 shadow-yuan. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "LICENSE");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// An easy to use c++ json library
+// Version 1.0.0
+// https://github.com/shadow-yuan/karl
+//
+// Authors: Shadow Yuan (shadow_yuan@qq.com)
+//
+
+#pragma once
+#include "karl.h"
+#include <stddef.h>
+#include <new>
+#include <utility>
+
+namespace karl {
+namespace memory {
+
+// Monotonic allocator for the values of one document (json::parse_arena).
+// Memory is carved from a few large blocks; deallocation does nothing and
+// the blocks are returned together when the last reference to the arena
+// is released. Not thread safe.
+class Arena final : public ref_counted {
+public:
+    // the first block holds 'initial' bytes, the next ones double
+    explicit Arena(size_t initial);
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator= (const Arena&) = delete;
+
+    void* allocate(size_t size, size_t align);
+
+    // copy of [ptr, ptr + len) in the arena
+    const char* copy_string(const char* ptr, size_t len);
+
+    size_t blocks() const { return _blocks; }
+
+private:
+    void add_block(size_t size);
+
+    // every block starts with a pointer to the previous one
+    char* _last;
+    char* _current;
+    char* _end;
+    size_t _next_size;
+    size_t _blocks;
+};
+
+// A json value placed in an arena. Every node holds a reference to the
+// arena, so the memory stays valid for as long as any node of the
+// document is alive; the last reference to a node only runs destructors.
+template <typename T>
+class ArenaNode final : public T {
+public:
+    template <typename... Args>
+    explicit ArenaNode(Arena* arena, Args&&... args)
+        : T(std::forward<Args>(args)...), _arena(arena) {
+        _arena->add_ref();
+    }
+
+private:
+    void destroy() const noexcept override {
+        Arena* arena = _arena;
+        this->~ArenaNode();
+        arena->release();
+    }
+
+    Arena* _arena;
+};
+
+// New<T> for the nodes of an arena document
+template <typename T, typename... Args>
+inline ref_ptr<T> ArenaNew(Arena* arena, Args&&... args) {
+    void* ptr = arena->allocate(sizeof(ArenaNode<T>), alignof(ArenaNode<T>));
+    return ref_ptr<T>(new (ptr) ArenaNode<T>(arena, std::forward<Args>(args)...));
+}
+
+}  // namespace memory
+}  // namespace karl
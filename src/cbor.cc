@@ -147,94 +147,400 @@ std::vector<uint8_t> build_boolean(bool value) {
 }
 
 std::vector<uint8_t> build_number_signed(int64_t value) {
-    Writer obj;
-    if (value >= 0) {
-        /*
-         * Major type 0: an unsigned integer. 0b000_00000 => 0x00
-         * The 5-bit additional information
-         * is either the integer itself (for additional information values 0
-         * through 23) or the length of additional data. Additional
-         * information 24 means the value is represented in an additional
-         * uint8_t, 25 means a uint16_t, 26 means a uint32_t, and 27 means a
-         * uint64_t.
-         */
-        if (value <= 0x17) {
-            obj.write_number(static_cast<uint8_t>(value));
-        } else if (value <= std::numeric_limits<uint8_t>::max()) {
-            obj.write_character(0x18);  // 0x18 means uint8_t
-            obj.write_number(static_cast<uint8_t>(value));
-        } else if (value <= std::numeric_limits<uint16_t>::max()) {
-            obj.write_character(0x19);  // 0x19 means uint16_t
-            obj.write_number(static_cast<uint16_t>(value));
-        } else if (value <= std::numeric_limits<uint32_t>::max()) {
-            obj.write_character(0x1A);  // 0x1a means uint32_t
-            obj.write_number(static_cast<uint32_t>(value));
-        } else {
-            obj.write_character(0x1B);  // 0x1b means uint64_t
-            obj.write_number(static_cast<uint64_t>(value));
-        }
-    } else {
-        // Major type 1: a negative integer 0b001_00000 => 0x20
-        const auto positive_number = -1 - value;
-        if (value >= -24) {  // 0-23
-            obj.write_number(static_cast<uint8_t>(0x20 + positive_number));
-        } else if (positive_number <= std::numeric_limits<uint8_t>::max()) {
-            obj.write_character(0x38);  // 0x20 + 0x18 
-            obj.write_number(static_cast<uint8_t>(positive_number));
-        } else if (positive_number <= std::numeric_limits<uint16_t>::max()) {
-            obj.write_character(0x39);  // 0x20 + 0x19 
-            obj.write_number(static_cast<uint16_t>(positive_number));
-        } else if (positive_number <= std::numeric_limits<uint32_t>::max()) {
-            obj.write_character(0x3A);  // 0x20 + 0x1a 
-            obj.write_number(static_cast<uint32_t>(positive_number));
-        } else {
-            obj.write_character(0x3B);  // 0x20 + 0x1b 
-            obj.write_number(static_cast<uint64_t>(positive_number));
-        }
-    }
-    return obj.binary();
+    std::vector<uint8_t> obj;
+    append_number_signed(&obj, value);
+    return obj;
 }
 
 std::vector<uint8_t> build_number_usigned(uint64_t value) {
-    Writer obj;
-    // Major type 0: an unsigned integer. 0b000_00000 => 0x00
+    std::vector<uint8_t> obj;
+    append_number_usigned(&obj, value);
+    return obj;
+}
+
+std::vector<uint8_t> build_number_float(double value) {
+    std::vector<uint8_t> obj;
+    append_number_float(&obj, value);
+    return obj;
+}
+
+namespace {
+// control byte 'major' + 'value', followed by the bytes that do not fit in
+// its 5-bit additional information, big endian
+void append_head(std::vector<uint8_t>* out, uint8_t major, uint64_t value) {
+    /*
+     * The 5-bit additional information is either the integer itself (for
+     * additional information values 0 through 23) or the length of
+     * additional data. Additional information 24 means the value is
+     * represented in an additional uint8_t, 25 means a uint16_t, 26 means
+     * a uint32_t, and 27 means a uint64_t.
+     */
     if (value <= 0x17) {
-        obj.write_number(static_cast<uint8_t>(value));
-    } else if (value <= std::numeric_limits<uint8_t>::max()) {
-        obj.write_character(0x18);
-        obj.write_number(static_cast<uint8_t>(value));
+        out->push_back(static_cast<uint8_t>(major + value));
+        return;
+    }
+    int bytes;
+    if (value <= std::numeric_limits<uint8_t>::max()) {
+        out->push_back(major + 0x18);
+        bytes = 1;
     } else if (value <= std::numeric_limits<uint16_t>::max()) {
-        obj.write_character(0x19);
-        obj.write_number(static_cast<uint16_t>(value));
+        out->push_back(major + 0x19);
+        bytes = 2;
     } else if (value <= std::numeric_limits<uint32_t>::max()) {
-        obj.write_character(0x1A);
-        obj.write_number(static_cast<uint32_t>(value));
+        out->push_back(major + 0x1A);
+        bytes = 4;
     } else {
-        obj.write_character(0x1B);
-        obj.write_number(static_cast<uint64_t>(value));
+        out->push_back(major + 0x1B);
+        bytes = 8;
+    }
+    for (int i = bytes - 1; i >= 0; i--) {
+        out->push_back(static_cast<uint8_t>(value >> (i * 8)));
     }
-    return obj.binary();
 }
 
-std::vector<uint8_t> build_number_float(double value) {
-    Writer obj;
+template <typename T>
+void append_big_endian(std::vector<uint8_t>* out, T value) {
+    uint8_t bytes[sizeof(T)];
+    memcpy(bytes, &value, sizeof(T));
+    if (is_little_endian) {
+        std::reverse(bytes, bytes + sizeof(T));
+    }
+    out->insert(out->end(), bytes, bytes + sizeof(T));
+}
+}  // namespace
+
+void append_number_signed(std::vector<uint8_t>* out, int64_t value) {
+    if (value >= 0) {
+        // Major type 0: an unsigned integer. 0b000_00000 => 0x00
+        append_head(out, 0x00, static_cast<uint64_t>(value));
+    } else {
+        // Major type 1: a negative integer 0b001_00000 => 0x20
+        append_head(out, 0x20, static_cast<uint64_t>(-1 - value));
+    }
+}
+
+void append_number_usigned(std::vector<uint8_t>* out, uint64_t value) {
+    // Major type 0: an unsigned integer. 0b000_00000 => 0x00
+    append_head(out, 0x00, value);
+}
+
+void append_number_float(std::vector<uint8_t>* out, double value) {
     if (is_double_precision(value)) {
-        obj.write_character(double_precision_prefix);
-        obj.write_number(value);
+        out->push_back(double_precision_prefix);
+        append_big_endian(out, value);
     } else {
-        obj.write_character(single_precision_prefix);
-        obj.write_number(static_cast<float>(value));
+        out->push_back(single_precision_prefix);
+        append_big_endian(out, static_cast<float>(value));
     }
-    return obj.binary();
+}
+
+namespace {
+size_t head_size(uint64_t value) {
+    if (value <= 0x17) {
+        return 1;
+    }
+    if (value <= std::numeric_limits<uint8_t>::max()) {
+        return 2;
+    }
+    if (value <= std::numeric_limits<uint16_t>::max()) {
+        return 3;
+    }
+    if (value <= std::numeric_limits<uint32_t>::max()) {
+        return 5;
+    }
+    return 9;
+}
+
+// append_head into memory that has room for it
+uint8_t* put_head(uint8_t* out, uint8_t major, uint64_t value) {
+    size_t size = head_size(value);
+    if (size == 1) {
+        *out++ = static_cast<uint8_t>(major + value);
+        return out;
+    }
+    static const uint8_t info[] = { 0, 0, 0x18, 0x19, 0, 0x1A, 0, 0, 0, 0x1B };
+    *out++ = static_cast<uint8_t>(major + info[size]);
+    for (size_t i = size - 1; i > 0; i--) {
+        *out++ = static_cast<uint8_t>(value >> ((i - 1) * 8));
+    }
+    return out;
+}
+
+template <typename T>
+uint8_t* put_big_endian(uint8_t* out, T value) {
+    memcpy(out, &value, sizeof(T));
+    if (is_little_endian) {
+        std::reverse(out, out + sizeof(T));
+    }
+    return out + sizeof(T);
+}
+
+size_t signed_size(int64_t value) {
+    return head_size(value >= 0 ? static_cast<uint64_t>(value) : static_cast<uint64_t>(-1 - value));
+}
+
+size_t float_size(double value) {
+    return is_double_precision(value) ? 1 + sizeof(double) : 1 + sizeof(float);
+}
+
+uint8_t* put_signed(uint8_t* out, int64_t value) {
+    if (value >= 0) {
+        return put_head(out, 0x00, static_cast<uint64_t>(value));
+    }
+    return put_head(out, 0x20, static_cast<uint64_t>(-1 - value));
+}
+
+uint8_t* put_float(uint8_t* out, double value) {
+    if (is_double_precision(value)) {
+        *out++ = double_precision_prefix;
+        return put_big_endian(out, value);
+    }
+    *out++ = single_precision_prefix;
+    return put_big_endian(out, static_cast<float>(value));
+}
+
+uint8_t* put_string(uint8_t* out, const char* ptr, size_t len) {
+    out = put_head(out, 0x60, len);
+    memcpy(out, ptr, len);
+    return out + len;
+}
+}  // namespace
+
+size_t encoded_size(const json_value* value) {
+    if (!value) {
+        return 1;
+    }
+    switch (value->type()) {
+    case value_type::kNumber:
+    {
+        auto number = static_cast<const json_number*>(value);
+        if (number->is_signed()) {
+            return signed_size(static_cast<int64_t>(*number));
+        }
+        if (number->is_unsigned()) {
+            return head_size(static_cast<uint64_t>(*number));
+        }
+        return float_size(static_cast<double>(*number));
+    }
+    case value_type::kString:
+    {
+        size_t len = static_cast<const json_string*>(value)->size();
+        return head_size(len) + len;
+    }
+    case value_type::kArray:
+    {
+        auto arr = static_cast<const json_array*>(value);
+        size_t count = arr->size();
+        size_t size = head_size(count);
+        for (size_t i = 0; i < count; i++) {
+            if (!arr->is_packed()) {
+                size += encoded_size(arr->at(i));
+                continue;
+            }
+            json_array::packed_number n = arr->packed_at(i);
+            switch (arr->packed()) {
+            case json_array::packed_kind::kInt64:
+                size += signed_size(n.i64);
+                break;
+            case json_array::packed_kind::kUint64:
+                size += head_size(n.u64);
+                break;
+            default:
+                size += float_size(n.d);
+                break;
+            }
+        }
+        return size;
+    }
+    case value_type::kObject:
+    {
+        auto obj = static_cast<const json_object*>(value);
+        size_t count = obj->size();
+        size_t size = head_size(count);
+        for (size_t i = 0; i < count; i++) {
+            const object_key& key = obj->key_at(i);
+            size += head_size(key.size()) + key.size();
+            size += encoded_size(obj->value_at(i).get());
+        }
+        return size;
+    }
+    default:
+        // null, true and false are one byte
+        return 1;
+    }
+}
+
+uint8_t* encode_into(const json_value* value, uint8_t* out) {
+    if (!value) {
+        *out++ = null_code;
+        return out;
+    }
+    switch (value->type()) {
+    case value_type::kNull:
+        *out++ = null_code;
+        return out;
+    case value_type::kBoolean:
+        *out++ = static_cast<const json_boolean*>(value)->value() ? true_code : false_code;
+        return out;
+    case value_type::kNumber:
+    {
+        auto number = static_cast<const json_number*>(value);
+        if (number->is_signed()) {
+            return put_signed(out, static_cast<int64_t>(*number));
+        }
+        if (number->is_unsigned()) {
+            return put_head(out, 0x00, static_cast<uint64_t>(*number));
+        }
+        return put_float(out, static_cast<double>(*number));
+    }
+    case value_type::kString:
+    {
+        auto str = static_cast<const json_string*>(value);
+        return put_string(out, str->data(), str->size());
+    }
+    case value_type::kArray:
+    {
+        auto arr = static_cast<const json_array*>(value);
+        size_t count = arr->size();
+        out = put_head(out, 0x80, count);
+        for (size_t i = 0; i < count; i++) {
+            if (!arr->is_packed()) {
+                out = encode_into(arr->at(i), out);
+                continue;
+            }
+            json_array::packed_number n = arr->packed_at(i);
+            switch (arr->packed()) {
+            case json_array::packed_kind::kInt64:
+                out = put_signed(out, n.i64);
+                break;
+            case json_array::packed_kind::kUint64:
+                out = put_head(out, 0x00, n.u64);
+                break;
+            default:
+                out = put_float(out, n.d);
+                break;
+            }
+        }
+        return out;
+    }
+    case value_type::kObject:
+    {
+        auto obj = static_cast<const json_object*>(value);
+        size_t count = obj->size();
+        out = put_head(out, 0xA0, count);
+        for (size_t i = 0; i < count; i++) {
+            const object_key& key = obj->key_at(i);
+            out = put_string(out, key.data(), key.size());
+            out = encode_into(obj->value_at(i).get(), out);
+        }
+        return out;
+    }
+    }
+    return out;
+}
+
+size_t encoded_size(const tape::Document* doc, size_t p) {
+    const tape::Value& v = doc->values[p];
+    switch (v.type) {
+    case tape::tag::kInt64:
+        return signed_size(v.i64);
+    case tape::tag::kUint64:
+        return head_size(v.u64);
+    case tape::tag::kDouble:
+        return float_size(v.d);
+    case tape::tag::kShortString:
+    case tape::tag::kString:
+        return head_size(doc->string_size(p)) + doc->string_size(p);
+    case tape::tag::kArray:
+    {
+        size_t count = doc->size(p);
+        size_t size = head_size(count);
+        size_t q = doc->first_child(p);
+        for (size_t i = 0; i < count; i++, q = doc->next(q)) {
+            size += encoded_size(doc, q);
+        }
+        return size;
+    }
+    case tape::tag::kObject:
+    {
+        if (!doc->unique_keys(p)) {
+            return encoded_size(doc->to_json_value(p).get());
+        }
+        size_t count = doc->size(p);
+        size_t size = head_size(count);
+        // members are a key followed by its value
+        size_t q = p + 1;
+        for (size_t i = 0; i < count; i++, q = doc->next(q + 1)) {
+            size += head_size(doc->string_size(q)) + doc->string_size(q);
+            size += encoded_size(doc, q + 1);
+        }
+        return size;
+    }
+    default:
+        // null, true and false are one byte
+        return 1;
+    }
+}
+
+uint8_t* encode_into(const tape::Document* doc, size_t p, uint8_t* out) {
+    const tape::Value& v = doc->values[p];
+    switch (v.type) {
+    case tape::tag::kNull:
+        *out++ = null_code;
+        return out;
+    case tape::tag::kFalse:
+        *out++ = false_code;
+        return out;
+    case tape::tag::kTrue:
+        *out++ = true_code;
+        return out;
+    case tape::tag::kInt64:
+        return put_signed(out, v.i64);
+    case tape::tag::kUint64:
+        return put_head(out, 0x00, v.u64);
+    case tape::tag::kDouble:
+        return put_float(out, v.d);
+    case tape::tag::kShortString:
+    case tape::tag::kString:
+        return put_string(out, doc->string_data(p), doc->string_size(p));
+    case tape::tag::kArray:
+    {
+        size_t count = doc->size(p);
+        out = put_head(out, 0x80, count);
+        size_t q = doc->first_child(p);
+        for (size_t i = 0; i < count; i++, q = doc->next(q)) {
+            out = encode_into(doc, q, out);
+        }
+        return out;
+    }
+    case tape::tag::kObject:
+    {
+        if (!doc->unique_keys(p)) {
+            return encode_into(doc->to_json_value(p).get(), out);
+        }
+        size_t count = doc->size(p);
+        out = put_head(out, 0xA0, count);
+        size_t q = p + 1;
+        for (size_t i = 0; i < count; i++, q = doc->next(q + 1)) {
+            out = put_string(out, doc->string_data(q), doc->string_size(q));
+            out = encode_into(doc, q + 1, out);
+        }
+        return out;
+    }
+    }
+    return out;
 }
 
 std::vector<uint8_t> build_string(const std::string& str) {
+    return build_string(str.data(), str.size());
+}
+
+std::vector<uint8_t> build_string(const char* str, size_t size) {
     Writer obj;
     // Major type 3: a text string, specifically a string of Unicode
     // characters that is encoded as UTF - 8[RFC3629]. 0b011_00000 => 0x60
 
     // step 1: write control byte and the string length
-    const auto size = str.size();
     if (size <= 0x17) {
         obj.write_number(static_cast<uint8_t>(0x60 + size));
     } else if (size <= std::numeric_limits<uint8_t>::max()) {
@@ -253,8 +559,7 @@ std::vector<uint8_t> build_string(const std::string& str) {
     }
 
     // step 2: write the string
-    obj.write_characters(
-        reinterpret_cast<const uint8_t*>(str.c_str()), str.size());
+    obj.write_characters(reinterpret_cast<const uint8_t*>(str), size);
 
     return obj.binary();
 }
@@ -426,7 +731,7 @@ bool Reader::read_string(std::string& s) {
     return false;
 }
 
-bool Reader::read_array(std::shared_ptr<json_array>& obj) {
+bool Reader::read_array(ref_ptr<json_array>& obj) {
     size_t count = 0;
     if (!read_array_size(count)) {
         return false;
@@ -435,7 +740,7 @@ bool Reader::read_array(std::shared_ptr<json_array>& obj) {
     if (count == INDEFINITE_LENGTH) {
         while (_buff[_position] != break_stop_code) {
             size_t parse_bytes = 0;
-            std::shared_ptr<json_value> value;
+            ref_ptr<json_value> value;
             if (!parse_into_json_value(value, &parse_bytes)) {
                 return false;
             }
@@ -447,7 +752,7 @@ bool Reader::read_array(std::shared_ptr<json_array>& obj) {
         obj->resize(count);
         for (size_t i = 0; i < count; i++) {
             size_t parse_bytes = 0;
-            std::shared_ptr<json_value> value;
+            ref_ptr<json_value> value;
             if (!parse_into_json_value(value, &parse_bytes)) {
                 return false;
             }
@@ -458,7 +763,7 @@ bool Reader::read_array(std::shared_ptr<json_array>& obj) {
     return true;
 }
 
-bool Reader::read_object(std::shared_ptr<json_object>& obj) {
+bool Reader::read_object(ref_ptr<json_object>& obj) {
     size_t count = 0;
     if (!read_object_size(count)) {
         return false;
@@ -473,7 +778,7 @@ bool Reader::read_object(std::shared_ptr<json_object>& obj) {
             }
 
             size_t transfer_bytes = 0;
-            std::shared_ptr<json_value> value;
+            ref_ptr<json_value> value;
             if (!parse_into_json_value(value, &transfer_bytes)) {
                 return false;
             }
@@ -488,7 +793,7 @@ bool Reader::read_object(std::shared_ptr<json_object>& obj) {
                 return false;
             }
             size_t transfer_bytes = 0;
-            std::shared_ptr<json_value> value;
+            ref_ptr<json_value> value;
             if (!parse_into_json_value(value, &transfer_bytes)) {
                 return false;
             }
@@ -623,7 +928,7 @@ bool Reader::read_object_size(size_t& size) {
     return false;
 }
 
-bool Reader::parse_into_json_value(std::shared_ptr<json_value>& obj, size_t* transfer_bytes) {
+bool Reader::parse_into_json_value(ref_ptr<json_value>& obj, size_t* transfer_bytes) {
     Reader rder(_buff + _position, _size - _position);
     MajorType type;
     if (!read_next_type(type) || type == MajorType::kUnknown) {
@@ -660,7 +965,7 @@ bool Reader::parse_into_json_value(std::shared_ptr<json_value>& obj, size_t* tra
         break;
     case MajorType::kArray:
     {
-        std::shared_ptr<json_array> vec;
+        ref_ptr<json_array> vec;
         if (!rder.read_array(vec)) {
             return false;
         }
@@ -669,7 +974,7 @@ bool Reader::parse_into_json_value(std::shared_ptr<json_value>& obj, size_t* tra
         break;
     case MajorType::kObject:
     {
-        std::shared_ptr<json_object> sub;
+        ref_ptr<json_object> sub;
         if (!rder.read_object(sub)) {
             return false;
         }
@@ -880,9 +1185,9 @@ bool Reader::read_float_number(double& value) {
 
 // -------------------------------------------------------------
 
-std::shared_ptr<json_value>
+ref_ptr<json_value>
 parse_into_arbitrary_json_object(const uint8_t* bin, size_t len, size_t* transfer_bytes) {
-    std::shared_ptr<json_value> obj;
+    ref_ptr<json_value> obj;
     Reader rder(bin, len);
 
     MajorType type;
@@ -920,7 +1225,7 @@ parse_into_arbitrary_json_object(const uint8_t* bin, size_t len, size_t* transfe
         break;
     case MajorType::kArray:
     {
-        std::shared_ptr<json_array> vec;
+        ref_ptr<json_array> vec;
         if (!rder.read_array(vec)) {
             goto __exit;
         }
@@ -929,7 +1234,7 @@ parse_into_arbitrary_json_object(const uint8_t* bin, size_t len, size_t* transfe
         break;
     case MajorType::kObject:
     {
-        std::shared_ptr<json_object> sub;
+        ref_ptr<json_object> sub;
         if (!rder.read_object(sub)) {
             goto __exit;
         }
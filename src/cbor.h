@@ -21,6 +21,7 @@
 
 #pragma once
 #include "karl.h"
+#include "tape.h"
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
@@ -53,7 +54,12 @@ std::vector<uint8_t> build_boolean(bool value);
 std::vector<uint8_t> build_number_float(double value);
 std::vector<uint8_t> build_number_signed(int64_t value);
 std::vector<uint8_t> build_number_usigned(uint64_t value);
+// the same encodings appended to 'out', for loops over many numbers
+void append_number_float(std::vector<uint8_t>* out, double value);
+void append_number_signed(std::vector<uint8_t>* out, int64_t value);
+void append_number_usigned(std::vector<uint8_t>* out, uint64_t value);
 std::vector<uint8_t> build_string(const std::string& s);
+std::vector<uint8_t> build_string(const char* s, size_t size);
 
 // build array :
 // step 1: write control byte and the array size
@@ -76,6 +82,18 @@ std::vector<uint8_t> build_array_prefix(size_t array_size);
 //
 std::vector<uint8_t> build_object_prefix(size_t obj_size);
 
+// Exact size of the encoding of 'value' (the same bytes as to_cbor()),
+// nothing is encoded.
+size_t encoded_size(const json_value* value);
+
+// Encode 'value' at 'out', which has room for encoded_size(value) bytes.
+// Returns the end of the encoding.
+uint8_t* encode_into(const json_value* value, uint8_t* out);
+
+// Same for the value at 'p' of a compact document, read from its tape.
+size_t encoded_size(const tape::Document* doc, size_t p);
+uint8_t* encode_into(const tape::Document* doc, size_t p, uint8_t* out);
+
 // -------------------------------------------------------------
 
 class Writer final {
@@ -135,8 +153,8 @@ public:
     bool read_float_number(double& value);
 
     bool read_string(std::string& s);
-    bool read_array(std::shared_ptr<json_array>& obj);
-    bool read_object(std::shared_ptr<json_object>& obj);
+    bool read_array(ref_ptr<json_array>& obj);
+    bool read_object(ref_ptr<json_object>& obj);
 
 
     // When the next type is simply encoded (such as null, false,
@@ -153,7 +171,7 @@ private:
     bool read_array_size(size_t& size);
     bool read_object_size(size_t& size);
     bool parse_into_json_value(
-        std::shared_ptr<json_value>& obj, size_t* transfer_bytes);
+        ref_ptr<json_value>& obj, size_t* transfer_bytes);
 
     template<typename Ty>
     bool decode_number(Ty& result) {
@@ -178,7 +196,7 @@ private:
     size_t _position;
 };
 
-std::shared_ptr<json_value>
+ref_ptr<json_value>
  parse_into_arbitrary_json_object(const uint8_t* bin, size_t len, size_t* transfer_bytes);
 
 }  // namespace cbor
@@ -21,12 +21,25 @@
 
 #include "karl.h"
 #include <assert.h>
+#include <errno.h>
 #include <math.h>
+#include <string.h>
 #include <limits>
+#include <mutex>
+#include <new>
 #include <utility>
 #include <sstream>
-#include "cJSON.h"
+#include <stdexcept>
+#include <unordered_set>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 #include "cbor.h"
+#include "parallel.h"
+#include "tape.h"
+#include "text.h"
 
 namespace karl {
 namespace {
@@ -34,16 +47,55 @@ const char NULL_STR[] = "null";
 const char EMPTY_OBJ[] = "{}";
 const char TRUE_STR[] = "true";
 const char FALSE_STR[] = "false";
-const char INDENT_CHAR = ' ';
+const char READ_ONLY_STR[] = "cannot modify a value of a compact document, use copy() first";
+const char SHARED_STR[] = "cannot modify a value shared with a copy_on_write() document "
+    "through a json taken before the copy, step down from the root again";
+
+// A shared value has only shared values below it, so a subtree that is
+// shared already is not walked again.
+void share_tree(const json_value* value) {
+    if (!value || value->is_shared()) {
+        return;
+    }
+    value->share();
+    if (value->type() == value_type::kArray) {
+        static_cast<const json_array*>(value)->share_values();
+    } else if (value->type() == value_type::kObject) {
+        static_cast<const json_object*>(value)->share_values();
+    }
+}
 }  // namespace
 
+// FNV-1a, object keys are short
+size_t hash_key(const char* key, size_t len) {
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < len; i++) {
+        h ^= static_cast<uint8_t>(key[i]);
+        h *= 1099511628211ull;
+    }
+    return static_cast<size_t>(h ^ (h >> 32));
+}
+
+// ---------------------------  shared_string members  ---------------------------------
+
+ref_ptr<shared_string> shared_string::create(const char* ptr, size_t len) {
+    void* block = ::operator new(sizeof(shared_string) + len);
+    shared_string* str = new (block) shared_string(len, hash_key(ptr, len));
+    memcpy(const_cast<char*>(str->data()), ptr, len);
+    return ref_ptr<shared_string>(str);
+}
+
+void shared_string::destroy() const noexcept {
+    this->~shared_string();
+    ::operator delete(const_cast<shared_string*>(this));
+}
+
 // ---------------------------  json_null members  ---------------------------------
 
-value_type json_null::type() const { return value_type::kNull; }
 std::string json_null::dump() const { return NULL_STR; }
 std::string json_null::dump(int indent, int prefix) const { return NULL_STR; }
 std::string json_null::value() const { return NULL_STR; }
-std::shared_ptr<json_value> json_null::copy() const { return New<json_null>(); }
+ref_ptr<json_value> json_null::copy() const { return New<json_null>(); }
 std::vector<uint8_t> json_null::to_cbor() const {
     return cbor::build_null();
 }
@@ -52,7 +104,6 @@ bool json_null::empty() const { return false; }
 
 // ---------------------------  json_number members  ---------------------------------
 
-value_type json_boolean::type() const { return value_type::kBoolean; }
 std::string json_boolean::dump() const {
     return (_value) ? std::string(TRUE_STR) : std::string(FALSE_STR);
 }
@@ -64,7 +115,7 @@ json_boolean& json_boolean::operator= (bool value) {
 }
 bool json_boolean::empty() const { return false; }
 
-std::shared_ptr<json_value> json_boolean::copy() const {
+ref_ptr<json_value> json_boolean::copy() const {
     return New<json_boolean>(_value);
 }
 std::vector<uint8_t> json_boolean::to_cbor() const {
@@ -73,7 +124,7 @@ std::vector<uint8_t> json_boolean::to_cbor() const {
 
 // ---------------------------  json_number members  ---------------------------------
 
-std::shared_ptr<json_value> json_number::create(double value) {
+ref_ptr<json_value> json_number::create(double value) {
     number_check number;
     number.ddd = value;
     number.u64 = static_cast<uint64_t>(value);
@@ -106,19 +157,19 @@ std::shared_ptr<json_value> json_number::create(double value) {
     return obj;
 }
 
-json_number::json_number(int8_t value)   { set_value(static_cast<int64_t>(value));}
-json_number::json_number(int16_t value)  { set_value(static_cast<int64_t>(value)); }
-json_number::json_number(int32_t value)  { set_value(static_cast<int64_t>(value)); }
-json_number::json_number(int64_t value)  { set_value(value);}
-json_number::json_number(uint8_t value)  { set_value(static_cast<uint64_t>(value));}
-json_number::json_number(uint16_t value) { set_value(static_cast<uint64_t>(value));}
-json_number::json_number(uint32_t value) { set_value(static_cast<uint64_t>(value));}
-json_number::json_number(uint64_t value) { set_value(value);}
-json_number::json_number(float value)    { set_value(static_cast<double>(value));}
-json_number::json_number(double value)   { set_value(value);}
+json_number::json_number(int8_t value)   : json_value(kType) { set_value(static_cast<int64_t>(value));}
+json_number::json_number(int16_t value)  : json_value(kType) { set_value(static_cast<int64_t>(value)); }
+json_number::json_number(int32_t value)  : json_value(kType) { set_value(static_cast<int64_t>(value)); }
+json_number::json_number(int64_t value)  : json_value(kType) { set_value(value);}
+json_number::json_number(uint8_t value)  : json_value(kType) { set_value(static_cast<uint64_t>(value));}
+json_number::json_number(uint16_t value) : json_value(kType) { set_value(static_cast<uint64_t>(value));}
+json_number::json_number(uint32_t value) : json_value(kType) { set_value(static_cast<uint64_t>(value));}
+json_number::json_number(uint64_t value) : json_value(kType) { set_value(value);}
+json_number::json_number(float value)    : json_value(kType) { set_value(static_cast<double>(value));}
+json_number::json_number(double value)   : json_value(kType) { set_value(value);}
 
 json_number::json_number(const json_number& oth)
-    : _value_type(oth._value_type), _value(oth._value) {}
+    : json_value(kType), _value_type(oth._value_type), _value(oth._value) {}
 
 json_number& json_number::operator=(const json_number& rhs) {
     if (this != &rhs) {
@@ -190,21 +241,16 @@ json_number::operator double()   const { return _value.ddd; }
 json_number::operator float()    const { return static_cast<float>(_value.ddd); }
 
 std::string json_number::dump() const {
-    switch (_value_type) {
-    case number_type::kSigned:
-        return std::to_string(_value.i64);
-    case number_type::kUnsigned:
-        return std::to_string(_value.u64);
-    default:
-        return std::to_string(_value.ddd);
-    }
+    std::string out;
+    text::Writer(&out, -1).write(this);
+    return out;
 }
 
 std::string json_number::dump(int indent, int prefix) const {
     return this->dump();
 }
 
-std::shared_ptr<json_value> json_number::copy() const {
+ref_ptr<json_value> json_number::copy() const {
     auto obj = New<json_number>();
     obj->_value = _value;
     obj->_value_type = _value_type;
@@ -251,151 +297,229 @@ bool json_number::is_signed() const {
 
 // ---------------------------  json_string members  ---------------------------------
 
-json_string::json_string(const char* value) : _value(value) {}
-json_string::json_string(const std::string& value) : _value(value) {}
+json_string::json_string(const char* value)
+    : json_string(value, strlen(value)) {}
+json_string::json_string(const std::string& value)
+    : json_string(value.data(), value.size()) {}
+json_string::json_string(const char* ptr, size_t len)
+    : json_value(kType), _size(0), _storage(kInline) {
+    assign(ptr, len);
+}
+json_string::json_string(const char* ptr, size_t len, borrowed_t)
+    : json_value(kType), _size(0), _storage(kBorrowed) {
+    if (len > max_size) {
+        throw std::length_error("json_string too long");
+    }
+    _size = static_cast<uint32_t>(len);
+    _ptr = ptr;
+}
+json_string::json_string(const char* ptr, size_t len, interned_t)
+    : json_string(ptr, len) {
+    share();
+}
+
+json_string::~json_string() {
+    if (_storage == kHeap) {
+        delete[] _ptr;
+    }
+}
+
+void json_string::assign(const char* ptr, size_t len) {
+    if (len > max_size) {
+        throw std::length_error("json_string too long");
+    }
+    if (_storage == kHeap) {
+        delete[] _ptr;
+    }
+    if (len <= max_inline) {
+        if (len) {
+            memcpy(_inline, ptr, len);
+        }
+        _storage = kInline;
+    } else {
+        char* buff = new char[len];
+        memcpy(buff, ptr, len);
+        _ptr = buff;
+        _storage = kHeap;
+    }
+    _size = static_cast<uint32_t>(len);
+}
 
 std::string json_string::dump() const {
-    std::stringstream ss;
-    ss << "\"" << _value << "\"";
-    return ss.str();
+    std::string out;
+    text::Writer(&out, -1).write(this);
+    return out;
 }
 
 std::string json_string::dump(int indent, int prefix) const {
-    std::stringstream ss;
-    ss << "\"" << _value << "\"";
-    return ss.str();
+    return dump();
 }
 
-std::shared_ptr<json_value> json_string::copy() const {
-    return New<json_string>(_value);
+ref_ptr<json_value> json_string::copy() const {
+    // a copy never borrows, it may outlive the parsed buffer
+    return New<json_string>(data(), size());
 }
 
 std::vector<uint8_t> json_string::to_cbor() const {
-    return cbor::build_string(_value);
+    return cbor::build_string(data(), size());
 }
 
 json_string& json_string::operator=(const std::string& value) {
-    _value = value;
+    assign(value.data(), value.size());
     return *this;
 }
 
 // ---------------------------  json_array members  ---------------------------------
 
-std::shared_ptr<json_value> json_array::GetAt(size_t i) {
+ref_ptr<json_value> json_array::GetAt(size_t i) {
+    touch();
     if (i >= _seq.size()) {
         return nullptr;
     }
     return _seq[i];
 }
 
-bool json_array::SetAt(size_t i, std::shared_ptr<json_value> element) {
+json_value* json_array::at(size_t i) const {
+    touch();
+    if (i >= _seq.size()) {
+        return nullptr;
+    }
+    return _seq[i].get();
+}
+
+const ref_ptr<json_value>* json_array::slot(size_t i) const {
+    touch();
+    if (i >= _seq.size()) {
+        return nullptr;
+    }
+    return &_seq[i];
+}
+
+bool json_array::SetAt(size_t i, ref_ptr<json_value> element) {
+    touch();
     if (i >= _seq.size()) {
         _seq.resize(i + 1);
+        _version++;
     }
     _seq[i] = element;
     return true;
 }
 
-std::shared_ptr<json_value>& json_array::operator[](size_t i) {
+ref_ptr<json_value>& json_array::operator[](size_t i) {
+    touch();
     if (i >= _seq.size()) {
         _seq.resize(i + 1);
+        _version++;
     }
     return _seq[i];
 }
 
-const std::shared_ptr<json_value>& json_array::operator[](size_t i) const {
+const ref_ptr<json_value>& json_array::operator[](size_t i) const {
+    touch();
     return _seq[i];
 }
 
-bool json_array::insert(size_t i, std::shared_ptr<json_value> element) {
+bool json_array::insert(size_t i, ref_ptr<json_value> element) {
+    touch();
     if (i > _seq.size()) {
         _seq.resize(i);
     }
     auto iter = _seq.begin();
     std::advance(iter, i);
     _seq.insert(iter, element);
+    _version++;
     return true;
 }
 
-void json_array::append(std::shared_ptr<json_value> element) {
+void json_array::append(ref_ptr<json_value> element) {
+    touch();
     _seq.push_back(element);
+    _version++;
 }
 
 void json_array::resize(size_t size) {
+    touch();
     _seq.resize(size);
+    _version++;
 }
 
 void json_array::clear() {
+    _lazy.reset();
     _seq.clear();
+    _numbers.clear();
+    _packed = packed_kind::kNone;
+    _version++;
 }
 
 size_t json_array::size() const {
+    if (is_packed()) {
+        return _numbers.size();
+    }
+    touch();
     return _seq.size();
 }
 
 void json_array::erase(size_t index) {
+    touch();
     if (index < _seq.size()) {
         _seq.erase(_seq.begin() + index);
+        _version++;
     }
 }
 
 array_iterator json_array::begin() {
+    touch();
     return _seq.begin();
 }
 
 array_iterator json_array::end() {
+    touch();
     return _seq.end();
 }
 
 std::string json_array::dump() const {
-    std::stringstream ss;
-    ss << "[";
-
-    size_t size = _seq.size();
-    size_t index = 0;
-    for (const std::shared_ptr<json_value>& iter : _seq) {
-        ss << ((iter) ? iter->dump() : std::string(NULL_STR));
-        if (++index != size) {
-            ss << ",";
-        }
-    }
-    ss << "]";
-    return ss.str();
+    std::string out;
+    text::Writer(&out, -1).write(this);
+    return out;
 }
 
 std::string json_array::dump(int indent, int prefix) const {
-    std::stringstream ss;
-    if (_seq.empty()) {
-        ss << "[]";
-        return ss.str();
-    }
-    ss << "[";
-
-    size_t size = _seq.size();
-    size_t index = 0;
-    for (const std::shared_ptr<json_value>& iter : _seq) {
-        if (index == 0) {
-            if (iter->type() == value_type::kArray || iter->type() == value_type::kObject) {
-                ss << /*"\n" <<*/ std::string(prefix + indent, INDENT_CHAR);
-            }
-        }
-        ss << "\n" << std::string(prefix + indent, INDENT_CHAR);
-        ss << ((iter) ? iter->dump(indent, prefix + indent) : std::string(NULL_STR));
-        
-        if (++index != size) {
-            ss << ",";
-        } else {
-            ss << "\n";
+    std::string out;
+    text::Writer(&out, indent).write(this, prefix);
+    return out;
+}
+
+ref_ptr<json_array> json_array::clone() const {
+    if (is_packed()) {
+        // numbers are values, there is nothing to share
+        return As<json_array>(copy());
+    }
+    touch();
+    auto obj = New<json_array>();
+    obj->_seq.reserve(_seq.size());
+    for (const ref_ptr<json_value>& element : _seq) {
+        if (element) {
+            element->share();
         }
+        obj->_seq.push_back(element);
     }
-    if (prefix) {
-        ss << std::string(prefix, INDENT_CHAR);
+    return obj;
+}
+
+void json_array::share_values() const {
+    for (const ref_ptr<json_value>& element : _seq) {
+        share_tree(element.get());
     }
-    ss << "]";
-    return ss.str();
 }
 
-std::shared_ptr<json_value> json_array::copy() const {
+ref_ptr<json_value> json_array::copy() const {
+    if (is_packed()) {
+        auto obj = New<json_array>();
+        obj->_packed = _packed;
+        obj->_numbers.assign(_numbers.begin(), _numbers.end());
+        return obj;
+    }
+    touch();
     auto obj = New<json_array>();
     if (!_seq.empty()) {
         obj->resize(_seq.size());
@@ -409,6 +533,29 @@ std::shared_ptr<json_value> json_array::copy() const {
 }
 
 std::vector<uint8_t> json_array::to_cbor() const {
+    if (is_packed()) {
+        std::vector<uint8_t> out = cbor::build_array_prefix(_numbers.size());
+        out.reserve(out.size() + _numbers.size() * 9);
+        switch (_packed) {
+        case packed_kind::kInt64:
+            for (const packed_number& n : _numbers) {
+                cbor::append_number_signed(&out, n.i64);
+            }
+            break;
+        case packed_kind::kUint64:
+            for (const packed_number& n : _numbers) {
+                cbor::append_number_usigned(&out, n.u64);
+            }
+            break;
+        default:
+            for (const packed_number& n : _numbers) {
+                cbor::append_number_float(&out, n.d);
+            }
+            break;
+        }
+        return out;
+    }
+    touch();
     cbor::Writer obj;
     obj += cbor::build_array_prefix(_seq.size());
     for (size_t i = 0; i < _seq.size(); i++) {
@@ -421,303 +568,757 @@ std::vector<uint8_t> json_array::to_cbor() const {
     return obj.binary();
 }
 
-// ---------------------------  json_object members  ---------------------------------
+json_number json_array::number_at(size_t i) const {
+    switch (_packed) {
+    case packed_kind::kInt64:
+        return json_number(_numbers[i].i64);
+    case packed_kind::kUint64:
+        return json_number(_numbers[i].u64);
+    default:
+        return json_number(_numbers[i].d);
+    }
+}
 
-bool json_object::has_key(const std::string& key) const {
-    auto it = _map.find(key);
-    if (it == _map.end()) {
+bool json_array::accepts_packed(packed_kind kind) {
+    if (_packed == kind) {
+        return true;
+    }
+    if (_packed != packed_kind::kNone || !_seq.empty() || _lazy) {
         return false;
     }
+    _packed = kind;
     return true;
 }
 
-std::shared_ptr<json_value> json_object::get_value(const std::string& key) const {
-    auto it = _map.find(key);
-    if (it == _map.end()) {
-        return nullptr;
+bool json_array::append_packed(int64_t value) {
+    packed_number n;
+    if (_packed == packed_kind::kUint64 && value >= 0) {
+        n.u64 = static_cast<uint64_t>(value);
+    } else if (accepts_packed(packed_kind::kInt64)) {
+        n.i64 = value;
+    } else {
+        return false;
     }
-    return it->second;
+    _numbers.push_back(n);
+    _version++;
+    return true;
 }
 
-void json_object::set_value(const std::string& key, std::shared_ptr<json_value> element) {
-    _map[key] = element;
+bool json_array::append_packed(uint64_t value) {
+    if (value <= static_cast<uint64_t>(INT64_MAX) && _packed != packed_kind::kUint64) {
+        return append_packed(static_cast<int64_t>(value));
+    }
+    if (_packed == packed_kind::kInt64) {
+        // the array turns unsigned when none of its numbers is negative
+        for (const packed_number& n : _numbers) {
+            if (n.i64 < 0) {
+                return false;
+            }
+        }
+        _packed = packed_kind::kUint64;
+    } else if (!accepts_packed(packed_kind::kUint64)) {
+        return false;
+    }
+    packed_number n;
+    n.u64 = value;
+    _numbers.push_back(n);
+    _version++;
+    return true;
 }
 
-void json_object::clear() {
-    _map.clear();
+bool json_array::append_packed(double value) {
+    if (!accepts_packed(packed_kind::kDouble)) {
+        return false;
+    }
+    packed_number n;
+    n.d = value;
+    _numbers.push_back(n);
+    _version++;
+    return true;
 }
 
-json_object::iterator json_object::begin() {
-    return _map.begin();
+bool json_array::set_packed(size_t i, const json_number& value) {
+    if (i >= _numbers.size()) {
+        return false;
+    }
+    packed_number& n = _numbers[i];
+    switch (_packed) {
+    case packed_kind::kInt64:
+        if (value.is_signed() || (value.is_unsigned() && static_cast<uint64_t>(value) <= INT64_MAX)) {
+            n.i64 = static_cast<int64_t>(value);
+            return true;
+        }
+        return false;
+    case packed_kind::kUint64:
+        if (value.is_unsigned()) {
+            n.u64 = static_cast<uint64_t>(value);
+            return true;
+        }
+        return false;
+    case packed_kind::kDouble:
+        if (value.is_float()) {
+            n.d = static_cast<double>(value);
+            return true;
+        }
+        return false;
+    default:
+        return false;
+    }
 }
 
-json_object::iterator json_object::end() {
-    return _map.end();
+void json_array::unpack() const {
+    packed_kind kind = _packed;
+    _packed = packed_kind::kNone;
+    _seq.reserve(_numbers.size());
+    for (const packed_number& n : _numbers) {
+        switch (kind) {
+        case packed_kind::kInt64:
+            _seq.push_back(New<json_number>(n.i64));
+            break;
+        case packed_kind::kUint64:
+            _seq.push_back(New<json_number>(n.u64));
+            break;
+        default:
+            _seq.push_back(New<json_number>(n.d));
+            break;
+        }
+    }
+    packed_sequence(_numbers.get_allocator()).swap(_numbers);
+    _version++;
+    if (is_shared()) {
+        share_values();
+    }
 }
 
-void json_object::erase(const std::string& key) {
-    _map.erase(key);
+void json_array::set_lazy(std::shared_ptr<text::LazyDocument> doc, uint32_t at) {
+    _seq.clear();
+    _version++;
+    _lazy = std::move(doc);
+    _lazy_at = at;
 }
 
-size_t json_object::size() const {
-    return _map.size();
+void json_array::materialize() const {
+    // detach first, filling the array goes through append()
+    auto doc = std::move(_lazy);
+    if (!text::expand_lazy_array(doc, _lazy_at, const_cast<json_array&>(*this))) {
+        // stay unexpanded, every access reports the error
+        _seq.clear();
+        _lazy = std::move(doc);
+        THROW_PARSE_ERROR("invalid json array in lazy document");
+    }
+    if (is_shared()) {
+        share_values();
+    }
 }
 
-std::string json_object::dump() const {
-    std::stringstream ss;
-    ss << "{";
-    size_t size = _map.size();
-    size_t index = 0;
-    for (const std::pair<const std::string, std::shared_ptr<json_value>>& iter : _map) {
-        ss << "\"" << iter.first << "\":";
-        ss << ((iter.second) ? iter.second->dump() : std::string(NULL_STR));
-        if (++index != size) {
-            ss << ",";
+// ---------------------------  object_shape members  ---------------------------------
+
+object_shape::object_shape(object_key* keys, size_t count, size_t hash)
+    : _hash(hash) {
+    _keys.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        _keys.push_back(std::move(keys[i]));
+    }
+    if (count <= json_object::kIndexThreshold) {
+        return;
+    }
+    size_t buckets = 64;
+    while (buckets < count * 2) {
+        buckets *= 2;
+    }
+    _index.assign(buckets, 0);
+    size_t mask = buckets - 1;
+    for (size_t i = 0; i < count; i++) {
+        size_t b = _keys[i].hash() & mask;
+        while (_index[b] != 0) {
+            b = (b + 1) & mask;
         }
+        _index[b] = static_cast<uint32_t>(i + 1);
     }
-    ss << "}";
-    return ss.str();
 }
 
-std::string json_object::dump(int indent, int prefix) const {
-    std::stringstream ss;
-    if (_map.empty()) {
-        ss << "{}";
-        return ss.str();
-    }
-    ss << "{\n";
-    size_t size = _map.size();
-    size_t index = 0;
-    for (const std::pair<const std::string, std::shared_ptr<json_value>>& iter : _map) {
-        ss << std::string(prefix + indent, INDENT_CHAR);
-        ss << "\"" << iter.first << "\": ";
-
-        if (iter.second) {
-            ss << iter.second->dump(indent, prefix + indent);
-        } else {
-            ss << std::string(NULL_STR);
-        }
-        if (++index != size) {
-            ss << ",\n";
-        } else {
-            ss << "\n";
-        }
+size_t object_shape::find(const char* key, size_t len) const {
+    if (_index.empty()) {
+        return scan(key, len);
     }
-    if (prefix) {
-        ss << std::string(prefix, INDENT_CHAR);
+    return probe(key, len, hash_key(key, len));
+}
+
+size_t object_shape::find(const object_key& key) const {
+    if (_index.empty()) {
+        return scan(key.data(), key.size());
     }
-    ss << "}";
-    return ss.str();
+    return probe(key.data(), key.size(), key.hash());
 }
 
-std::shared_ptr<json_value> json_object::copy() const {
-    auto obj = New<json_object>();
-    if (!_map.empty()) {
-        for (auto it = _map.begin(); it != _map.end(); ++it) {
-            if (it->second) {
-                obj->set_value(it->first, it->second->copy());
-            } else {
-                obj->set_value(it->first, it->second);
-            }
+size_t object_shape::scan(const char* key, size_t len) const {
+    for (size_t i = 0; i < _keys.size(); i++) {
+        if (_keys[i].equals(key, len)) {
+            return i;
         }
     }
-    return obj;
+    return npos;
 }
 
-std::vector<uint8_t> json_object::to_cbor() const {
-    cbor::Writer obj;
-    obj += cbor::build_object_prefix(_map.size());
-    for (auto it = _map.begin(); it != _map.end(); ++it) {
-        obj += cbor::build_string(it->first);
-        if (it->second) {
-            obj += it->second->to_cbor();
-        } else {
-            obj.write_character(cbor::null_code);
+size_t object_shape::probe(const char* key, size_t len, size_t hash) const {
+    size_t mask = _index.size() - 1;
+    for (size_t b = hash & mask; _index[b] != 0; b = (b + 1) & mask) {
+        size_t pos = _index[b] - 1;
+        if (_keys[pos].equals(key, len)) {
+            return pos;
         }
     }
-    return obj.binary();
+    return npos;
 }
 
-// ---------------------------  key_value_pair members  ---------------------------------
+bool object_shape::equals(const object_key* keys, size_t count) const {
+    if (count != _keys.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (!_keys[i].equals(keys[i].data(), keys[i].size())) {
+            return false;
+        }
+    }
+    return true;
+}
 
-key_value_pair::key_value_pair() {}
-key_value_pair::~key_value_pair() {}
-key_value_pair::key_value_pair(const std::string& key, const char* value)
-    : _key(key) {
-    if (value) {
-        _value = New<json_string>(value);
-    } else {
-        _value = New<json_null>();
+// ---------------------------  shape_table members  ---------------------------------
+
+namespace {
+size_t hash_keys(const object_key* keys, size_t count) {
+    size_t h = count;
+    for (size_t i = 0; i < count; i++) {
+        h = h * 31 + keys[i].hash();
     }
+    return h;
 }
 
-key_value_pair::key_value_pair(const std::string& key, const std::string& value)
-    : _key(key), _value(New<json_string>(value)){}
+bool has_duplicate(const object_key* keys, size_t count) {
+    if (count <= json_object::kIndexThreshold) {
+        for (size_t i = 1; i < count; i++) {
+            for (size_t j = 0; j < i; j++) {
+                if (keys[i].equals(keys[j].data(), keys[j].size())) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+    std::unordered_set<std::string> seen;
+    for (size_t i = 0; i < count; i++) {
+        if (!seen.insert(keys[i].str()).second) {
+            return true;
+        }
+    }
+    return false;
+}
+}  // namespace
 
-key_value_pair::key_value_pair(const std::string& key, int8_t value) 
-    : _key(key), _value(New<json_number>(value)) {}
+ref_ptr<object_shape> shape_table::find_or_add(object_key* keys, size_t count) {
+    if (_last && _last->equals(keys, count)) {
+        return ref_ptr<object_shape>(_last);
+    }
+    size_t h = hash_keys(keys, count);
+    if (_buckets.empty()) {
+        _buckets.resize(64);
+    }
+    size_t mask = _buckets.size() - 1;
+    size_t b = h & mask;
+    for (; _buckets[b]; b = (b + 1) & mask) {
+        if (_buckets[b]->hash() == h && _buckets[b]->equals(keys, count)) {
+            _last = _buckets[b].get();
+            return _buckets[b];
+        }
+    }
+    if (has_duplicate(keys, count)) {
+        return nullptr;
+    }
+    _buckets[b] = New<object_shape>(keys, count, h);
+    _last = _buckets[b].get();
+    ref_ptr<object_shape> shape = _buckets[b];
+    if (++_count * 2 > _buckets.size()) {
+        grow();
+    }
+    return shape;
+}
 
-key_value_pair::key_value_pair(const std::string& key, int16_t value)
-    : _key(key), _value(New<json_number>(value)) {}
+void shape_table::grow() {
+    std::vector<ref_ptr<object_shape>> old(_buckets.size() * 2);
+    old.swap(_buckets);
+    size_t mask = _buckets.size() - 1;
+    for (auto& shape : old) {
+        if (shape) {
+            size_t b = shape->hash() & mask;
+            while (_buckets[b]) {
+                b = (b + 1) & mask;
+            }
+            _buckets[b] = std::move(shape);
+        }
+    }
+}
 
-key_value_pair::key_value_pair(const std::string& key, int32_t value)
-    : _key(key), _value(New<json_number>(value)) {}
+void shape_table::clear() {
+    _buckets.clear();
+    _count = 0;
+    _last = nullptr;
+}
 
-key_value_pair::key_value_pair(const std::string& key, int64_t value)
-    : _key(key), _value(New<json_number>(value)) {}
+// ---------------------------  json_object members  ---------------------------------
 
-key_value_pair::key_value_pair(const std::string& key, uint8_t value)
-    : _key(key), _value(New<json_number>(value)) {}
+bool json_object::has_key(const std::string& key) const {
+    touch();
+    return lookup(key.data(), key.size()) != npos;
+}
 
-key_value_pair::key_value_pair(const std::string& key, uint16_t value)
-    : _key(key), _value(New<json_number>(value)) {}
+ref_ptr<json_value> json_object::get_value(const std::string& key) const {
+    const ref_ptr<json_value>* value = slot(key.data(), key.size());
+    return value ? *value : nullptr;
+}
 
-key_value_pair::key_value_pair(const std::string& key, uint32_t value)
-    : _key(key), _value(New<json_number>(value)) {}
+json_value* json_object::find(const std::string& key) const {
+    const ref_ptr<json_value>* value = slot(key.data(), key.size());
+    return value ? value->get() : nullptr;
+}
 
-key_value_pair::key_value_pair(const std::string& key, uint64_t value)
-    : _key(key), _value(New<json_number>(value)) {}
+const ref_ptr<json_value>* json_object::slot(const std::string& key) const {
+    return slot(key.data(), key.size());
+}
 
-key_value_pair::key_value_pair(const std::string& key, double value)
-    : _key(key), _value(New<json_number>(value)) {}
+const ref_ptr<json_value>* json_object::slot(const char* key, size_t len) const {
+    touch();
+    size_t pos = lookup(key, len);
+    if (pos == npos) {
+        return nullptr;
+    }
+    return &value_at(pos);
+}
 
-key_value_pair::key_value_pair(const std::string& key, float value)
-    : _key(key), _value(New<json_number>(value)) {}
+const ref_ptr<json_value>* json_object::slot(const object_key& key) const {
+    touch();
+    size_t pos = lookup(key);
+    if (pos == npos) {
+        return nullptr;
+    }
+    return &value_at(pos);
+}
 
-key_value_pair::key_value_pair(const std::string& key, bool value)
-    : _key(key), _value(New<json_boolean>(value)) {}
+void json_object::set_value(const std::string& key, ref_ptr<json_value> element) {
+    set_value(object_key(key), std::move(element));
+}
 
-key_value_pair::key_value_pair(const key_value_pair& oth)
-    : _key(oth._key), _value(oth._value) {}
+void json_object::set_value(std::string&& key, ref_ptr<json_value> element) {
+    set_value(key, std::move(element));
+}
 
-key_value_pair& key_value_pair::operator= (const key_value_pair& rhs) {
-    if (this != &rhs) {
-        _key = rhs._key;
-        _value = rhs._value;
+void json_object::set_value(object_key&& key, ref_ptr<json_value> element) {
+    touch();
+    size_t pos = lookup(key);
+    if (pos != npos) {
+        const_cast<ref_ptr<json_value>&>(value_at(pos)) = std::move(element);
+        return;
     }
-    return *this;
+    unshape();
+    append(std::move(key), std::move(element));
 }
 
-key_value_pair::key_value_pair(const std::string& key, const std::vector<int8_t>& value) {
-    auto obj = New<json_array>();
-    obj->resize(value.size());
+void json_object::clear() {
+    _lazy.reset();
+    _members.clear();
+    _index.clear();
+    _shape.reset();
+    _slots.clear();
+    _version++;
+}
 
-    for (size_t i = 0; i < value.size(); ++i) {
-        auto item = New<json_number>(value[i]);
-        obj->SetAt(i, item);
-    }
-    _value = obj;
-    _key = key;
+json_object::iterator json_object::begin() {
+    touch();
+    unshape();
+    return _members.begin();
 }
 
-key_value_pair::key_value_pair(const std::string& key, const std::vector<int16_t>& value) {
-    auto obj = New<json_array>();
-    obj->resize(value.size());
+json_object::iterator json_object::end() {
+    touch();
+    unshape();
+    return _members.end();
+}
 
-    for (size_t i = 0; i < value.size(); ++i) {
-        auto item = New<json_number>(value[i]);
-        obj->SetAt(i, item);
+void json_object::erase(const std::string& key) {
+    touch();
+    size_t pos = lookup(key.data(), key.size());
+    if (pos == npos) {
+        return;
     }
-    _value = obj;
-    _key = key;
+    unshape();
+    if (_members.size() - 1 > kIndexThreshold) {
+        unindex(pos);
+    } else {
+        _index.clear();
+    }
+    _members.erase(_members.begin() + pos);
+    _version++;
 }
 
-key_value_pair::key_value_pair(const std::string& key, const std::vector<int32_t>& value) {
-    auto obj = New<json_array>();
-    obj->resize(value.size());
-
-    for (size_t i = 0; i < value.size(); ++i) {
-        auto item = New<json_number>(value[i]);
-        obj->SetAt(i, item);
+void json_object::unindex(size_t pos) {
+    size_t mask = _index.size() - 1;
+    size_t hole = _members[pos].first.hash() & mask;
+    while (_index[hole] != pos + 1) {
+        hole = (hole + 1) & mask;
+    }
+    // backward shift: the entries of the cluster after the hole move into
+    // it unless that would put them before their home bucket
+    for (size_t b = (hole + 1) & mask; _index[b] != 0; b = (b + 1) & mask) {
+        size_t home = _members[_index[b] - 1].first.hash() & mask;
+        if (((b - home) & mask) >= ((b - hole) & mask)) {
+            _index[hole] = _index[b];
+            hole = b;
+        }
+    }
+    _index[hole] = 0;
+    // the members after 'pos' move down one position
+    if (pos + 1 != _members.size()) {
+        for (uint32_t& entry : _index) {
+            if (entry > pos + 1) {
+                entry--;
+            }
+        }
     }
-    _value = obj;
-    _key = key;
 }
 
-key_value_pair::key_value_pair(const std::string& key, const std::vector<int64_t>& value) {
-    auto obj = New<json_array>();
-    obj->resize(value.size());
+size_t json_object::size() const {
+    touch();
+    return _shape ? _slots.size() : _members.size();
+}
 
-    for (size_t i = 0; i < value.size(); ++i) {
-        auto item = New<json_number>(value[i]);
-        obj->SetAt(i, item);
+void json_object::adopt(ref_ptr<object_shape> shape, ref_ptr<json_value>* values) {
+    _slots.reserve(shape->size());
+    for (size_t i = 0; i < shape->size(); i++) {
+        _slots.push_back(std::move(values[i]));
     }
-    _value = obj;
-    _key = key;
+    _shape = std::move(shape);
+    _version++;
 }
 
-key_value_pair::key_value_pair(const std::string& key, const std::vector<uint8_t>& value) {
-    auto obj = New<json_array>();
-    obj->resize(value.size());
+void json_object::unshape() {
+    if (!_shape) {
+        return;
+    }
+    _members.reserve(_slots.size());
+    for (size_t i = 0; i < _slots.size(); i++) {
+        _members.emplace_back(_shape->key(i), std::move(_slots[i]));
+    }
+    sequence(_slots.get_allocator()).swap(_slots);
+    _shape.reset();
+    _version++;
+    if (_members.size() > kIndexThreshold) {
+        build_index();
+    }
+}
 
-    for (size_t i = 0; i < value.size(); ++i) {
-        auto item = New<json_number>(value[i]);
-        obj->SetAt(i, item);
+size_t json_object::lookup(const char* key, size_t len) const {
+    if (_shape) {
+        return _shape->find(key, len);
     }
-    _value = obj;
-    _key = key;
+    if (_index.empty()) {
+        return scan(key, len);
+    }
+    return probe(key, len, hash_key(key, len));
 }
 
-key_value_pair::key_value_pair(const std::string& key, const std::vector<uint16_t>& value) {
-    auto obj = New<json_array>();
-    obj->resize(value.size());
+size_t json_object::lookup(const object_key& key) const {
+    if (_shape) {
+        return _shape->find(key);
+    }
+    if (_index.empty()) {
+        return scan(key.data(), key.size());
+    }
+    // a shared key brings its hash along
+    return probe(key.data(), key.size(), key.hash());
+}
 
-    for (size_t i = 0; i < value.size(); ++i) {
-        auto item = New<json_number>(value[i]);
-        obj->SetAt(i, item);
+size_t json_object::scan(const char* key, size_t len) const {
+    for (size_t i = 0; i < _members.size(); i++) {
+        if (_members[i].first.equals(key, len)) {
+            return i;
+        }
     }
-    _value = obj;
-    _key = key;
+    return npos;
 }
 
-key_value_pair::key_value_pair(const std::string& key, const std::vector<uint32_t>& value) {
-    auto obj = New<json_array>();
-    obj->resize(value.size());
+size_t json_object::probe(const char* key, size_t len, size_t hash) const {
+    size_t mask = _index.size() - 1;
+    for (size_t b = hash & mask; _index[b] != 0; b = (b + 1) & mask) {
+        size_t pos = _index[b] - 1;
+        if (_members[pos].first.equals(key, len)) {
+            return pos;
+        }
+    }
+    return npos;
+}
 
-    for (size_t i = 0; i < value.size(); ++i) {
-        auto item = New<json_number>(value[i]);
-        obj->SetAt(i, item);
+void json_object::append(object_key&& key, ref_ptr<json_value> element) {
+    _members.emplace_back(std::move(key), std::move(element));
+    _version++;
+    size_t count = _members.size();
+    if (count <= kIndexThreshold) {
+        return;
     }
-    _value = obj;
-    _key = key;
+    if (count * 2 > _index.size()) {
+        build_index();
+        return;
+    }
+    size_t mask = _index.size() - 1;
+    size_t b = _members.back().first.hash() & mask;
+    while (_index[b] != 0) {
+        b = (b + 1) & mask;
+    }
+    _index[b] = static_cast<uint32_t>(count);
 }
 
-key_value_pair::key_value_pair(const std::string& key, const std::vector<uint64_t>& value) {
-    auto obj = New<json_array>();
-    obj->resize(value.size());
+void json_object::build_index() {
+    size_t buckets = 64;
+    while (buckets < _members.size() * 2) {
+        buckets *= 2;
+    }
+    _index.assign(buckets, 0);
+    size_t mask = buckets - 1;
+    for (size_t i = 0; i < _members.size(); i++) {
+        // shared keys bring their hash along
+        size_t b = _members[i].first.hash() & mask;
+        while (_index[b] != 0) {
+            b = (b + 1) & mask;
+        }
+        _index[b] = static_cast<uint32_t>(i + 1);
+    }
+}
 
-    for (size_t i = 0; i < value.size(); ++i) {
-        auto item = New<json_number>(value[i]);
-        obj->SetAt(i, item);
+std::string json_object::dump() const {
+    std::string out;
+    text::Writer(&out, -1).write(this);
+    return out;
+}
+
+std::string json_object::dump(int indent, int prefix) const {
+    std::string out;
+    text::Writer(&out, indent).write(this, prefix);
+    return out;
+}
+
+ref_ptr<json_value> json_object::copy() const {
+    touch();
+    auto obj = New<json_object>();
+    if (_shape) {
+        obj->_shape = _shape;
+        obj->_slots.reserve(_slots.size());
+        for (const ref_ptr<json_value>& it : _slots) {
+            obj->_slots.push_back(it ? it->copy() : it);
+        }
+        return obj;
     }
-    _value = obj;
-    _key = key;
+    // the keys are already unique and the positions stay the same
+    obj->_members.reserve(_members.size());
+    for (const member& it : _members) {
+        obj->_members.emplace_back(it.first, it.second ? it.second->copy() : it.second);
+    }
+    obj->_index.assign(_index.begin(), _index.end());
+    return obj;
 }
 
-key_value_pair::key_value_pair(const std::string& key, const std::vector<std::string>& value) {
-    auto obj = New<json_array>();
-    obj->resize(value.size());
+ref_ptr<json_object> json_object::clone() const {
+    touch();
+    auto obj = New<json_object>();
+    if (_shape) {
+        obj->_shape = _shape;
+        obj->_slots.reserve(_slots.size());
+        for (const ref_ptr<json_value>& it : _slots) {
+            if (it) {
+                it->share();
+            }
+            obj->_slots.push_back(it);
+        }
+        return obj;
+    }
+    obj->_members.reserve(_members.size());
+    for (const member& it : _members) {
+        if (it.second) {
+            it.second->share();
+        }
+        obj->_members.emplace_back(it.first, it.second);
+    }
+    obj->_index.assign(_index.begin(), _index.end());
+    return obj;
+}
 
-    for (size_t i = 0; i < value.size(); ++i) {
-        auto item = New<json_string>(value[i]);
-        obj->SetAt(i, item);
+void json_object::share_values() const {
+    if (_shape) {
+        for (const ref_ptr<json_value>& it : _slots) {
+            share_tree(it.get());
+        }
+        return;
     }
-    _value = obj;
-    _key = key;
+    for (const member& it : _members) {
+        share_tree(it.second.get());
+    }
+}
+
+std::vector<uint8_t> json_object::to_cbor() const {
+    touch();
+    cbor::Writer obj;
+    size_t size = this->size();
+    obj += cbor::build_object_prefix(size);
+    for (size_t i = 0; i < size; i++) {
+        const object_key& key = key_at(i);
+        const ref_ptr<json_value>& value = value_at(i);
+        obj += cbor::build_string(key.data(), key.size());
+        if (value) {
+            obj += value->to_cbor();
+        } else {
+            obj.write_character(cbor::null_code);
+        }
+    }
+    return obj.binary();
+}
+
+void json_object::set_lazy(std::shared_ptr<text::LazyDocument> doc, uint32_t at) {
+    _members.clear();
+    _index.clear();
+    _shape.reset();
+    _slots.clear();
+    _version++;
+    _lazy = std::move(doc);
+    _lazy_at = at;
+}
+
+void json_object::materialize() const {
+    // detach first, filling the object goes through set_value()
+    auto doc = std::move(_lazy);
+    if (!text::expand_lazy_object(doc, _lazy_at, const_cast<json_object&>(*this))) {
+        // stay unexpanded, every access reports the error
+        _members.clear();
+        _index.clear();
+        _lazy = std::move(doc);
+        THROW_PARSE_ERROR("invalid json object in lazy document");
+    }
+    if (is_shared()) {
+        share_values();
+    }
+}
+
+// ---------------------------  key_value_pair members  ---------------------------------
+
+key_value_pair::key_value_pair() {}
+key_value_pair::~key_value_pair() {}
+key_value_pair::key_value_pair(const std::string& key, const char* value)
+    : _key(key) {
+    if (value) {
+        _value = New<json_string>(value);
+    } else {
+        _value = New<json_null>();
+    }
+}
+
+key_value_pair::key_value_pair(const std::string& key, const std::string& value)
+    : _key(key), _value(New<json_string>(value)){}
+
+key_value_pair::key_value_pair(const std::string& key, int8_t value) 
+    : _key(key), _value(New<json_number>(value)) {}
+
+key_value_pair::key_value_pair(const std::string& key, int16_t value)
+    : _key(key), _value(New<json_number>(value)) {}
+
+key_value_pair::key_value_pair(const std::string& key, int32_t value)
+    : _key(key), _value(New<json_number>(value)) {}
+
+key_value_pair::key_value_pair(const std::string& key, int64_t value)
+    : _key(key), _value(New<json_number>(value)) {}
+
+key_value_pair::key_value_pair(const std::string& key, uint8_t value)
+    : _key(key), _value(New<json_number>(value)) {}
+
+key_value_pair::key_value_pair(const std::string& key, uint16_t value)
+    : _key(key), _value(New<json_number>(value)) {}
+
+key_value_pair::key_value_pair(const std::string& key, uint32_t value)
+    : _key(key), _value(New<json_number>(value)) {}
+
+key_value_pair::key_value_pair(const std::string& key, uint64_t value)
+    : _key(key), _value(New<json_number>(value)) {}
+
+key_value_pair::key_value_pair(const std::string& key, double value)
+    : _key(key), _value(New<json_number>(value)) {}
+
+key_value_pair::key_value_pair(const std::string& key, float value)
+    : _key(key), _value(New<json_number>(value)) {}
+
+key_value_pair::key_value_pair(const std::string& key, bool value)
+    : _key(key), _value(New<json_boolean>(value)) {}
+
+key_value_pair::key_value_pair(const key_value_pair& oth)
+    : _key(oth._key), _value(oth._value) {}
+
+key_value_pair& key_value_pair::operator= (const key_value_pair& rhs) {
+    if (this != &rhs) {
+        _key = rhs._key;
+        _value = rhs._value;
+    }
+    return *this;
 }
 
-key_value_pair::key_value_pair(const std::string& key, const std::vector<double>& value) {
+namespace {
+// every element is stored as a 'Stored' number, which holds them all
+template <typename Stored, typename T>
+ref_ptr<json_array> packed_array(const std::vector<T>& value) {
+    auto obj = New<json_array>();
+    obj->reserve_packed(value.size());
+    for (T v : value) {
+        obj->append_packed(static_cast<Stored>(v));
+    }
+    return obj;
+}
+}  // namespace
+
+key_value_pair::key_value_pair(const std::string& key, const std::vector<int8_t>& value)
+    : _key(key), _value(packed_array<int64_t>(value)) {}
+
+key_value_pair::key_value_pair(const std::string& key, const std::vector<int16_t>& value)
+    : _key(key), _value(packed_array<int64_t>(value)) {}
+
+key_value_pair::key_value_pair(const std::string& key, const std::vector<int32_t>& value)
+    : _key(key), _value(packed_array<int64_t>(value)) {}
+
+key_value_pair::key_value_pair(const std::string& key, const std::vector<int64_t>& value)
+    : _key(key), _value(packed_array<int64_t>(value)) {}
+
+key_value_pair::key_value_pair(const std::string& key, const std::vector<uint8_t>& value)
+    : _key(key), _value(packed_array<int64_t>(value)) {}
+
+key_value_pair::key_value_pair(const std::string& key, const std::vector<uint16_t>& value)
+    : _key(key), _value(packed_array<int64_t>(value)) {}
+
+key_value_pair::key_value_pair(const std::string& key, const std::vector<uint32_t>& value)
+    : _key(key), _value(packed_array<int64_t>(value)) {}
+
+key_value_pair::key_value_pair(const std::string& key, const std::vector<uint64_t>& value)
+    : _key(key), _value(packed_array<uint64_t>(value)) {}
+
+key_value_pair::key_value_pair(const std::string& key, const std::vector<std::string>& value) {
     auto obj = New<json_array>();
     obj->resize(value.size());
 
     for (size_t i = 0; i < value.size(); ++i) {
-        auto item = New<json_number>(value[i]);
+        auto item = New<json_string>(value[i]);
         obj->SetAt(i, item);
     }
     _value = obj;
     _key = key;
 }
 
+key_value_pair::key_value_pair(const std::string& key, const std::vector<double>& value)
+    : _key(key), _value(packed_array<double>(value)) {}
+
+key_value_pair::key_value_pair(const std::string& key, const std::vector<float>& value)
+    : _key(key), _value(packed_array<double>(value)) {}
+
 key_value_pair::key_value_pair(const std::string& key, const std::vector<bool>& value) {
     auto obj = New<json_array>();
     obj->resize(value.size());
@@ -731,124 +1332,235 @@ key_value_pair::key_value_pair(const std::string& key, const std::vector<bool>&
 }
 
 const std::string& key_value_pair::key() const { return _key; }
-std::shared_ptr<json_value> key_value_pair::value() const { return _value; }
+ref_ptr<json_value> key_value_pair::value() const { return _value; }
 
-//////////////////////////////////////////////////////////////////////////
-// ---------------------------  global functions  ---------------------------------
+// ---------------------------  json static members  ---------------------------------
 
-std::shared_ptr<json_value> internal_parse_object(cJSON* js);
-std::shared_ptr<json_value> internal_parse_array(cJSON* js);
+namespace {
+// parse_many hands out documents in batches of about this size,
+// small enough to balance the threads, large enough to amortize
+const size_t kBatchBytes = 32 * 1024;
+
+// [first, last) document numbers
+typedef std::pair<size_t, size_t> document_batch;
+
+void make_batches(const std::vector<size_t>& offsets, std::vector<document_batch>& batches) {
+    size_t first = 0;
+    for (size_t i = 1; i < offsets.size(); i++) {
+        if (offsets[i] - offsets[first] >= kBatchBytes) {
+            batches.push_back(document_batch(first, i));
+            first = i;
+        }
+    }
+    if (first < offsets.size()) {
+        batches.push_back(document_batch(first, offsets.size()));
+    }
+}
 
-std::shared_ptr<json_value> internal_parse_array(cJSON* ptr) {
-    assert(ptr && ptr->type == cJSON_Array);
-    std::shared_ptr<json_array> obj = New<json_array>();
-    cJSON* child = ptr->child;
+json parse_document(text::DocumentReader& reader, const char* ptr, size_t size,
+                    const std::vector<size_t>& offsets, size_t i) {
+    size_t end = (i + 1 < offsets.size()) ? offsets[i + 1] : size;
+    auto obj = reader.read(ptr + offsets[i], end - offsets[i]);
+    return obj ? json(obj) : json();
+}
 
-    while (child) {
-        std::shared_ptr<json_value> value;
-        switch (child->type) {
-        case cJSON_False:
-            value = New<json_boolean>(false);
-            break;
-        case cJSON_True:
-            value = New<json_boolean>(true);
-            break;
-        case cJSON_NULL:
-            value = New<json_null>();
-            break;
-        case cJSON_Number:
-            value = json_number::create(child->valuedouble);
-            break;
-        case cJSON_String:
-            value = New<json_string>(child->valuestring);
-            break;
-        case cJSON_Array:
-            value = internal_parse_array(child);
-            break;
-        case cJSON_Object:
-            value = internal_parse_object(child);
-            break;
-        }
-        assert(value);
+// the text given to json::parse*() holds an array or an object
+void check_root(value_type type) {
+    if (type != value_type::kArray && type != value_type::kObject) {
+        THROW_PARSE_ERROR("the data is not json array or json object");
+    }
+}
 
-        obj->append(value);
-        child = child->next;
+// the json of a parsed value, empty if the text is not json
+json parsed_root(ref_ptr<json_value> obj) {
+    if (!obj) {
+        return json();
     }
-    return obj;
+    check_root(obj->type());
+    return json(std::move(obj));
 }
+}  // namespace
 
-std::shared_ptr<json_value> internal_parse_object(cJSON* ptr) {
-    assert(ptr && ptr->type == cJSON_Object);
-    std::shared_ptr<json_object> obj = New<json_object>();
-    cJSON* child = ptr->child;
-    while (child) {
-        std::shared_ptr<json_value> value;
-        switch (child->type) {
-        case cJSON_False:
-            value = New<json_boolean>(false);
-            break;
-        case cJSON_True:
-            value = New<json_boolean>(true);
-            break;
-        case cJSON_NULL:
-            value = New<json_null>();
-            break;
-        case cJSON_Number:
-            value = json_number::create(child->valuedouble);
-            break;
-        case cJSON_String:
-            value = New<json_string>(child->valuestring);
-            break;
-        case cJSON_Array:
-            value = internal_parse_array(child);
-            break;
-        case cJSON_Object:
-            value = internal_parse_object(child);
-            break;
-        }
-        assert(value);
+json json::parse(const std::string& data) {
+    return parse(data.data(), data.size());
+}
 
-        obj->set_value(child->string, value);
-        child = child->next;
+json json::parse(const char* ptr, size_t size) {
+    if (ptr == nullptr || size == 0) {
+        return json();
     }
-    return obj;
+    auto obj = text::parse_into_json_value(ptr, size, nullptr);
+    return parsed_root(std::move(obj));
 }
 
-// ---------------------------  json static members  ---------------------------------
+json json::parse(const std::string& data, const projection& proj) {
+    return parse(data.data(), data.size(), proj);
+}
 
-json json::parse(const std::string& data) {
-    cJSON* js = cJSON_Parse(data.c_str());
-    if (!js) {
+json json::parse(const char* ptr, size_t size, const projection& proj) {
+    if (ptr == nullptr || size == 0) {
         return json();
     }
-    if (js->type == cJSON_Array) {
-        json obj(internal_parse_array(js));
-        cJSON_Delete(js);
-        return obj;
+    auto obj = text::parse_projection(ptr, size, proj.paths());
+    return parsed_root(std::move(obj));
+}
+
+bool json::parse(const std::string& data, sax_handler* handler) {
+    return parse(data.data(), data.size(), handler);
+}
+
+bool json::parse(const char* ptr, size_t size, sax_handler* handler) {
+    if (ptr == nullptr || size == 0 || handler == nullptr) {
+        return false;
     }
-    if (js->type == cJSON_Object) {
-        json obj(internal_parse_object(js));
-        cJSON_Delete(js);
-        return obj;
+    return text::parse_into_handler(ptr, size, *handler, nullptr);
+}
+
+json json::parse_borrowed(const char* ptr, size_t size) {
+    if (ptr == nullptr || size == 0) {
+        return json();
     }
-    THROW_PARSE_ERROR("the data is not json array or json object");
+    auto obj = text::parse_into_json_value(ptr, size, nullptr, text::kBorrowStrings);
+    return parsed_root(std::move(obj));
 }
 
-json json::parse(const char* ptr, size_t size) {
+json json::parse_lazy(const char* ptr, size_t size) {
     if (ptr == nullptr || size == 0) {
         return json();
     }
-    std::string data(ptr, size);
-    return parse(data);
+    auto obj = text::parse_lazy(ptr, size);
+    return parsed_root(std::move(obj));
+}
+
+json json::parse_compact(const char* ptr, size_t size) {
+    if (ptr == nullptr || size == 0) {
+        return json();
+    }
+    auto doc = text::parse_into_tape(ptr, size);
+    if (!doc) {
+        return json();
+    }
+    check_root(doc->type(0));
+    json js;
+    js._ref = std::move(doc);
+    js._compact = true;
+    return js;
+}
+
+json json::parse_interned(const char* ptr, size_t size, string_pool* pool) {
+    if (ptr == nullptr || size == 0) {
+        return json();
+    }
+    string_pool local;
+    auto obj = text::parse_into_json_value(ptr, size, nullptr, 0, pool ? pool : &local);
+    return parsed_root(std::move(obj));
+}
+
+json json::parse_arena(const char* ptr, size_t size) {
+    if (ptr == nullptr || size == 0) {
+        return json();
+    }
+    auto obj = text::parse_into_json_value(ptr, size, nullptr, text::kArenaValues);
+    return parsed_root(std::move(obj));
+}
+
+json json::parse_parallel(const char* ptr, size_t size, size_t threads, int split_depth) {
+    if (ptr == nullptr || size == 0) {
+        return json();
+    }
+    auto obj = text::parse_parallel(ptr, size, threads, split_depth);
+    return parsed_root(std::move(obj));
+}
+
+std::vector<json> json::parse_many(const char* ptr, size_t size, size_t threads) {
+    std::vector<json> docs;
+    if (ptr == nullptr || size == 0) {
+        return docs;
+    }
+    std::vector<size_t> offsets;
+    text::split_documents(ptr, size, offsets);
+    std::vector<document_batch> batches;
+    make_batches(offsets, batches);
+
+    docs.resize(offsets.size());
+    parallel::for_each_index(batches.size(), threads, [&](size_t b) {
+        text::DocumentReader reader;
+        for (size_t i = batches[b].first; i < batches[b].second; i++) {
+            docs[i] = parse_document(reader, ptr, size, offsets, i);
+        }
+    });
+    return docs;
+}
+
+size_t json::parse_many(const char* ptr, size_t size,
+    const std::function<bool(json&)>& callback, size_t threads) {
+    if (ptr == nullptr || size == 0 || !callback) {
+        return 0;
+    }
+    std::vector<size_t> offsets;
+    text::split_documents(ptr, size, offsets);
+    std::vector<document_batch> batches;
+    make_batches(offsets, batches);
+
+    if (threads == 0) {
+        threads = parallel::hardware_concurrency();
+    }
+    // a few batches per thread are parsed ahead, then delivered in order
+    const size_t window = threads * 4;
+    size_t delivered = 0;
+    std::vector<json> docs;
+    for (size_t begin = 0; begin < batches.size(); begin += window) {
+        size_t end = std::min(begin + window, batches.size());
+        size_t base = batches[begin].first;
+        docs.clear();
+        docs.resize(batches[end - 1].second - base);
+        parallel::for_each_index(end - begin, threads, [&](size_t b) {
+            const document_batch& batch = batches[begin + b];
+            text::DocumentReader reader;
+            for (size_t i = batch.first; i < batch.second; i++) {
+                docs[i - base] = parse_document(reader, ptr, size, offsets, i);
+            }
+        });
+        for (auto& doc : docs) {
+            delivered++;
+            if (!callback(doc)) {
+                return delivered;
+            }
+        }
+    }
+    return delivered;
 }
 
 json json::parse(std::istream* stream) {
     if (!stream) {
         return json();
     }
-    std::stringstream ss;
-    ss << stream->rdbuf();
-    return parse(ss.str());
+    // a file or string stream tells its size: one read into a buffer
+    // of that size, then the indexed parser
+    const std::ios::iostate state = stream->rdstate();
+    const std::istream::pos_type begin = stream->tellg();
+    if (begin != std::istream::pos_type(-1) && stream->seekg(0, std::ios::end)) {
+        const std::istream::pos_type end = stream->tellg();
+        stream->seekg(begin);
+        if (end != std::istream::pos_type(-1) && end >= begin && *stream) {
+            std::string data(static_cast<size_t>(end - begin), '\0');
+            stream->read(&data[0], static_cast<std::streamsize>(data.size()));
+            data.resize(static_cast<size_t>(stream->gcount()));
+            return parse(data);
+        }
+    }
+    stream->clear(state);
+
+    // a pipe or socket: the push parser, peak memory is the tree and a block
+    parser p;
+    std::vector<char> buff(64 * 1024);
+    while (!p.done() && *stream) {
+        stream->read(buff.data(), static_cast<std::streamsize>(buff.size()));
+        if (!p.feed(buff.data(), static_cast<size_t>(stream->gcount()))) {
+            return json();
+        }
+    }
+    return p.finish();
 }
 
 json json::from_cbor(const uint8_t* ptr, size_t len, size_t* tranfer_bytes) {
@@ -863,59 +1575,261 @@ json json::from_cbor(const uint8_t* ptr, size_t len, size_t* tranfer_bytes) {
     return json(obj);
 }
 
-json json::from_cbor(const std::vector<uint8_t>& bin, size_t* tranfer_bytes) {
-    if (bin.empty()){
-        return json();
-    }
-    size_t parse_bytes = 0;
-    auto obj = cbor::parse_into_arbitrary_json_object(bin.data(), bin.size(), &parse_bytes);
-    if (tranfer_bytes) {
-        *tranfer_bytes = parse_bytes;
-    }
-    return json(obj);
+json json::from_cbor(const std::vector<uint8_t>& bin, size_t* tranfer_bytes) {
+    if (bin.empty()){
+        return json();
+    }
+    size_t parse_bytes = 0;
+    auto obj = cbor::parse_into_arbitrary_json_object(bin.data(), bin.size(), &parse_bytes);
+    if (tranfer_bytes) {
+        *tranfer_bytes = parse_bytes;
+    }
+    return json(obj);
+}
+
+std::vector<uint8_t> json::to_cbor(json js) {
+    return js.to_cbor();
+}
+
+json json::array() {
+    return json(New<json_array>());
+}
+
+json json::object() {
+    return json(New<json_object>());
+}
+
+// ---------------------------  object_key members  ---------------------------------
+
+object_key::object_key(const char* ptr, size_t len) : _tag(kNone) {
+    if (len <= max_inline) {
+        memcpy(_buf, ptr, len);
+        _tag = static_cast<uint8_t>(len);
+        return;
+    }
+    shared_string* str = shared_string::create(ptr, len).detach();
+    memcpy(_buf, &str, sizeof(str));
+    _tag = kShared;
+}
+
+object_key::object_key(ref_ptr<shared_string> key) : _tag(kShared) {
+    shared_string* str = key.detach();
+    memcpy(_buf, &str, sizeof(str));
+}
+
+object_key::object_key(const object_key& other) : _tag(kNone) {
+    copy_bytes(other);
+    if (_tag == kShared) {
+        shared()->add_ref();
+    }
+}
+
+object_key& object_key::operator=(const object_key& other) {
+    if (this != &other) {
+        object_key(other).swap(*this);
+    }
+    return *this;
+}
+
+object_key& object_key::operator=(object_key&& other) noexcept {
+    if (this != &other) {
+        reset();
+        copy_bytes(other);
+        other._tag = kNone;
+    }
+    return *this;
+}
+
+void object_key::swap(object_key& other) noexcept {
+    object_key tmp(std::move(other));
+    other = std::move(*this);
+    *this = std::move(tmp);
+}
+
+const char* object_key::data() const {
+    if (_tag == kShared) {
+        return shared()->data();
+    }
+    return _buf;
+}
+
+size_t object_key::size() const {
+    if (_tag == kShared) {
+        return shared()->size();
+    }
+    return _tag == kNone ? 0 : _tag;
+}
+
+size_t object_key::hash() const {
+    if (_tag == kShared) {
+        return shared()->hash();
+    }
+    return hash_key(data(), size());
+}
+
+void object_key::reset() {
+    if (_tag == kShared) {
+        shared()->release();
+    }
+    _tag = kNone;
+}
+
+shared_string* object_key::shared() const {
+    shared_string* str;
+    memcpy(&str, _buf, sizeof(str));
+    return str;
+}
+
+// ---------------------------  string_pool members  ---------------------------------
+
+struct string_pool::impl {
+    // open addressing, entries hold the hash and the shared string
+    template <typename T>
+    struct table {
+        std::vector<std::pair<size_t, ref_ptr<T>>> buckets;
+        size_t count = 0;
+    };
+
+    template <typename T>
+    ref_ptr<T> find_or_add(table<T>& t, const char* ptr, size_t len,
+                           const std::function<ref_ptr<T>()>& create) {
+        size_t h = hash_key(ptr, len);
+        if (t.buckets.empty()) {
+            t.buckets.resize(64);
+        }
+        size_t mask = t.buckets.size() - 1;
+        size_t b = h & mask;
+        for (; t.buckets[b].second; b = (b + 1) & mask) {
+            const ref_ptr<T>& s = t.buckets[b].second;
+            if (t.buckets[b].first == h && s->size() == len && memcmp(s->data(), ptr, len) == 0) {
+                return s;
+            }
+        }
+        if (size() >= capacity) {
+            return nullptr;
+        }
+        ref_ptr<T> s = create();
+        t.buckets[b] = std::make_pair(h, s);
+        t.count++;
+        bytes += len;
+        if (t.count * 2 > t.buckets.size()) {
+            grow(t);
+        }
+        return s;
+    }
+
+    template <typename T>
+    void grow(table<T>& t) {
+        std::vector<std::pair<size_t, ref_ptr<T>>> old(t.buckets.size() * 2);
+        old.swap(t.buckets);
+        size_t mask = t.buckets.size() - 1;
+        for (auto& e : old) {
+            if (e.second) {
+                size_t b = e.first & mask;
+                while (t.buckets[b].second) {
+                    b = (b + 1) & mask;
+                }
+                t.buckets[b] = std::move(e);
+            }
+        }
+    }
+
+    size_t size() const { return keys.count + values.count; }
+
+    std::mutex mutex;
+    table<shared_string> keys;
+    table<json_string> values;
+    size_t capacity;
+    size_t bytes = 0;
+};
+
+string_pool::string_pool(size_t capacity) : _impl(new impl) {
+    _impl->capacity = capacity;
+}
+
+string_pool::~string_pool() {}
+
+size_t string_pool::size() const {
+    std::lock_guard<std::mutex> lock(_impl->mutex);
+    return _impl->size();
 }
 
-std::vector<uint8_t> json::to_cbor(json js) {
-    return js.to_cbor();
+size_t string_pool::bytes() const {
+    std::lock_guard<std::mutex> lock(_impl->mutex);
+    return _impl->bytes;
 }
 
-json json::array() {
-    return json(New<json_array>());
+void string_pool::clear() {
+    std::lock_guard<std::mutex> lock(_impl->mutex);
+    _impl->keys = impl::table<shared_string>();
+    _impl->values = impl::table<json_string>();
+    _impl->bytes = 0;
 }
 
-json json::object() {
-    return json(New<json_object>());
+ref_ptr<shared_string> string_pool::key(const char* ptr, size_t len) {
+    if (len <= object_key::max_inline) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(_impl->mutex);
+    return _impl->find_or_add<shared_string>(_impl->keys, ptr, len, [ptr, len]() {
+        return shared_string::create(ptr, len);
+    });
+}
+
+ref_ptr<json_string> string_pool::value(const char* ptr, size_t len) {
+    if (len > max_value_size) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(_impl->mutex);
+    return _impl->find_or_add<json_string>(_impl->values, ptr, len, [ptr, len]() {
+        return New<json_string>(ptr, len, interned_t());
+    });
 }
 
 // ---------------------------  json members  ---------------------------------
 
-json::json(std::shared_ptr<json_value> item)
-    : _depth(0), _data(item) {}
+json::json(ref_ptr<json_value> item)
+    : _depth(0), _compact(false), _ref(std::move(item)) {}
 
-json::json() : _depth(0) {}
+json::json() : _depth(0), _compact(false) {}
 
 json::json(const json& j)
     : _depth(j._depth)
-    , _data(j._data)
-    , _index(j._index)
-    , _key(j._key) {}
+    , _compact(j._compact)
+    , _version(j._version)
+    , _ref(j._ref)
+    , _pos(j._pos)
+    , _key(j._key)
+    , _slot(j._slot) {}
 
 json::json(std::initializer_list<key_value_pair> init)
-    : _depth(0) {
+    : _depth(0), _compact(false) {
     auto obj = New<json_object>();
     for (auto it = init.begin(); it != init.end(); ++it) {
         obj->set_value(it->key(), it->value());
     }
-    _data = std::move(obj);
+    _ref = std::move(obj);
 }
 
 json& json::operator=(const json& j) {
-    auto value = j.current_value();
+    if (j._compact && _depth == 0) {
+        // share the compact document instead of building its tree
+        _ref = j._ref;
+        _compact = true;
+        _pos = j._pos;
+        return *this;
+    }
+    auto value = j.assigned_value();
     fill_current_value(value);
     return *this;
 }
 
 std::string json::dump(int indent) const {
+    if (has_tape_value()) {
+        std::string out;
+        text::Writer(&out, indent).write(tape(), _pos);
+        return out;
+    }
     auto obj = current_value();
     if (!obj) {
         return _depth ? std::string(NULL_STR) : std::string(EMPTY_OBJ);
@@ -926,10 +1840,96 @@ std::string json::dump(int indent) const {
     return obj->dump(indent, 0);
 }
 
-bool json::empty() const {
+bool json::dump_to(const sink_callback& sink, int indent) const {
+    if (has_tape_value()) {
+        return text::Writer(sink, indent).write(tape(), _pos);
+    }
     auto obj = current_value();
     if (!obj) {
+        const char* text = _depth ? NULL_STR : EMPTY_OBJ;
+        return sink(text, strlen(text));
+    }
+    return text::Writer(sink, indent).write(obj.get());
+}
+
+bool json::dump_to(std::ostream& stream, int indent) const {
+    return dump_to([&stream](const char* ptr, size_t len) {
+        stream.write(ptr, static_cast<std::streamsize>(len));
+        return static_cast<bool>(stream);
+    }, indent);
+}
+
+bool json::dump_to(int fd, int indent) const {
+    return dump_to([fd](const char* ptr, size_t len) {
+        while (len > 0) {
+#ifdef _WIN32
+            int n = _write(fd, ptr, static_cast<unsigned int>(len));
+#else
+            ssize_t n = write(fd, ptr, len);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+#endif
+            if (n <= 0) {
+                return false;
+            }
+            ptr += n;
+            len -= static_cast<size_t>(n);
+        }
         return true;
+    }, indent);
+}
+
+size_t json::dump_size(int indent) const {
+    if (has_tape_value()) {
+        return text::measure_text(tape(), _pos, indent);
+    }
+    auto obj = current_value();
+    if (!obj) {
+        return strlen(_depth ? NULL_STR : EMPTY_OBJ);
+    }
+    return text::measure_text(obj.get(), indent);
+}
+
+size_t json::dump_into(char* buff, size_t capacity, int indent) const {
+    if (has_tape_value()) {
+        text::Writer writer(buff, capacity, indent);
+        return writer.write(tape(), _pos) ? writer.size() : 0;
+    }
+    auto obj = current_value();
+    if (!obj) {
+        const char* text = _depth ? NULL_STR : EMPTY_OBJ;
+        size_t len = strlen(text);
+        if (len > capacity) {
+            return 0;
+        }
+        memcpy(buff, text, len);
+        return len;
+    }
+    text::Writer writer(buff, capacity, indent);
+    return writer.write(obj.get()) ? writer.size() : 0;
+}
+
+void json::dump_append(std::string& out, int indent) const {
+    if (has_tape_value()) {
+        text::Writer(&out, indent).write(tape(), _pos);
+        return;
+    }
+    auto obj = current_value();
+    if (!obj) {
+        out += _depth ? NULL_STR : EMPTY_OBJ;
+        return;
+    }
+    text::Writer(&out, indent).write(obj.get());
+}
+
+bool json::empty() const {
+    if (_compact) {
+        return _pos == tape::npos || tape()->empty(_pos);
+    }
+    json_value* obj = current_node();
+    if (!obj) {
+        return !packed_parent();
     }
     return obj->empty();
 }
@@ -938,16 +1938,94 @@ json json::copy() const {
     if (!obj) {
         return json();
     }
+    if (_compact) {
+        // current_value() already built a tree of its own
+        return json(obj);
+    }
     json js(obj->copy());
     return js;
 }
 
+json json::copy_on_write() const {
+    if (_compact || packed_parent()) {
+        if (!_compact) {
+            // a number in a packed array has no node to share
+            return copy();
+        }
+        // a compact document is read-only already
+        json js;
+        if (_pos != tape::npos) {
+            js._ref = _ref;
+            js._compact = true;
+            js._pos = _pos;
+        }
+        return js;
+    }
+    json_value* obj = current_node();
+    if (!obj || (obj->type() != value_type::kArray && obj->type() != value_type::kObject)) {
+        return copy();
+    }
+    // each side keeps a root of its own, so every json holding either
+    // root keeps seeing its document; the values below are shared
+    if (obj->type() == value_type::kArray) {
+        auto arr = static_cast<json_array*>(obj);
+        arr->share_values();
+        return json(arr->clone());
+    }
+    auto map = static_cast<json_object*>(obj);
+    map->share_values();
+    return json(map->clone());
+}
+
 std::vector<uint8_t> json::to_cbor() const {
+    std::vector<uint8_t> out;
+    to_cbor_append(out);
+    return out;
+}
+
+size_t json::cbor_size() const {
+    if (has_tape_value()) {
+        return cbor::encoded_size(tape(), _pos);
+    }
+    auto obj = current_value();
+    return obj ? cbor::encoded_size(obj.get()) : 0;
+}
+
+size_t json::to_cbor_into(uint8_t* buff, size_t capacity) const {
+    if (has_tape_value()) {
+        size_t size = cbor::encoded_size(tape(), _pos);
+        if (size > capacity) {
+            return 0;
+        }
+        cbor::encode_into(tape(), _pos, buff);
+        return size;
+    }
+    auto obj = current_value();
+    if (!obj) {
+        return 0;
+    }
+    size_t size = cbor::encoded_size(obj.get());
+    if (size > capacity) {
+        return 0;
+    }
+    cbor::encode_into(obj.get(), buff);
+    return size;
+}
+
+void json::to_cbor_append(std::vector<uint8_t>& out) const {
+    if (has_tape_value()) {
+        size_t used = out.size();
+        out.resize(used + cbor::encoded_size(tape(), _pos));
+        cbor::encode_into(tape(), _pos, out.data() + used);
+        return;
+    }
     auto obj = current_value();
     if (!obj) {
-        return std::vector<uint8_t>();
+        return;
     }
-    return obj->to_cbor();
+    size_t used = out.size();
+    out.resize(used + cbor::encoded_size(obj.get()));
+    cbor::encode_into(obj.get(), out.data() + used);
 }
 
 bool json::is_null() const {
@@ -980,100 +2058,76 @@ bool json::is_structured() const {
 }
 
 bool json::has_key(const std::string& key) const {
-    auto value = current_value();
+    if (_compact) {
+        return is_object() && tape()->member(_pos, key.data(), key.size()) != tape::npos;
+    }
+    json_value* value = current_node();
     if (value && value->type() == value_type::kObject) {
-        auto obj = As<json_object>(value);
-        return obj->has_key(key);
+        return static_cast<json_object*>(value)->has_key(key);
     }
     return false;
 }
 
 void json::erase(const std::string& key) {
-    auto value = current_value();
+    if (_compact) {
+        THROW_OTHER_ERROR(READ_ONLY_STR);
+    }
+    json_value* value = writable_node();
     if (value && value->type() == value_type::kObject) {
-        auto obj = As<json_object>(value);
-        obj->erase(key);
+        static_cast<json_object*>(value)->erase(key);
     }
 }
 
 void json::erase(size_t idx) {
-    auto value = current_value();
+    if (_compact) {
+        THROW_OTHER_ERROR(READ_ONLY_STR);
+    }
+    json_value* value = writable_node();
     if (value && value->type() == value_type::kArray) {
-        auto obj = As<json_array>(value);
-        obj->erase(idx);
+        static_cast<json_array*>(value)->erase(idx);
     }
 }
 
 json json::operator[](size_t index) {
-    if (_depth != 0) {
-        json js;
-        js._data = current_value();
-        if (!js._data) {
-            auto obj = New<json_array>();
-            fill_current_value(obj);
-            js._data = obj;
-        }
-        js._index = New<size_t>(index);
-        js._depth = _depth + 1;
-        return js;
+    if (_compact) {
+        return static_cast<const json&>(*this)[index];
     }
-
-    if (!_data || _data->type() == value_type::kNull) {
-        json js;
-        _data = New<json_array>();
-        js._data = _data;
-        js._index = New<size_t>(index);
-        js._depth = _depth + 1;
-        return js;
-    } else if (_data->type() == value_type::kArray) {
-        json js;
-        js._data = _data;
-        js._index = New<size_t>(index);
-        js._depth = _depth + 1;
-        return js;
+    json js;
+    js._ref = container(value_type::kArray);
+    if (!js._ref) {
+        THROW_OTHER_ERROR("cannot use operator[] with a size_t argument with " + std::string(current_type()));
     }
-
-    THROW_OTHER_ERROR("cannot use operator[] with a size_t argument with " + std::string(current_type()));
+    js._pos = index;
+    js._depth = _depth + 1;
+    js.cache_slot();
+    return js;
 }
 
 json json::operator[](const std::string& key) {
-    if (_depth != 0) {
-        json js;
-        js._data = current_value();
-        if (!js._data) {
-            auto obj = New<json_object>();
-            fill_current_value(obj);
-            js._data = obj;
-        }
-        js._key = New<std::string>(key);
-        js._depth = _depth + 1;
-        return js;
-    } 
-    
-    if (!_data || _data->type() == value_type::kNull) {
-        json js;
-        _data = New<json_object>();
-        js._data = _data;
-        js._key = New<std::string>(key);
-        js._depth = _depth + 1;
-        return js;
-    } else if (_data->type() == value_type::kObject) {
-        json js;
-        js._data = _data;
-        js._key = New<std::string>(key);
-        js._depth = _depth + 1;
-        return js;
+    if (_compact) {
+        return static_cast<const json&>(*this)[key];
+    }
+    json js;
+    js._ref = container(value_type::kObject);
+    if (!js._ref) {
+        THROW_OTHER_ERROR("cannot use operator[] with a string argument with " + std::string(current_type()));
     }
-    
-    THROW_OTHER_ERROR("cannot use operator[] with a string argument with " + std::string(current_type()));
+    js._key = object_key(key);
+    js._depth = _depth + 1;
+    js.cache_slot();
+    return js;
 }
 
 const json json::operator[](size_t index) const {
     if (is_array()) {
+        if (_compact) {
+            return tape_child(tape()->element(_pos, index));
+        }
         json js;
-        js._data = current_value();
-        js._index = New<size_t>(index);
+        js._ref = current_value();
+        js._pos = index;
         js._depth = _depth + 1;
+        js.cache_slot();
         return js;
     }
 
@@ -1083,10 +2137,14 @@ const json json::operator[](size_t index) const {
 
 const json json::operator[](const std::string& key) const {
     if (is_object()) {
+        if (_compact) {
+            return tape_child(tape()->member(_pos, key.data(), key.size()));
+        }
         json js;
-        js._data = current_value();
-        js._key = New<std::string>(key);
+        js._ref = current_value();
+        js._key = object_key(key);
         js._depth = _depth + 1;
+        js.cache_slot();
         return js;
     }
 
@@ -1096,56 +2154,36 @@ const json json::operator[](const std::string& key) const {
 
 void json::clear() {
     _depth = 0;
-    _data.reset();
-    _index.reset();
-    _key.reset();
+    _compact = false;
+    _ref.reset();
+    _pos = 0;
+    _key = object_key();
+    _slot = nullptr;
 }
 
 size_t json::size() {
-    auto obj = current_value();
+    if (_compact) {
+        return _pos == tape::npos ? 0 : tape()->size(_pos);
+    }
+    json_value* obj = current_node();
     if (obj) {
         if (obj->type() == value_type::kArray) {
-            auto vec = As<json_array>(obj);
-            return vec->size();
+            return static_cast<json_array*>(obj)->size();
         }
         if (obj->type() == value_type::kObject) {
-            auto map = As<json_object>(obj);
-            return map->size();
+            return static_cast<json_object*>(obj)->size();
         }
     }
     return 0;
 }
 
 json& json::assign(const std::string& s) {
-    if (_index) {
-        auto vec = As<json_array>(_data);
-        auto old = vec->GetAt(*_index);
-        if (!old || old->type() != value_type::kString) {
-            old = New<json_string>(s);
-            vec->SetAt(*_index, old);
-        } else {
-            auto obj = As<json_string>(old);
-            obj ->operator= (s);
-        }
-        return *this;
-    }
-    if (_key) {
-        auto map = As<json_object>(_data);
-        auto old = map->get_value(*_key);
-        if (!old || old->type() != value_type::kString) {
-            old = New<json_string>(s);
-            map->set_value(*_key, old);
-        } else {
-            auto obj = As<json_string>(old);
-            obj ->operator= (s);
-        }
-        return *this;
-    }
-    if (!_data || _data->type() != value_type::kString) {
-        _data = New<json_string>(s);
+    release_tape();
+    json_value* old = writable_node();
+    if (old && old->type() == value_type::kString) {
+        static_cast<json_string*>(old)->operator= (s);
     } else {
-        auto obj = As<json_string>(_data);
-        obj ->operator= (s);
+        fill_current_value(New<json_string>(s));
     }
     return *this;
 }
@@ -1166,126 +2204,46 @@ json& json::assign(double value) {
 }
 
 json& json::set_json_number(json_value* value) {
-    json_number* number = dynamic_cast<json_number*>(value);
-    if (_index) {
-        auto vec = As<json_array>(_data);
-        auto old = vec->GetAt(*_index);
-        if (!old || old->type() != value_type::kNumber) {
-            old = New<json_number>(*number);
-            vec->SetAt(*_index, old);
-        } else {
-            auto obj = As<json_number>(old);
-            obj->operator= (*number);
-        }
+    json_number* number = static_cast<json_number*>(value);
+    release_tape();
+    json_array* packed = packed_parent();
+    if (packed && !packed->is_shared() && packed->set_packed(_pos, *number)) {
         return *this;
     }
-    if (_key) {
-        auto map = As<json_object>(_data);
-        auto old = map->get_value(*_key);
-        if (!old || old->type() != value_type::kNumber) {
-            old = New<json_number>(*number);
-            map->set_value(*_key, old);
-        } else {
-            auto obj = As<json_number>(old);
-            obj->operator= (*number);
-        }
-        return *this;
-    }
-    if (!_data || _data->type() != value_type::kNumber) {
-        _data = New<json_number>(*number);
+    json_value* old = writable_node();
+    if (old && old->type() == value_type::kNumber) {
+        static_cast<json_number*>(old)->operator= (*number);
     } else {
-        auto obj = As<json_number>(_data);
-        obj->operator= (*number);
+        fill_current_value(New<json_number>(*number));
     }
     return *this;
 }
 
 json& json::assign(bool v) {
-    if (_index) {
-        auto vec = As<json_array>(_data);
-        auto old = vec->GetAt(*_index);
-        if (!old || old->type() != value_type::kBoolean) {
-            old = New<json_boolean>(v);
-            vec->SetAt(*_index, old);
-        } else {
-            auto obj = As<json_boolean>(old);
-            obj ->operator= (v);
-        }
-        return *this;
-    }
-    if (_key) {
-        auto map = As<json_object>(_data);
-        auto old = map->get_value(*_key);
-        if (!old || old->type() != value_type::kBoolean) {
-            old = New<json_boolean>(v);
-            map->set_value(*_key, old);
-        } else {
-            auto obj = As<json_boolean>(old);
-            obj ->operator= (v);
-        }
-        return *this;
-    }
-    if (!_data || _data->type() != value_type::kBoolean) {
-        _data = New<json_boolean>(v);
+    release_tape();
+    json_value* old = writable_node();
+    if (old && old->type() == value_type::kBoolean) {
+        static_cast<json_boolean*>(old)->operator= (v);
     } else {
-        auto obj = As<json_boolean>(_data);
-        obj ->operator= (v);
+        fill_current_value(New<json_boolean>(v));
     }
     return *this;
 }
 
 void json::push_back(json j) {
-    if (_depth == 0) {
-        if (!_data || _data->type() == value_type::kNull) {
-            auto obj = New<json_array>();
-            obj->append(j.current_value());
-            _data = obj;
-            return;
-        } else if (_data->type() == value_type::kArray) {
-            auto obj = As<json_array>(_data);
-            obj->append(j.current_value());
-            return;
-        }
-    } else {
-        if (_index) {
-            auto obj = As<json_array>(_data);
-            auto real = obj->GetAt(*_index);
-            if (!real) {
-                auto vec = New<json_array>();
-                obj->SetAt(*_index, vec);
-                vec->append(j.current_value());
-            } else {
-                auto vec = As<json_array>(real);
-                vec->append(j.current_value());
-            }
-            return;
-        }
-
-        if (_key) {
-            auto obj = As<json_object>(_data);
-            auto real = obj->get_value(*_key);
-            if (!real) {
-                auto vec = New<json_array>();
-                obj->set_value(*_key, vec);
-                vec->append(j.current_value());
-            } else {
-                auto vec = As<json_array>(real);
-                vec->append(j.current_value());
-            }
-            return;
-        }
-        value_type type = get_type();
-        if (type == value_type::kNull) {
-            auto obj = New<json_array>();
-            _data = obj;
-            obj->append(j._data);
-            return;
-        }
-        if (type == value_type::kArray) {
-            auto obj = As<json_array>(_data);
-            obj->append(j._data);
-            return;
-        }
+    if (_compact) {
+        THROW_OTHER_ERROR(READ_ONLY_STR);
+    }
+    json_value* node = writable_node();
+    if (!node || node->type() == value_type::kNull) {
+        auto obj = New<json_array>();
+        obj->append(j.current_value());
+        fill_current_value(obj);
+        return;
+    }
+    if (node->type() == value_type::kArray) {
+        static_cast<json_array*>(node)->append(j.current_value());
+        return;
     }
 
     THROW_TYPE_ERROR("cannot use push_back() with " + std::string(current_type()));
@@ -1299,26 +2257,139 @@ const char* json::type_name(value_type ty) {
 }
 
 value_type json::get_type() const {
-    auto obj = current_value();
+    if (_compact) {
+        return _pos == tape::npos ? value_type::kNull : tape()->type(_pos);
+    }
+    json_value* obj = current_node();
     if (!obj) {
-        return value_type::kNull;
+        return packed_parent() ? value_type::kNumber : value_type::kNull;
     }
     return obj->type();
 }
 
-std::shared_ptr<json_value> json::current_value() const {
+ref_ptr<json_value> json::current_value() const {
+    if (_compact) {
+        return _pos == tape::npos ? nullptr : tape()->to_json_value(_pos);
+    }
+    json_value* node = current_node();
+    if (!node) {
+        json_array* packed = packed_parent();
+        if (packed) {
+            return New<json_number>(packed->number_at(_pos));
+        }
+    }
+    return ref_ptr<json_value>(node);
+}
+
+ref_ptr<json_value> json::assigned_value() const {
+    // an element of a packed array has no node, current_value() would
+    // hand out a number of its own: the array is unpacked instead, like
+    // for anything that needs its nodes
+    json_array* packed = packed_parent();
+    if (packed) {
+        packed->unpack();
+    }
+    // a value of a string_pool (parse_interned) or of a copy_on_write()
+    // document is never changed, a clone would only be seen by the json
+    // it is assigned to: like writable_node(), it is replaced by a node of
+    // this document's own first. Inside a shared container it stays, and
+    // changing it through that json throws.
+    json_value* node = current_node();
+    if (node && node->is_shared() && _depth != 0 && !data()->is_shared()) {
+        json owner(*this);
+        return ref_ptr<json_value>(owner.writable_node());
+    }
+    return current_value();
+}
+
+json_value* json::current_node() const {
+    // values of a compact document have no node
+    if (_compact) {
+        return nullptr;
+    }
     if (_depth == 0) {
-        return _data;
+        return data();
+    }
+    const ref_ptr<json_value>* slot = current_slot();
+    return slot ? slot->get() : nullptr;
+}
+
+const ref_ptr<json_value>* json::current_slot() const {
+    if (_slot && _version == data()->version()) {
+        return _slot;
+    }
+    // the lookup is not kept here, a const json can be read by several threads
+    return find_slot();
+}
+
+const ref_ptr<json_value>* json::find_slot() const {
+    // _ref is the array or object holding the value, its type is fixed
+    if (_key.empty()) {
+        json_array* arr = static_cast<json_array*>(data());
+        // the elements of a packed array have no slot
+        return arr->is_packed() ? nullptr : arr->slot(_pos);
+    }
+    return static_cast<json_object*>(data())->slot(_key);
+}
+
+void json::cache_slot() {
+    _slot = find_slot();
+    _version = data()->version();
+}
+
+ref_ptr<json_value> json::container(value_type type) {
+    ref_ptr<json_value> value(writable_node());
+    if (!value || value->type() == value_type::kNull) {
+        if (type == value_type::kArray) {
+            value = New<json_array>();
+        } else {
+            value = New<json_object>();
+        }
+        fill_current_value(value);
+    } else if (value->type() != type) {
+        return nullptr;
+    }
+    return value;
+}
+
+json_value* json::writable_node() {
+    // the container of a json below the root was made writable on the
+    // way down, unless the json was taken before a copy_on_write()
+    if (_depth != 0 && data()->is_shared()) {
+        THROW_OTHER_ERROR(SHARED_STR);
+    }
+    json_array* packed = packed_parent();
+    if (packed) {
+        packed->unpack();
     }
-    if (_index) {
-        auto obj = As<json_array>(_data);
-        return obj->GetAt(*_index);
+    json_value* node = current_node();
+    if (!node || !node->is_shared()) {
+        return node;
     }
-    if (_key) {
-        auto obj = As<json_object>(_data);
-        return obj->get_value(*_key);
+    // a shared value held by a root json came through operator=, a clone
+    // would only be seen by this json
+    if (_depth == 0) {
+        THROW_OTHER_ERROR(SHARED_STR);
+    }
+    // one level is cloned, the children stay shared
+    ref_ptr<json_value> clone;
+    if (node->type() == value_type::kArray) {
+        clone = static_cast<json_array*>(node)->clone();
+    } else if (node->type() == value_type::kObject) {
+        clone = static_cast<json_object*>(node)->clone();
+    } else {
+        clone = node->copy();
+    }
+    fill_current_value(clone);
+    return clone.get();
+}
+
+json_array* json::packed_parent() const {
+    if (_depth == 0 || !_key.empty() || _compact) {
+        return nullptr;
     }
-    THROW_OTHER_ERROR("cann't get current value, depth = " + std::to_string(_depth));
+    json_array* arr = static_cast<json_array*>(data());
+    return arr->is_packed() && _pos < arr->size() ? arr : nullptr;
 }
 
 const char* json::current_type() const {
@@ -1326,66 +2397,134 @@ const char* json::current_type() const {
 }
 
 std::string json::to_string() const {
-    auto obj = current_value();
+    if (_compact && get_type() == value_type::kString) {
+        return std::string(tape()->string_data(_pos), tape()->string_size(_pos));
+    }
+    json_value* obj = current_node();
     if (!obj || obj->type() != value_type::kString) {
         THROW_TYPE_ERROR("type must be string, but is " + std::string(current_type()));
     }
-    return *As<json_string>(obj);
+    return static_cast<json_string*>(obj)->value();
 }
 
 bool json::to_bool() const {
-    auto obj = current_value();
+    if (_compact && get_type() == value_type::kBoolean) {
+        return tape()->boolean(_pos);
+    }
+    json_value* obj = current_node();
     if (!obj || obj->type() != value_type::kBoolean) {
         THROW_TYPE_ERROR("type must be boolean, but is " + std::string(current_type()));
     }
-    return *As<json_boolean>(obj);
+    return *static_cast<json_boolean*>(obj);
 }
 
 uint64_t json::to_uint64() const {
-    auto obj = current_value();
+    if (_compact && get_type() == value_type::kNumber) {
+        return tape()->number(_pos);
+    }
+    json_value* obj = current_node();
+    if (!obj && packed_parent()) {
+        return packed_parent()->number_at(_pos);
+    }
     if (!obj || obj->type() != value_type::kNumber) {
         THROW_TYPE_ERROR("type must be number, but is " + std::string(current_type()));
     }
-    return *As<json_number>(obj);
+    return *static_cast<json_number*>(obj);
 }
 
 int64_t json::to_int64() const {
-    auto obj = current_value();
+    if (_compact && get_type() == value_type::kNumber) {
+        return tape()->number(_pos);
+    }
+    json_value* obj = current_node();
+    if (!obj && packed_parent()) {
+        return packed_parent()->number_at(_pos);
+    }
     if (!obj || obj->type() != value_type::kNumber) {
         THROW_TYPE_ERROR("type must be number, but is " + std::string(current_type()));
     }
-    return *As<json_number>(obj);
+    return *static_cast<json_number*>(obj);
 }
 
 double json::to_double() const {
-    auto obj = current_value();
+    if (_compact && get_type() == value_type::kNumber) {
+        return tape()->number(_pos);
+    }
+    json_value* obj = current_node();
+    if (!obj && packed_parent()) {
+        return packed_parent()->number_at(_pos);
+    }
     if (!obj || obj->type() != value_type::kNumber) {
         THROW_TYPE_ERROR("type must be number, but is " + std::string(current_type()));
     }
-    return *As<json_number>(obj);
+    return *static_cast<json_number*>(obj);
 }
 
-void json::fill_current_value(std::shared_ptr<json_value> obj) {
+void json::fill_current_value(ref_ptr<json_value> obj) {
+    release_tape();
     if (_depth == 0) {
-        _data = obj;
+        _ref = obj;
         return;
     }
+    if (data()->is_shared()) {
+        THROW_OTHER_ERROR(SHARED_STR);
+    }
 
-    if (_index) {
-        auto vec = As<json_array>(_data);
-        vec->SetAt(*_index, obj);
-        return;
+    if (_key.empty()) {
+        static_cast<json_array*>(data())->SetAt(_pos, obj);
+    } else {
+        static_cast<json_object*>(data())->set_value(_key.str(), obj);
     }
-    if (_key) {
-        auto map = As<json_object>(_data);
-        map->set_value(*_key, obj);
+    cache_slot();
+}
+
+const tape::Document* json::tape() const {
+    return _compact ? static_cast<const tape::Document*>(_ref.get()) : nullptr;
+}
+
+void json::release_tape() {
+    // the value of a root json is replaced, the document is left alone;
+    // the values inside a compact document cannot be changed
+    if (!_compact) {
         return;
     }
-    THROW_OTHER_ERROR("cann't fill current value, depth = " + std::to_string(_depth));
+    if (_depth != 0) {
+        THROW_OTHER_ERROR(READ_ONLY_STR);
+    }
+    _ref.reset();
+    _compact = false;
+    _pos = 0;
+}
+
+json json::tape_child(size_t at) const {
+    json js;
+    js._ref = _ref;
+    js._compact = true;
+    js._pos = at;
+    js._depth = _depth + 1;
+    return js;
 }
 
 json_iterator json::begin() {
     json_iterator it;
+    if (_compact) {
+        if (_pos == tape::npos) {
+            return it;
+        }
+        it._js_obj = New<json>();
+        it._js_obj->_ref = _ref;
+        it._js_obj->_compact = true;
+        it._js_obj->_pos = _pos;
+        if (tape()->type(_pos) == value_type::kArray) {
+            if (tape()->size(_pos) == 0) {
+                return json_iterator();
+            }
+            it._js_obj->_pos = tape()->first_child(_pos);
+            it._js_obj->_depth = 1;
+            it._tape_end = tape()->next(_pos);
+        }
+        return it;
+    }
     auto obj = current_value();
     if (obj) {
         if (obj->type() == value_type::kArray) {
@@ -1393,14 +2532,13 @@ json_iterator json::begin() {
             if (vec->empty()) {
                 return it;
             }
-            it._iter = vec->begin();
             it._js_obj = New<json>();
-            it._js_obj->_data = obj;
+            it._js_obj->_ref = obj;
             it._js_obj->_depth = 1;
-            it._js_obj->_index = New<size_t>(0);
+            it._js_obj->cache_slot();
         } else {
             it._js_obj = New<json>();
-            it._js_obj->_data = obj;
+            it._js_obj->_ref = obj;
         }
         it._value = obj;
     }
@@ -1419,13 +2557,13 @@ json_iterator::~json_iterator() {}
 json_iterator::json_iterator(const json_iterator& iter)
     : _js_obj(iter._js_obj)
     , _value(iter._value)
-    , _iter(iter._iter) {}
+    , _tape_end(iter._tape_end) {}
 
 json_iterator& json_iterator::operator= (const json_iterator& iter) {
     if (this != &iter) {
         _js_obj = iter._js_obj;
         _value = iter._value;
-        _iter = iter._iter;
+        _tape_end = iter._tape_end;
     }
     return *this;
 }
@@ -1454,23 +2592,32 @@ bool json_iterator::equal(const json_iterator& rhs) const {
     if ((!_js_obj && rhs._js_obj) || (_js_obj && !rhs._js_obj)) {
         return false;
     }
-    if (_value->type() != rhs._value->type()) {
-        return false;
-    }
-    if (_iter == rhs._iter) {
-        return true;
+    if (_js_obj->_compact || rhs._js_obj->_compact) {
+        return _js_obj->_compact == rhs._js_obj->_compact && _js_obj->_ref == rhs._js_obj->_ref &&
+            _js_obj->_pos == rhs._js_obj->_pos;
     }
-    return false;
+    return _value.get() == rhs._value.get() && _js_obj->_pos == rhs._js_obj->_pos;
 }
 
 void json_iterator::increment() {
+    if (_js_obj && _js_obj->_compact) {
+        // arrays step to the next element, anything else is a single value
+        if (_tape_end != 0) {
+            _js_obj->_pos = _js_obj->tape()->next(_js_obj->_pos);
+            if (_js_obj->_pos != _tape_end) {
+                return;
+            }
+        }
+        _js_obj.reset();
+        return;
+    }
     if (!_js_obj || !_value) {
         THROW_INVALID_INTERATOR("cannot use increment for an invalid iterator");
     }
     if (_value->type() == value_type::kArray) {
-        auto obj = As<json_array>(_value);
-        if (++_iter != obj->end()) {
-            (*_js_obj->_index) += 1;
+        // elements are visited by index, a packed array stays packed
+        if (++_js_obj->_pos < static_cast<json_array*>(_value.get())->size()) {
+            _js_obj->cache_slot();
             return;
         }
     }
@@ -1478,4 +2625,30 @@ void json_iterator::increment() {
     _js_obj.reset();
     _value.reset();
 }
+
+// ---------------------------  parser members  ---------------------------------
+
+parser::parser() : _reader(new text::PushReader()) {}
+parser::~parser() {}
+
+bool parser::feed(const char* ptr, size_t len) {
+    return _reader->feed(ptr, len);
+}
+
+bool parser::feed(const std::string& data) {
+    return _reader->feed(data.data(), data.size());
+}
+
+bool parser::done() const {
+    return _reader->done();
+}
+
+json parser::finish() {
+    auto obj = _reader->finish();
+    return parsed_root(std::move(obj));
+}
+
+void parser::reset() {
+    _reader->reset();
+}
 }  // namespace karl
@@ -20,57 +20,85 @@
 //
 
 #pragma once
-#include <unordered_map>
+#include <utility>
 #include "karl/json.hxx"
 
 namespace karl {
+namespace text { struct LazyDocument; }
 
 // ---------------------------------------------------------------------------------
 
+// shared ownership of a T: ref_ptr for json values, shared_ptr otherwise
+template <typename T>
+using ptr_of = typename std::conditional<std::is_base_of<ref_counted, T>::value,
+    ref_ptr<T>, std::shared_ptr<T>>::type;
+
+template <typename T, typename... Args>
+inline ref_ptr<T> make_ptr(std::true_type, Args&&... args) {
+    return ref_ptr<T>(new T(std::forward<Args>(args)...));
+}
+
 template <typename T, typename... Args>
-inline std::shared_ptr<T> New(Args&&... args) {
+inline std::shared_ptr<T> make_ptr(std::false_type, Args&&... args) {
     return std::make_shared<T>(std::forward<Args>(args)...);
 }
 
-class json_value {
+template <typename T, typename... Args>
+inline ptr_of<T> New(Args&&... args) {
+    return make_ptr<T>(std::is_base_of<ref_counted, T>(), std::forward<Args>(args)...);
+}
+
+// Immutable string owned through ref_ptr, the bytes follow the header in
+// the same allocation and the hash is computed once (see object_key).
+class shared_string final : public ref_counted {
 public:
-    virtual ~json_value() = default;
-    virtual value_type type() const = 0;
-    virtual std::string dump() const = 0;
-    virtual std::string dump(int indent, int prefix) const = 0;
-    virtual bool empty() const = 0;
-    virtual std::shared_ptr<json_value> copy() const = 0;
-    virtual std::vector<uint8_t> to_cbor() const = 0;
+    static ref_ptr<shared_string> create(const char* ptr, size_t len);
+
+    const char* data() const { return reinterpret_cast<const char*>(this + 1); }
+    size_t size() const { return _size; }
+    size_t hash() const { return _hash; }
+
+private:
+    shared_string(size_t size, size_t hash) : _size(size), _hash(hash) {}
+    void destroy() const noexcept override;
+
+    size_t _size;
+    size_t _hash;
 };
 
+// hash of object keys, the one shared_string keeps
+size_t hash_key(const char* ptr, size_t len);
+
 class json_null : public json_value {
 public:
-    json_null() {}
+    static const value_type kType = value_type::kNull;
+
+    json_null() : json_value(kType) {}
     ~json_null() {}
 
-    value_type type() const override;
     std::string dump() const override;
     std::string dump(int, int) const override;
     bool empty() const override;
     std::string value() const;
-    std::shared_ptr<json_value> copy() const override;
+    ref_ptr<json_value> copy() const override;
     std::vector<uint8_t> to_cbor() const override;
 };
 
 class json_boolean : public json_value {
 public:
-    explicit json_boolean(bool value) : _value(value) {}
-    json_boolean() {}
+    static const value_type kType = value_type::kBoolean;
+
+    explicit json_boolean(bool value) : json_value(kType), _value(value) {}
+    json_boolean() : json_value(kType) {}
     ~json_boolean() {}
 
-    value_type type() const override;
     inline bool value() const { return _value; }
     operator bool() const { return _value; }
     std::string dump() const override;
     std::string dump(int, int) const override;
     json_boolean& operator= (bool value);
     bool empty() const override;
-    std::shared_ptr<json_value> copy() const override;
+    ref_ptr<json_value> copy() const override;
     std::vector<uint8_t> to_cbor() const override;
 
 private:
@@ -82,9 +110,10 @@ public:
     enum class number_type {
         kUnsigned, kSigned, kFloat
     };
+    static const value_type kType = value_type::kNumber;
 
-    static std::shared_ptr<json_value> create(double value);
-    json_number() : _value_type(number_type::kUnsigned), _value() {}
+    static ref_ptr<json_value> create(double value);
+    json_number() : json_value(kType), _value_type(number_type::kUnsigned), _value() {}
     json_number(int8_t value);
     json_number(int16_t value);
     json_number(int32_t value);
@@ -124,12 +153,11 @@ public:
     bool is_unsigned() const;
     bool is_signed() const;
 
-    value_type type() const override { return value_type::kNumber; }
     std::string dump() const override;
     std::string dump(int, int) const override;
     bool empty() const override { return false; }
     void clear() { _value.clear(); }
-    std::shared_ptr<json_value> copy() const override;
+    ref_ptr<json_value> copy() const override;
     std::vector<uint8_t> to_cbor() const override;
     void set_value(int64_t value);
     void set_value(uint64_t value);
@@ -150,40 +178,103 @@ private:
     } _value;
 };
 
+// Tag for a json_string that refers to memory owned by someone else,
+// see json::parse_borrowed for the lifetime rules.
+struct borrowed_t {};
+
+// Tag for the read-only json_string nodes of a string_pool.
+struct interned_t {};
+
+// Strings of up to max_inline bytes are stored inside the node, so a short
+// value costs one allocation. Longer ones are in a separate buffer, or
+// borrowed from the parsed input or an arena. The node is 56 bytes.
 class json_string : public json_value {
 public:
-    json_string() {}
+    static const value_type kType = value_type::kString;
+    static const size_t max_inline = 24;
+    // longest string, a longer one throws std::length_error
+    static const size_t max_size = UINT32_MAX;
+
+    json_string() : json_value(kType), _size(0), _storage(kInline) {}
     json_string(const char* value);
     json_string(const std::string& value);
-    value_type type() const override { return value_type::kString; }
-    const std::string& value() const { return _value; }
-    operator std::string() const { return _value; }
+    json_string(const char* ptr, size_t len);
+    json_string(const char* ptr, size_t len, borrowed_t);
+    // a shared value of a string_pool, see json_value::is_shared()
+    json_string(const char* ptr, size_t len, interned_t);
+    ~json_string();
+
+    json_string(const json_string&) = delete;
+    json_string& operator= (const json_string&) = delete;
+
+    std::string value() const { return std::string(data(), size()); }
+    operator std::string() const { return value(); }
     json_string& operator= (const std::string& value);
     std::string dump() const override;
     std::string dump(int, int) const override;
-    void clear() { _value.clear(); }
+    void clear() { assign(nullptr, 0); }
     bool empty() const override {
-        return _value.empty();
+        return size() == 0;
     }
-    std::shared_ptr<json_value> copy() const override;
+    ref_ptr<json_value> copy() const override;
     std::vector<uint8_t> to_cbor() const override;
 
+    // raw access, valid for every kind of storage
+    const char* data() const { return _storage == kInline ? _inline : _ptr; }
+    size_t size() const { return _size; }
+    bool is_borrowed() const { return _storage == kBorrowed; }
+
 private:
-    std::string _value;
+    enum storage : uint8_t { kInline, kHeap, kBorrowed };
+
+    // replace the bytes, they may not overlap the current ones
+    void assign(const char* ptr, size_t len);
+
+    uint32_t _size;
+    storage _storage;
+    union {
+        char _inline[max_inline];
+        const char* _ptr;
+    };
 };
 
+// A packed array keeps numbers of one kind in a plain vector instead of a
+// node per element; the parser and the vector constructors make one when
+// every element is an int64, a uint64 or a double. Elements are read and
+// numbers of the same kind written in place through json without nodes.
+// Whatever needs the nodes (slots, the sequence iterators, a value of
+// another kind) unpacks the array first.
 class json_array : public json_value {
 public:
-    json_array() {}
+    static const value_type kType = value_type::kArray;
 
-    std::shared_ptr<json_value> GetAt(size_t i);
-    bool SetAt(size_t i, std::shared_ptr<json_value> element);
+    enum class packed_kind : uint8_t {
+        kNone, kInt64, kUint64, kDouble
+    };
+    union packed_number {
+        int64_t i64;
+        uint64_t u64;
+        double d;
+    };
+    using packed_sequence = std::vector<packed_number, arena_allocator<packed_number>>;
 
-    std::shared_ptr<json_value>& operator[] (size_t i);
-    const std::shared_ptr<json_value>& operator[] (size_t i) const;
+    json_array() : json_value(kType) {}
+    explicit json_array(const sequence::allocator_type& alloc)
+        : json_value(kType), _seq(alloc), _numbers(alloc) {}
 
-    bool insert(size_t i, std::shared_ptr<json_value> element);
-    void append(std::shared_ptr<json_value> element);
+    ref_ptr<json_value> GetAt(size_t i);
+    // no reference is taken, nullptr past the end
+    json_value* at(size_t i) const;
+    // same for the slot holding the element, which stays
+    // at its address until version() changes
+    const ref_ptr<json_value>* slot(size_t i) const;
+    bool SetAt(size_t i, ref_ptr<json_value> element);
+
+    ref_ptr<json_value>& operator[] (size_t i);
+    const ref_ptr<json_value>& operator[] (size_t i) const;
+
+    bool insert(size_t i, ref_ptr<json_value> element);
+    void append(ref_ptr<json_value> element);
     void resize(size_t size);
     void clear();
     size_t size() const;
@@ -192,28 +283,138 @@ public:
     array_iterator begin();
     array_iterator end();
 
-    value_type type() const override { return value_type::kArray; }
     std::string dump() const override;
     std::string dump(int, int) const override;
     bool empty() const override {
-        return _seq.empty();
+        return size() == 0;
     }
-    std::shared_ptr<json_value> copy() const override;
+    ref_ptr<json_value> copy() const override;
     std::vector<uint8_t> to_cbor() const override;
+    // a new array holding the same, now shared, elements
+    ref_ptr<json_array> clone() const;
+    // mark every value below this array shared (json::copy_on_write), the
+    // elements of a lazy or packed array are marked when they are made
+    void share_values() const;
+
+    bool is_packed() const { return _packed != packed_kind::kNone; }
+    packed_kind packed() const { return _packed; }
+    // element i of a packed array, i < size()
+    json_number number_at(size_t i) const;
+    packed_number packed_at(size_t i) const { return _numbers[i]; }
+    // append to an empty or packed array, false if the number is not of
+    // its kind and has to be appended as a node
+    bool append_packed(int64_t value);
+    bool append_packed(uint64_t value);
+    bool append_packed(double value);
+    // replace element i of a packed array in place, false if i is past
+    // the end or the number is not of its kind
+    bool set_packed(size_t i, const json_number& value);
+    void reserve_packed(size_t size) { _numbers.reserve(size); }
+    // build the nodes of a packed array
+    void unpack() const;
+
+    // the elements are read from 'doc' on first access (json::parse_lazy),
+    // 'at' is the position of the '[' in its structural index
+    void set_lazy(std::shared_ptr<text::LazyDocument> doc, uint32_t at);
 
 private:
-    sequence _seq;
+    void touch() const {
+        if (_lazy) materialize();
+        if (is_packed()) unpack();
+    }
+    void materialize() const;
+    bool accepts_packed(packed_kind kind);
+
+    mutable sequence _seq;
+    mutable std::shared_ptr<text::LazyDocument> _lazy;
+    uint32_t _lazy_at = 0;
+    mutable packed_kind _packed = packed_kind::kNone;
+    mutable packed_sequence _numbers;
 };
 
+// The keys of the objects that have the same keys in the same order, like
+// the records of an array (a hidden class). Such an object keeps only its
+// values, value i belongs to key(i). A shape is not changed once built, so
+// objects, documents and threads share it.
+class object_shape final : public ref_counted {
+public:
+    static const size_t npos = static_cast<size_t>(-1);
+
+    // takes the keys, which are unique
+    object_shape(object_key* keys, size_t count, size_t hash);
+
+    size_t size() const { return _keys.size(); }
+    const object_key& key(size_t i) const { return _keys[i]; }
+    // slot of the key, npos if it is not one of the shape
+    size_t find(const char* key, size_t len) const;
+    // same, with the hash a shared key keeps
+    size_t find(const object_key& key) const;
+    // hash of the key sequence, see shape_table
+    size_t hash() const { return _hash; }
+    bool equals(const object_key* keys, size_t count) const;
+
+private:
+    size_t scan(const char* key, size_t len) const;
+    size_t probe(const char* key, size_t len, size_t hash) const;
+
+    std::vector<object_key> _keys;
+    // slot + 1 per bucket like json_object::_index, 0 for a small shape
+    std::vector<uint32_t> _index;
+    size_t _hash;
+};
+
+// The shapes of the objects built for one document, objects with the same
+// key sequence get the same shape. Not thread safe.
+class shape_table final {
+public:
+    // the shape of 'keys', added from them (moved) the first time;
+    // nullptr if a key appears twice
+    ref_ptr<object_shape> find_or_add(object_key* keys, size_t count);
+    void clear();
+
+private:
+    void grow();
+
+    std::vector<ref_ptr<object_shape>> _buckets;
+    size_t _count = 0;
+    // sibling records mostly repeat the shape of the previous one
+    object_shape* _last = nullptr;
+};
+
+// Members are kept in insertion order in one vector. Small objects are
+// searched linearly; once an object has more than kIndexThreshold members
+// an open addressing table of member positions is built next to them.
+//
+// An object built by the parser holds an object_shape and a vector of its
+// values instead (see shape_table). Values are read and replaced in their
+// slots; adding or erasing a key, or the member iterators, move the
+// object to its own members first.
 class json_object : public json_value {
 public:
-    using object = std::unordered_map<std::string, std::shared_ptr<json_value>>;
+    using member = std::pair<object_key, ref_ptr<json_value>>;
+    using object = std::vector<member, arena_allocator<member>>;
     using iterator = object::iterator;
 
-    json_object() = default;
+    static const value_type kType = value_type::kObject;
+    static const size_t kIndexThreshold = 16;
+
+    json_object() : json_value(kType) {}
+    explicit json_object(const object::allocator_type& alloc)
+        : json_value(kType), _members(alloc), _index(alloc), _slots(alloc) {}
     bool has_key(const std::string& key) const;
-    std::shared_ptr<json_value> get_value(const std::string& key) const;
-    void set_value(const std::string& key, std::shared_ptr<json_value> element);
+    ref_ptr<json_value> get_value(const std::string& key) const;
+    // no reference is taken, nullptr if missing
+    json_value* find(const std::string& key) const;
+    // same for the slot holding the value, which stays
+    // at its address until version() changes
+    const ref_ptr<json_value>* slot(const std::string& key) const;
+    const ref_ptr<json_value>* slot(const char* key, size_t len) const;
+    // a long key is not hashed again, see object_key
+    const ref_ptr<json_value>* slot(const object_key& key) const;
+    // a new key is appended, an existing one keeps its position
+    void set_value(const std::string& key, ref_ptr<json_value> element);
+    void set_value(std::string&& key, ref_ptr<json_value> element);
+    void set_value(object_key&& key, ref_ptr<json_value> element);
     void clear();
 
     iterator begin();
@@ -222,16 +423,69 @@ public:
 
     size_t size() const;
 
-    value_type type() const override { return value_type::kObject; }
     std::string dump() const override;
     std::string dump(int indent, int) const override;
     bool empty() const override {
-        return _map.empty();
+        return size() == 0;
     }
-    std::shared_ptr<json_value> copy() const override;
+    ref_ptr<json_value> copy() const override;
     std::vector<uint8_t> to_cbor() const override;
+    // a new object holding the same, now shared, members
+    ref_ptr<json_object> clone() const;
+    // mark every value below this object shared, see json_array
+    void share_values() const;
+
+    // make an empty object one of 'shape', its shape->size() values are
+    // moved from 'values'
+    void adopt(ref_ptr<object_shape> shape, ref_ptr<json_value>* values);
+    // nullptr if the object holds its own keys. A lookup repeated over
+    // objects of one shape can keep the slot:
+    //   if (obj->shape() != shape) { shape = obj->shape(); i = shape->find(k, n); }
+    //   value = obj->value_at(i);
+    const object_shape* shape() const {
+        touch();
+        return _shape.get();
+    }
+    // value of member or slot i, i < size()
+    const ref_ptr<json_value>& value_at(size_t i) const {
+        return _shape ? _slots[i] : _members[i].second;
+    }
+    const object_key& key_at(size_t i) const {
+        return _shape ? _shape->key(i) : _members[i].first;
+    }
+
+    // the members are read from 'doc' on first access (json::parse_lazy),
+    // 'at' is the position of the '{' in its structural index
+    void set_lazy(std::shared_ptr<text::LazyDocument> doc, uint32_t at);
 
 private:
-    object _map;
+    void touch() const {
+        if (_lazy) materialize();
+    }
+    void materialize() const;
+
+    // position of the member in _members, npos if missing
+    static const size_t npos = static_cast<size_t>(-1);
+    size_t lookup(const char* key, size_t len) const;
+    size_t lookup(const object_key& key) const;
+    // linear search of the members, and probe of the index with 'hash'
+    size_t scan(const char* key, size_t len) const;
+    size_t probe(const char* key, size_t len, size_t hash) const;
+    void append(object_key&& key, ref_ptr<json_value> element);
+    void build_index();
+    // drop member 'pos' from the index before it is erased
+    void unindex(size_t pos);
+    // keys and values of the shape become members
+    void unshape();
+
+    mutable object _members;
+    // member position + 1 per bucket, 0 for an empty one; the size is a
+    // power of two at least twice the number of members, or 0 for a small
+    // object
+    mutable std::vector<uint32_t, arena_allocator<uint32_t>> _index;
+    ref_ptr<object_shape> _shape;
+    mutable sequence _slots;
+    mutable std::shared_ptr<text::LazyDocument> _lazy;
+    uint32_t _lazy_at = 0;
 };
 }  // namespace karl
@@ -0,0 +1,57 @@
+// Copyright (c) 2019 shadow-yuan. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "LICENSE");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// An easy to use c++ json library
+// Version 1.0.0
+// https://github.com/shadow-yuan/karl
+//
+// Authors: Shadow Yuan (shadow_yuan@qq.com)
+//
+
+#pragma once
+#include "karl.h"
+#include <stddef.h>
+#include <stdint.h>
+
+namespace karl {
+namespace numeric {
+
+// Parse the json number at the beginning of 'ptr' into 'number'.
+//
+// Integer literals that fit are stored exactly as signed/unsigned
+// 64-bit values. Everything else becomes the correctly rounded double:
+// Clinger's fast path first, then the Eisel-Lemire algorithm, and
+// strtod for the rare inputs neither of them can decide.
+//
+// Returns false if the text does not match the json number grammar,
+// 'consumed' receives the length of the number.
+bool parse_number(const char* ptr, size_t len, size_t* consumed, json_number& number);
+
+// Longest text of the format_* functions
+const size_t max_number_size = 32;
+
+// Decimal text of 'value' in [out, out + returned length).
+size_t format_int64(int64_t value, char* out);
+size_t format_uint64(uint64_t value, char* out);
+
+// Shortest text that parse_number reads back as exactly 'value' (Grisu2,
+// the shortest in all but a tiny fraction of cases, always the same value).
+// Numbers from 1e-6 up to 1e21 are written like 0.000125 or 1500.0, the
+// others like 1.5e+300; the '.' or the exponent keeps a double a double
+// when it is parsed again. NaN and infinity have no json text, they are
+// written as null.
+size_t format_double(double value, char* out);
+
+}  // namespace numeric
+}  // namespace karl
@@ -0,0 +1,69 @@
+// Copyright (c) 2019 shadow-yuan. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "LICENSE");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// An easy to use c++ json library
+// Version 1.0.0
+// https://github.com/shadow-yuan/karl
+//
+// Authors: Shadow Yuan (shadow_yuan@qq.com)
+//
+
+#include "parallel.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace karl {
+namespace parallel {
+
+size_t hardware_concurrency() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+void for_each_index(size_t count, size_t threads, const std::function<void(size_t)>& fn) {
+    if (threads == 0) {
+        threads = hardware_concurrency();
+    }
+    if (threads > count) {
+        threads = count;
+    }
+    if (threads <= 1) {
+        for (size_t i = 0; i < count; i++) {
+            fn(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    auto worker = [&next, count, &fn]() {
+        size_t i;
+        while ((i = next.fetch_add(1, std::memory_order_relaxed)) < count) {
+            fn(i);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    pool.reserve(threads - 1);
+    for (size_t i = 1; i < threads; i++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto& t : pool) {
+        t.join();
+    }
+}
+
+}  // namespace parallel
+}  // namespace karl
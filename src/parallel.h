@@ -0,0 +1,39 @@
+// Copyright (c) 2019 shadow-yuan. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "LICENSE");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// An easy to use c++ json library
+// Version 1.0.0
+// https://github.com/shadow-yuan/karl
+//
+// Authors: Shadow Yuan (shadow_yuan@qq.com)
+//
+
+#pragma once
+#include <stddef.h>
+#include <functional>
+
+namespace karl {
+namespace parallel {
+
+// Number of hardware threads, at least 1.
+size_t hardware_concurrency();
+
+// Call fn(i) for every i in [0, count) on up to 'threads' threads, the
+// calling thread included, and return when all of them are done. Indexes
+// are handed out one at a time, so uneven work items balance themselves.
+// 0 threads means hardware_concurrency().
+void for_each_index(size_t count, size_t threads, const std::function<void(size_t)>& fn);
+
+}  // namespace parallel
+}  // namespace karl
@@ -0,0 +1,501 @@
+// Copyright (c) 2019 shadow-yuan. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "LICENSE");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// An easy to use c++ json library
+// Version 1.0.0
+// https://github.com/shadow-yuan/karl
+//
+// Authors: Shadow Yuan (shadow_yuan@qq.com)
+//
+
+#include "structural.h"
+#include <string.h>
+#include <algorithm>
+#include <limits>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define KARL_X86_64 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// the cpus with avx2 also have bmi1 and popcnt, see cpu_supports_avx2()
+#if defined(__GNUC__) || defined(__clang__)
+#define KARL_TARGET_AVX2 __attribute__((target("avx2,bmi,popcnt")))
+#define KARL_ALWAYS_INLINE __attribute__((always_inline))
+#elif defined(_MSC_VER)
+#define KARL_TARGET_AVX2
+#define KARL_ALWAYS_INLINE __forceinline
+#else
+#define KARL_TARGET_AVX2
+#define KARL_ALWAYS_INLINE
+#endif
+
+// The algorithm follows simdjson's stage 1 (https://arxiv.org/abs/1902.08318):
+// every 64 bytes are turned into bit masks, escaped quotes are removed,
+// a prefix xor over the quote mask gives the bytes inside strings, and
+// what remains outside of strings are the structural positions.
+
+namespace karl {
+namespace text {
+namespace {
+const size_t block_size = 64;
+
+// how many blocks a kernel classifies per call
+const size_t batch_blocks = 64;
+
+struct block_masks {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t op;            // { } [ ] : ,
+    uint64_t whitespace;    // space \t \n \r
+};
+
+typedef void (*classify_fn)(const char* ptr, size_t blocks, block_masks* out);
+typedef size_t (*scan_fn)(const char* ptr, size_t len);
+typedef bool (*index_fn)(const char* ptr, size_t len, std::vector<uint32_t>& index);
+
+inline unsigned trailing_zeroes(uint64_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(__builtin_ctzll(v));
+#elif defined(_MSC_VER) && defined(KARL_X86_64)
+    unsigned long index = 0;
+    _BitScanForward64(&index, v);
+    return static_cast<unsigned>(index);
+#else
+    unsigned n = 0;
+    while (!(v & 1)) { v >>= 1; n++; }
+    return n;
+#endif
+}
+
+inline size_t popcount(uint64_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<size_t>(__builtin_popcountll(v));
+#else
+    v = v - ((v >> 1) & 0x5555555555555555ULL);
+    v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+    v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return static_cast<size_t>((v * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+inline uint64_t prefix_xor(uint64_t v) {
+    v ^= v << 1;
+    v ^= v << 2;
+    v ^= v << 4;
+    v ^= v << 8;
+    v ^= v << 16;
+    v ^= v << 32;
+    return v;
+}
+
+// ----------------------------- scalar kernel -----------------------------
+
+enum : uint8_t {
+    kQuote = 1, kBackslash = 2, kOp = 4, kWhitespace = 8
+};
+
+class CharacterTable {
+public:
+    CharacterTable() {
+        memset(_table, 0, sizeof(_table));
+        _table[static_cast<uint8_t>('"')] = kQuote;
+        _table[static_cast<uint8_t>('\\')] = kBackslash;
+        const char ops[] = "{}[]:,";
+        for (size_t i = 0; i < sizeof(ops) - 1; i++) {
+            _table[static_cast<uint8_t>(ops[i])] = kOp;
+        }
+        const char spaces[] = " \t\n\r";
+        for (size_t i = 0; i < sizeof(spaces) - 1; i++) {
+            _table[static_cast<uint8_t>(spaces[i])] = kWhitespace;
+        }
+    }
+    inline uint8_t get(char c) const { return _table[static_cast<uint8_t>(c)]; }
+
+private:
+    uint8_t _table[256];
+};
+
+#ifndef KARL_X86_64
+const CharacterTable character_table;
+
+void classify_scalar(const char* ptr, size_t blocks, block_masks* out) {
+    for (size_t b = 0; b < blocks; b++) {
+        block_masks m = { 0, 0, 0, 0 };
+        const char* p = ptr + b * block_size;
+        for (size_t i = 0; i < block_size; i++) {
+            uint8_t cls = character_table.get(p[i]);
+            uint64_t bit = uint64_t(1) << i;
+            if (cls & kQuote) m.quote |= bit;
+            if (cls & kBackslash) m.backslash |= bit;
+            if (cls & kOp) m.op |= bit;
+            if (cls & kWhitespace) m.whitespace |= bit;
+        }
+        out[b] = m;
+    }
+}
+#endif  // KARL_X86_64
+
+// bytes a json string can not hold as they are: '"', '\\' and below 0x20
+inline bool needs_escape(char c) {
+    return c == '"' || c == '\\' || static_cast<uint8_t>(c) < 0x20;
+}
+
+size_t scan_unescaped_scalar(const char* ptr, size_t len) {
+    size_t i = 0;
+    while (i < len && !needs_escape(ptr[i])) {
+        i++;
+    }
+    return i;
+}
+
+// ------------------------------ x86 kernels ------------------------------
+
+#ifdef KARL_X86_64
+void classify_sse2(const char* ptr, size_t blocks, block_masks* out) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i lower = _mm_set1_epi8(0x20);
+    const __m128i open = _mm_set1_epi8('{');    // '[' | 0x20 == '{'
+    const __m128i close = _mm_set1_epi8('}');   // ']' | 0x20 == '}'
+    const __m128i colon = _mm_set1_epi8(':');
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+
+    for (size_t b = 0; b < blocks; b++) {
+        block_masks m = { 0, 0, 0, 0 };
+        const char* p = ptr + b * block_size;
+        for (int i = 0; i < 4; i++) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i * 16));
+            const __m128i v20 = _mm_or_si128(v, lower);
+            const int shift = i * 16;
+
+            m.quote |= static_cast<uint64_t>(static_cast<uint16_t>(
+                _mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)))) << shift;
+            m.backslash |= static_cast<uint64_t>(static_cast<uint16_t>(
+                _mm_movemask_epi8(_mm_cmpeq_epi8(v, backslash)))) << shift;
+
+            __m128i op = _mm_or_si128(_mm_cmpeq_epi8(v20, open), _mm_cmpeq_epi8(v20, close));
+            op = _mm_or_si128(op, _mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, comma)));
+            m.op |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(op))) << shift;
+
+            __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab));
+            ws = _mm_or_si128(ws, _mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr)));
+            m.whitespace |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(ws))) << shift;
+        }
+        out[b] = m;
+    }
+}
+
+size_t scan_unescaped_sse2(const char* ptr, size_t len) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1f);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr + i));
+        // max(v, 0x1f) == 0x1f for the bytes below 0x20
+        __m128i hit = _mm_cmpeq_epi8(_mm_max_epu8(v, control), control);
+        hit = _mm_or_si128(hit, _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)));
+        const int mask = _mm_movemask_epi8(hit);
+        if (mask) {
+            return i + trailing_zeroes(static_cast<uint64_t>(mask));
+        }
+    }
+    return i + scan_unescaped_scalar(ptr + i, len - i);
+}
+
+KARL_TARGET_AVX2
+void classify_avx2(const char* ptr, size_t blocks, block_masks* out) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i lower = _mm256_set1_epi8(0x20);
+    const __m256i open = _mm256_set1_epi8('{');
+    const __m256i close = _mm256_set1_epi8('}');
+    const __m256i colon = _mm256_set1_epi8(':');
+    const __m256i comma = _mm256_set1_epi8(',');
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i cr = _mm256_set1_epi8('\r');
+
+    for (size_t b = 0; b < blocks; b++) {
+        block_masks m = { 0, 0, 0, 0 };
+        const char* p = ptr + b * block_size;
+        for (int i = 0; i < 2; i++) {
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i * 32));
+            const __m256i v20 = _mm256_or_si256(v, lower);
+            const int shift = i * 32;
+
+            m.quote |= static_cast<uint64_t>(static_cast<uint32_t>(
+                _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote)))) << shift;
+            m.backslash |= static_cast<uint64_t>(static_cast<uint32_t>(
+                _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, backslash)))) << shift;
+
+            __m256i op = _mm256_or_si256(_mm256_cmpeq_epi8(v20, open), _mm256_cmpeq_epi8(v20, close));
+            op = _mm256_or_si256(op, _mm256_or_si256(_mm256_cmpeq_epi8(v, colon), _mm256_cmpeq_epi8(v, comma)));
+            m.op |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(op))) << shift;
+
+            __m256i ws = _mm256_or_si256(_mm256_cmpeq_epi8(v, space), _mm256_cmpeq_epi8(v, tab));
+            ws = _mm256_or_si256(ws, _mm256_or_si256(_mm256_cmpeq_epi8(v, lf), _mm256_cmpeq_epi8(v, cr)));
+            m.whitespace |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(ws))) << shift;
+        }
+        out[b] = m;
+    }
+}
+
+bool cpu_supports_avx2() {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi") &&
+        __builtin_cpu_supports("popcnt");
+#elif defined(_MSC_VER)
+    int info[4] = { 0 };
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    const bool popcnt = (info[2] & (1 << 23)) != 0;
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    if (!popcnt || !osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    // avx2 and bmi1
+    return (info[1] & (1 << 5)) != 0 && (info[1] & (1 << 3)) != 0;
+#else
+    return false;
+#endif
+}
+KARL_TARGET_AVX2
+size_t scan_unescaped_avx2(const char* ptr, size_t len) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i control = _mm256_set1_epi8(0x1f);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr + i));
+        __m256i hit = _mm256_cmpeq_epi8(_mm256_max_epu8(v, control), control);
+        hit = _mm256_or_si256(hit, _mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+                                                   _mm256_cmpeq_epi8(v, backslash)));
+        const uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(hit));
+        if (mask) {
+            return i + trailing_zeroes(mask);
+        }
+    }
+    return i + scan_unescaped_sse2(ptr + i, len - i);
+}
+
+#endif  // KARL_X86_64
+
+// Carries the string/escape/scalar state from one block to the next.
+class IndexBuilder {
+public:
+    IndexBuilder(std::vector<uint32_t>& index, size_t len)
+        : _index(index), _len(len), _count(0)
+        , _prev_escaped(0), _prev_in_string(0), _prev_scalar(0) {}
+
+    KARL_ALWAYS_INLINE void add_block(const block_masks& m, uint32_t base) {
+        const uint64_t escaped = find_escaped(m.backslash);
+        const uint64_t quote = m.quote & ~escaped;
+        // opening quote and string body are set, closing quote is clear
+        const uint64_t in_string = prefix_xor(quote) ^ _prev_in_string;
+        _prev_in_string = (in_string >> 63) ? ~uint64_t(0) : 0;
+        const uint64_t string_tail = in_string ^ quote;
+
+        // first byte of every run that is neither whitespace, an operator nor a quote
+        const uint64_t scalar = ~(m.op | m.whitespace | quote);
+        const uint64_t follows_scalar = (scalar << 1) | _prev_scalar;
+        _prev_scalar = scalar >> 63;
+        const uint64_t scalar_start = scalar & ~follows_scalar;
+
+        flatten(base, (m.op | quote | scalar_start) & ~string_tail);
+    }
+
+    bool finish() {
+        _index.resize(_count);
+        return _prev_in_string == 0;
+    }
+
+private:
+    // The bytes escaped by a backslash, without a loop over the
+    // backslashes (simdjson's odd-length sequence trick): a run of
+    // backslashes escapes the byte after it when its length is odd, an
+    // add carries each run starting on an odd bit to its end.
+    KARL_ALWAYS_INLINE uint64_t find_escaped(uint64_t backslash) {
+        if (!backslash) {
+            const uint64_t escaped = _prev_escaped;
+            _prev_escaped = 0;
+            return escaped;
+        }
+        const uint64_t even_bits = 0x5555555555555555ULL;
+        backslash &= ~_prev_escaped;
+        const uint64_t follows_escape = (backslash << 1) | _prev_escaped;
+        const uint64_t odd_starts = backslash & ~even_bits & ~follows_escape;
+        const uint64_t even_starts = odd_starts + backslash;
+        // the carry out of bit 63: the run reaches into the next block
+        _prev_escaped = even_starts < backslash ? 1 : 0;
+        const uint64_t invert = even_starts << 1;
+        return (even_bits ^ invert) & follows_escape;
+    }
+
+    // Write the positions of the set bits. The vector always has room
+    // for a whole block, so the loops write 8 entries per round without
+    // checking and fix up the count afterwards; most blocks have no more
+    // than 8 or 16 structurals.
+    KARL_ALWAYS_INLINE void flatten(uint32_t base, uint64_t bits) {
+        if (!bits) {
+            return;
+        }
+        if (_index.size() < _count + 64) {
+            grow(base);
+        }
+        uint32_t* out = _index.data() + _count;
+        const size_t count = popcount(bits);
+        // bit 63 keeps trailing_zeroes defined once the bits run out
+        const uint64_t stop = uint64_t(1) << 63;
+        for (size_t i = 0; i < 8; i++) {
+            out[i] = base + trailing_zeroes(bits | stop);
+            bits &= bits - 1;
+        }
+        if (count > 8) {
+            for (size_t i = 8; i < 16; i++) {
+                out[i] = base + trailing_zeroes(bits | stop);
+                bits &= bits - 1;
+            }
+            for (size_t i = 16; i < count; i++) {
+                out[i] = base + trailing_zeroes(bits);
+                bits &= bits - 1;
+            }
+        }
+        _count += count;
+    }
+
+    // the density seen so far tells how many entries the rest of the
+    // text needs, growing by that avoids doubling (and zero filling)
+    // far past the end
+    void grow(uint32_t base) {
+        size_t estimate = base ? static_cast<size_t>(static_cast<double>(_count) * _len / base * 1.1) : 0;
+        _index.resize(std::max(estimate, _count) + 1024);
+    }
+
+    std::vector<uint32_t>& _index;
+    const size_t _len;
+    size_t _count;
+    uint64_t _prev_escaped;
+    uint64_t _prev_in_string;
+    uint64_t _prev_scalar;
+};
+// The whole of stage 1 with one classify kernel. It is inlined into a
+// function per kernel, so the mask arithmetic of the avx2 one is built
+// for the bmi and popcnt instructions as well.
+KARL_ALWAYS_INLINE inline bool
+build_index(const char* ptr, size_t len, std::vector<uint32_t>& index, classify_fn classify) {
+    index.clear();
+    if (len >= std::numeric_limits<uint32_t>::max()) {
+        return false;
+    }
+
+    index.resize(len / 4 + 64);
+    IndexBuilder builder(index, len);
+    block_masks masks[batch_blocks];
+
+    const size_t full_blocks = len / block_size;
+    size_t block = 0;
+    while (block < full_blocks) {
+        size_t count = std::min(batch_blocks, full_blocks - block);
+        classify(ptr + block * block_size, count, masks);
+        for (size_t i = 0; i < count; i++) {
+            builder.add_block(masks[i], static_cast<uint32_t>((block + i) * block_size));
+        }
+        block += count;
+    }
+
+    // the tail is padded with spaces, they never produce a structural
+    const size_t rest = len - full_blocks * block_size;
+    if (rest) {
+        char tail[block_size];
+        memset(tail, ' ', sizeof(tail));
+        memcpy(tail, ptr + full_blocks * block_size, rest);
+        classify(tail, 1, masks);
+        builder.add_block(masks[0], static_cast<uint32_t>(full_blocks * block_size));
+    }
+    return builder.finish();
+}
+
+#ifdef KARL_X86_64
+bool build_index_sse2(const char* ptr, size_t len, std::vector<uint32_t>& index) {
+    return build_index(ptr, len, index, classify_sse2);
+}
+
+KARL_TARGET_AVX2
+bool build_index_avx2(const char* ptr, size_t len, std::vector<uint32_t>& index) {
+    return build_index(ptr, len, index, classify_avx2);
+}
+#else
+bool build_index_scalar(const char* ptr, size_t len, std::vector<uint32_t>& index) {
+    return build_index(ptr, len, index, classify_scalar);
+}
+#endif  // KARL_X86_64
+
+struct Kernel {
+    index_fn build_index;
+    scan_fn scan_unescaped;
+    const char* name;
+};
+
+Kernel select_kernel() {
+#ifdef KARL_X86_64
+    if (cpu_supports_avx2()) {
+        return Kernel{ build_index_avx2, scan_unescaped_avx2, "avx2" };
+    }
+    return Kernel{ build_index_sse2, scan_unescaped_sse2, "sse2" };
+#else
+    return Kernel{ build_index_scalar, scan_unescaped_scalar, "scalar" };
+#endif
+}
+
+const Kernel& current_kernel() {
+    static const Kernel kernel = select_kernel();
+    return kernel;
+}
+
+}  // namespace
+
+bool build_structural_index(const char* ptr, size_t len, std::vector<uint32_t>& index) {
+    return current_kernel().build_index(ptr, len, index);
+}
+
+const char* structural_kernel_name() {
+    return current_kernel().name;
+}
+
+size_t scan_unescaped(const char* ptr, size_t len) {
+    // short strings, mostly keys, are not worth the indirect call
+    if (len < 16) {
+        return scan_unescaped_scalar(ptr, len);
+    }
+    return current_kernel().scan_unescaped(ptr, len);
+}
+}  // namespace text
+}  // namespace karl
@@ -0,0 +1,50 @@
+// Copyright (c) 2019 shadow-yuan. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "LICENSE");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// An easy to use c++ json library
+// Version 1.0.0
+// https://github.com/shadow-yuan/karl
+//
+// Authors: Shadow Yuan (shadow_yuan@qq.com)
+//
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace karl {
+namespace text {
+
+// Stage 1 of the text reader:
+// record the offset of every structural character ({ } [ ] : ,),
+// every opening quote and the first byte of every scalar (number,
+// true, false, null) that is outside of a string. The input is
+// classified 64 bytes at a time with SSE2 or AVX2 when the cpu
+// supports it, otherwise with a portable scalar loop.
+//
+// Returns false if the input ends inside a string or is larger
+// than 4GB (offsets are stored as uint32_t).
+bool build_structural_index(const char* ptr, size_t len, std::vector<uint32_t>& index);
+
+// name of the kernel picked at runtime: "avx2", "sse2" or "scalar"
+const char* structural_kernel_name();
+
+// Length of the prefix of [ptr, ptr + len) that a json string holds as
+// it is: up to the first '"', '\\' or byte below 0x20. Scans 32 or 16
+// bytes at a time with the kernel of build_structural_index.
+size_t scan_unescaped(const char* ptr, size_t len);
+
+}  // namespace text
+}  // namespace karl
@@ -0,0 +1,339 @@
+// Copyright (c) 2019 shadow-yuan. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "LICENSE");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// An easy to use c++ json library
+// Version 1.0.0
+// https://github.com/shadow-yuan/karl
+//
+// Authors: Shadow Yuan (shadow_yuan@qq.com)
+//
+
+#include "tape.h"
+#include <string.h>
+#include <algorithm>
+
+namespace karl {
+namespace tape {
+
+// ---------------------------  Document members  ---------------------------------
+
+value_type Document::type(size_t p) const {
+    switch (values[p].type) {
+    case tag::kNull:
+        return value_type::kNull;
+    case tag::kFalse:
+    case tag::kTrue:
+        return value_type::kBoolean;
+    case tag::kInt64:
+    case tag::kUint64:
+    case tag::kDouble:
+        return value_type::kNumber;
+    case tag::kShortString:
+    case tag::kString:
+        return value_type::kString;
+    case tag::kArray:
+        return value_type::kArray;
+    default:
+        return value_type::kObject;
+    }
+}
+
+size_t Document::next(size_t p) const {
+    const Value& v = values[p];
+    if (v.type == tag::kArray || v.type == tag::kObject) {
+        return v.container.next;
+    }
+    return p + 1;
+}
+
+const char* Document::string_data(size_t p) const {
+    const Value& v = values[p];
+    if (v.type == tag::kShortString) {
+        return v.short_data();
+    }
+    return strings.data() + v.offset;
+}
+
+size_t Document::string_size(size_t p) const {
+    const Value& v = values[p];
+    if (v.type == tag::kShortString) {
+        return v.short_size;
+    }
+    return v.size;
+}
+
+json_number Document::number(size_t p) const {
+    const Value& v = values[p];
+    switch (v.type) {
+    case tag::kInt64:
+        return json_number(v.i64);
+    case tag::kUint64:
+        return json_number(v.u64);
+    default:
+        return json_number(v.d);
+    }
+}
+
+bool Document::boolean(size_t p) const {
+    return values[p].type == tag::kTrue;
+}
+
+size_t Document::size(size_t p) const {
+    const Value& v = values[p];
+    if (v.type == tag::kArray || v.type == tag::kObject) {
+        return v.size;
+    }
+    return 0;
+}
+
+bool Document::empty(size_t p) const {
+    switch (values[p].type) {
+    case tag::kShortString:
+    case tag::kString:
+        return string_size(p) == 0;
+    case tag::kArray:
+    case tag::kObject:
+        return values[p].size == 0;
+    default:
+        return false;
+    }
+}
+
+size_t Document::first_child(size_t p) const {
+    return values[p].type == tag::kObject ? p + 2 : p + 1;
+}
+
+size_t Document::element(size_t p, size_t index) const {
+    const Value& v = values[p];
+    if (index >= v.size) {
+        return npos;
+    }
+    if (v.container.table == no_table) {
+        return p + 1 + index;
+    }
+    return elements[v.container.table + index];
+}
+
+size_t Document::member(size_t p, const char* key, size_t len) const {
+    size_t found = npos;
+    size_t end = values[p].container.next;
+    for (size_t q = p + 1; q < end; q = next(q + 1)) {
+        if (string_size(q) == len && memcmp(string_data(q), key, len) == 0) {
+            found = q + 1;
+        }
+    }
+    return found;
+}
+
+bool Document::unique_keys(size_t p) const {
+    const size_t end = values[p].container.next;
+    if (values[p].size <= 16) {
+        for (size_t q = p + 1; q < end; q = next(q + 1)) {
+            for (size_t r = next(q + 1); r < end; r = next(r + 1)) {
+                if (string_size(q) == string_size(r) &&
+                    memcmp(string_data(q), string_data(r), string_size(q)) == 0) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+    std::vector<std::string> keys;
+    keys.reserve(values[p].size);
+    for (size_t q = p + 1; q < end; q = next(q + 1)) {
+        keys.emplace_back(string_data(q), string_size(q));
+    }
+    std::sort(keys.begin(), keys.end());
+    return std::adjacent_find(keys.begin(), keys.end()) == keys.end();
+}
+
+ref_ptr<json_value> Document::to_json_value(size_t p) const {
+    const Value& v = values[p];
+    switch (v.type) {
+    case tag::kNull:
+        return New<json_null>();
+    case tag::kFalse:
+        return New<json_boolean>(false);
+    case tag::kTrue:
+        return New<json_boolean>(true);
+    case tag::kInt64:
+        return New<json_number>(v.i64);
+    case tag::kUint64:
+        return New<json_number>(v.u64);
+    case tag::kDouble:
+        return New<json_number>(v.d);
+    case tag::kShortString:
+    case tag::kString:
+        return New<json_string>(string_data(p), string_size(p));
+    case tag::kArray:
+    {
+        auto arr = New<json_array>();
+        for (size_t q = p + 1; q < v.container.next; q = next(q)) {
+            arr->append(to_json_value(q));
+        }
+        return arr;
+    }
+    default:
+    {
+        auto obj = New<json_object>();
+        for (size_t q = p + 1; q < v.container.next; q = next(q + 1)) {
+            obj->set_value(std::string(string_data(q), string_size(q)), to_json_value(q + 1));
+        }
+        return obj;
+    }
+    }
+}
+
+size_t Document::memory_usage() const {
+    return sizeof(Document)
+        + values.capacity() * sizeof(Value)
+        + strings.capacity()
+        + elements.capacity() * sizeof(uint32_t);
+}
+
+// ---------------------------  Builder members  ---------------------------------
+
+Builder::Builder(Document* doc) : _doc(doc) {}
+
+bool Builder::on_null() {
+    return add_value(tag::kNull) != nullptr;
+}
+
+bool Builder::on_bool(bool value) {
+    return add_value(value ? tag::kTrue : tag::kFalse) != nullptr;
+}
+
+bool Builder::on_int64(int64_t value) {
+    Value* v = add_value(tag::kInt64);
+    if (!v) {
+        return false;
+    }
+    v->i64 = value;
+    return true;
+}
+
+bool Builder::on_uint64(uint64_t value) {
+    Value* v = add_value(tag::kUint64);
+    if (!v) {
+        return false;
+    }
+    v->u64 = value;
+    return true;
+}
+
+bool Builder::on_double(double value) {
+    Value* v = add_value(tag::kDouble);
+    if (!v) {
+        return false;
+    }
+    v->d = value;
+    return true;
+}
+
+bool Builder::on_string(const char* ptr, size_t len) {
+    return add_string(add_value(tag::kString), ptr, len);
+}
+
+bool Builder::on_key(const char* ptr, size_t len) {
+    // a key is not a child, the member is counted with its value
+    return add_string(append(tag::kString), ptr, len);
+}
+
+bool Builder::on_start_object() {
+    size_t p = _doc->values.size();
+    if (!add_value(tag::kObject)) {
+        return false;
+    }
+    _open.push_back(static_cast<uint32_t>(p));
+    return true;
+}
+
+bool Builder::on_end_object() {
+    Value& obj = _doc->values[_open.back()];
+    obj.container.next = static_cast<uint32_t>(_doc->values.size());
+    _open.pop_back();
+    return true;
+}
+
+bool Builder::on_start_array() {
+    size_t p = _doc->values.size();
+    Value* v = add_value(tag::kArray);
+    if (!v) {
+        return false;
+    }
+    v->container.table = no_table;
+    _open.push_back(static_cast<uint32_t>(p));
+    return true;
+}
+
+bool Builder::on_end_array() {
+    size_t p = _open.back();
+    _open.pop_back();
+    Value& arr = _doc->values[p];
+    size_t end = _doc->values.size();
+    arr.container.next = static_cast<uint32_t>(end);
+
+    // the element starts of this array are on top of the pending stack,
+    // they are only kept when some element takes more than one value
+    size_t count = arr.size;
+    if (end - p - 1 != count) {
+        arr.container.table = static_cast<uint32_t>(_doc->elements.size());
+        _doc->elements.insert(_doc->elements.end(), _pending.end() - count, _pending.end());
+    }
+    _pending.resize(_pending.size() - count);
+    return true;
+}
+
+Value* Builder::append(tag type) {
+    std::vector<Value>& values = _doc->values;
+    if (values.size() >= no_table) {
+        return nullptr;
+    }
+    values.push_back(Value());
+    values.back().type = type;
+    return &values.back();
+}
+
+Value* Builder::add_value(tag type) {
+    if (!_open.empty()) {
+        Value& parent = _doc->values[_open.back()];
+        if (parent.type == tag::kArray) {
+            _pending.push_back(static_cast<uint32_t>(_doc->values.size()));
+        }
+        parent.size++;
+    }
+    return append(type);
+}
+
+bool Builder::add_string(Value* v, const char* ptr, size_t len) {
+    if (!v) {
+        return false;
+    }
+    if (len <= max_short_string) {
+        v->type = tag::kShortString;
+        v->short_size = static_cast<uint8_t>(len);
+        memcpy(v->short_data(), ptr, len);
+        return true;
+    }
+    if (len > static_cast<uint32_t>(-1)) {
+        return false;
+    }
+    v->size = static_cast<uint32_t>(len);
+    v->offset = _doc->strings.size();
+    _doc->strings.append(ptr, len);
+    return true;
+}
+
+}  // namespace tape
+}  // namespace karl
@@ -0,0 +1,171 @@
+// Copyright (c) 2019 shadow-yuan. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "LICENSE");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// An easy to use c++ json library
+// Version 1.0.0
+// https://github.com/shadow-yuan/karl
+//
+// Authors: Shadow Yuan (shadow_yuan@qq.com)
+//
+
+#pragma once
+#include "karl.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Compact storage of a whole document (json::parse_compact).
+//
+// Every value is one 16 byte Value in a single vector, in document order.
+// Scalars are stored inline, strings of up to 14 bytes too. A container
+// is followed by its children and records where it ends, so a subtree is
+// skipped in one step; object members are a key followed by its value.
+// Longer strings live in one shared buffer, and arrays holding nested
+// containers get a table with the position of every element.
+
+namespace karl {
+namespace tape {
+
+enum class tag : uint8_t {
+    kNull,
+    kFalse,
+    kTrue,
+    kInt64,
+    kUint64,
+    kDouble,
+    kShortString,   // the bytes are inside the value
+    kString,        // the bytes are in Document::strings
+    kArray,
+    kObject,
+};
+
+// position of a value that does not exist (missing member or element)
+const size_t npos = static_cast<size_t>(-1);
+
+// longest string stored inline
+const size_t max_short_string = 14;
+
+struct Value {
+    tag type;
+    uint8_t short_size;
+    uint16_t reserved;
+    uint32_t size;          // elements, members or long string bytes
+    union {
+        int64_t i64;
+        uint64_t u64;
+        double d;
+        uint64_t offset;    // kString: position in Document::strings
+        struct {
+            uint32_t next;  // position after the last child
+            uint32_t table; // kArray: first entry in Document::elements
+        } container;
+    };
+
+    // kShortString: the bytes overlay everything after 'short_size'
+    const char* short_data() const {
+        return reinterpret_cast<const char*>(this) + 2;
+    }
+    char* short_data() {
+        return reinterpret_cast<char*>(this) + 2;
+    }
+};
+
+static_assert(sizeof(Value) == 16, "tape::Value must stay 16 bytes");
+
+// no element table: every element of the array is a single Value
+const uint32_t no_table = static_cast<uint32_t>(-1);
+
+class Document final : public ref_counted {
+public:
+    Document() = default;
+    ~Document() = default;
+
+    value_type type(size_t p) const;
+
+    // position of the value following the one at 'p'
+    size_t next(size_t p) const;
+
+    // string or key at 'p'
+    const char* string_data(size_t p) const;
+    size_t string_size(size_t p) const;
+
+    json_number number(size_t p) const;
+    bool boolean(size_t p) const;
+
+    // number of elements or members, 0 for scalars
+    size_t size(size_t p) const;
+
+    // same meaning as json_value::empty()
+    bool empty(size_t p) const;
+
+    // position of the first element or the first member's value,
+    // 'p' must be a non-empty container
+    size_t first_child(size_t p) const;
+
+    // position of the element or the member's value, npos if missing.
+    // Objects are searched linearly, a repeated key finds the last one.
+    size_t element(size_t p, size_t index) const;
+    size_t member(size_t p, const char* key, size_t len) const;
+
+    // false if a key of the object at 'p' appears twice. Its tree keeps
+    // one member with the last value, the serializers write that tree.
+    bool unique_keys(size_t p) const;
+
+    // build the json_value tree of the value at 'p'
+    ref_ptr<json_value> to_json_value(size_t p) const;
+
+    // bytes held by the document
+    size_t memory_usage() const;
+
+    std::vector<Value> values;
+    std::string strings;
+    std::vector<uint32_t> elements;
+};
+
+// Handler for text::Reader that appends the events to a Document,
+// it has the same interface as sax_handler (see karl/json.hxx).
+class Builder final {
+public:
+    explicit Builder(Document* doc);
+    ~Builder() = default;
+
+    bool on_null();
+    bool on_bool(bool value);
+    bool on_int64(int64_t value);
+    bool on_uint64(uint64_t value);
+    bool on_double(double value);
+    bool on_string(const char* ptr, size_t len);
+    bool on_key(const char* ptr, size_t len);
+    bool on_start_object();
+    bool on_end_object();
+    bool on_start_array();
+    bool on_end_array();
+
+private:
+    // append a value, nullptr once positions no longer fit in 32 bits
+    Value* append(tag type);
+    // append a child of the innermost open container
+    Value* add_value(tag type);
+    bool add_string(Value* v, const char* ptr, size_t len);
+
+    Document* _doc;
+    // positions of the open containers
+    std::vector<uint32_t> _open;
+    // start of every element of the open arrays, innermost last
+    std::vector<uint32_t> _pending;
+};
+
+}  // namespace tape
+}  // namespace karl
@@ -0,0 +1,2121 @@
+// Copyright (c) 2019 shadow-yuan. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "LICENSE");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// An easy to use c++ json library
+// Version 1.0.0
+// https://github.com/shadow-yuan/karl
+//
+// Authors: Shadow Yuan (shadow_yuan@qq.com)
+//
+
+#include "text.h"
+#include "number.h"
+#include "parallel.h"
+#include "structural.h"
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <unordered_map>
+#include <utility>
+
+namespace karl {
+namespace text {
+namespace {
+inline bool is_whitespace(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+// a scalar must be followed by one of these (or the end of the input)
+inline bool is_delimiter(char c) {
+    switch (c) {
+    case ' ': case '\t': case '\n': case '\r':
+    case '{': case '}': case '[': case ']': case ':': case ',': case '"':
+        return true;
+    default:
+        return false;
+    }
+}
+
+// append the code point to 's' as utf-8
+void append_utf8(uint32_t code, std::string& s) {
+    if (code < 0x80) {
+        s.push_back(static_cast<char>(code));
+    } else if (code < 0x800) {
+        s.push_back(static_cast<char>(0xC0 | (code >> 6)));
+        s.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+    } else if (code < 0x10000) {
+        s.push_back(static_cast<char>(0xE0 | (code >> 12)));
+        s.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+        s.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+    } else {
+        s.push_back(static_cast<char>(0xF0 | (code >> 18)));
+        s.push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3F)));
+        s.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+        s.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+    }
+}
+}  // namespace
+
+// -------------------------------------------------------------
+
+DomBuilder::DomBuilder() : _borrow_begin(nullptr), _borrow_end(nullptr), _pool(nullptr) {}
+
+void DomBuilder::borrow_from(const char* begin, const char* end) {
+    _borrow_begin = begin;
+    _borrow_end = end;
+}
+
+void DomBuilder::use_arena(ref_ptr<memory::Arena> arena) {
+    _arena = std::move(arena);
+}
+
+void DomBuilder::use_pool(string_pool* pool) {
+    _pool = pool;
+}
+
+template <typename T, typename... Args>
+ref_ptr<T> DomBuilder::make(Args&&... args) {
+    if (_arena) {
+        return memory::ArenaNew<T>(_arena.get(), std::forward<Args>(args)...);
+    }
+    return New<T>(std::forward<Args>(args)...);
+}
+
+template <typename T>
+bool DomBuilder::add_number(T value) {
+    if (!_stack.empty() && !_stack.back().object && _stack.back().array->append_packed(value)) {
+        return true;
+    }
+    return add_value(make<json_number>(value));
+}
+
+bool DomBuilder::on_null() {
+    return add_value(make<json_null>());
+}
+
+bool DomBuilder::on_bool(bool value) {
+    return add_value(make<json_boolean>(value));
+}
+
+bool DomBuilder::on_int64(int64_t value) {
+    return add_number(value);
+}
+
+bool DomBuilder::on_uint64(uint64_t value) {
+    return add_number(value);
+}
+
+bool DomBuilder::on_double(double value) {
+    return add_number(value);
+}
+
+
+bool DomBuilder::on_string(const char* ptr, size_t len) {
+    if (len > json_string::max_size) {
+        return false;
+    }
+    if (_pool) {
+        ref_ptr<json_string> shared = _pool->value(ptr, len);
+        if (shared) {
+            return add_value(std::move(shared));
+        }
+    }
+    if (ptr >= _borrow_begin && ptr < _borrow_end) {
+        return add_value(make<json_string>(ptr, len, borrowed_t()));
+    }
+    if (_arena && len > json_string::max_inline) {
+        // the bytes live in the arena like a borrowed string in its input
+        return add_value(make<json_string>(_arena->copy_string(ptr, len), len, borrowed_t()));
+    }
+    return add_value(make<json_string>(ptr, len));
+}
+
+bool DomBuilder::on_key(const char* ptr, size_t len) {
+    ref_ptr<shared_string> shared;
+    if (_pool) {
+        shared = _pool->key(ptr, len);
+    }
+    if (shared) {
+        _keys.emplace_back(std::move(shared));
+    } else {
+        _keys.emplace_back(ptr, len);
+    }
+    // filled by add_value, members of nested objects go after it
+    _values.emplace_back();
+    return true;
+}
+
+bool DomBuilder::on_start_object() {
+    _stack.push_back(Frame());
+    _stack.back().object = true;
+    _stack.back().mark = _keys.size();
+    return true;
+}
+
+bool DomBuilder::on_end_object() {
+    size_t mark = _stack.back().mark;
+    size_t count = _keys.size() - mark;
+    _stack.pop_back();
+    auto obj = make<json_object>(json_object::object::allocator_type(_arena.get()));
+    ref_ptr<object_shape> shape;
+    if (count > 0) {
+        shape = _shapes.find_or_add(&_keys[mark], count);
+    }
+    if (shape) {
+        obj->adopt(std::move(shape), &_values[mark]);
+    } else {
+        // a key appears twice, the last value wins
+        for (size_t i = mark; i < _keys.size(); i++) {
+            obj->set_value(std::move(_keys[i]), std::move(_values[i]));
+        }
+    }
+    _keys.erase(_keys.begin() + mark, _keys.end());
+    _values.erase(_values.begin() + mark, _values.end());
+    return add_value(std::move(obj));
+}
+
+bool DomBuilder::on_start_array() {
+    _stack.push_back(Frame());
+    _stack.back().array = make<json_array>(sequence::allocator_type(_arena.get()));
+    return true;
+}
+
+bool DomBuilder::on_end_array() {
+    ref_ptr<json_value> obj = std::move(_stack.back().array);
+    _stack.pop_back();
+    return add_value(std::move(obj));
+}
+
+bool DomBuilder::add_value(ref_ptr<json_value> obj) {
+    if (_stack.empty()) {
+        _root = std::move(obj);
+        return true;
+    }
+    Frame& top = _stack.back();
+    if (top.object) {
+        _values.back() = std::move(obj);
+    } else {
+        top.array->append(std::move(obj));
+    }
+    return true;
+}
+
+bool DomBuilder::done() const {
+    return _stack.empty() && _root;
+}
+
+size_t DomBuilder::depth() const {
+    return _stack.size();
+}
+
+bool DomBuilder::in_object() const {
+    return !_stack.empty() && _stack.back().object;
+}
+
+ref_ptr<json_value> DomBuilder::root() const {
+    return _stack.empty() ? _root : nullptr;
+}
+
+void DomBuilder::reset() {
+    _stack.clear();
+    _keys.clear();
+    _values.clear();
+    _shapes.clear();
+    _root.reset();
+}
+
+// -------------------------------------------------------------
+
+Reader::Reader(const char* ptr, size_t size)
+    : _buff(ptr), _size(size), _position(0), _flags(0)
+    , _index(nullptr), _index_size(0), _next(0) {}
+
+Reader::Reader(const char* ptr, size_t size, const std::vector<uint32_t>& index)
+    : _buff(ptr), _size(size), _position(0), _flags(0)
+    , _index(index.data()), _index_size(index.size()), _next(0) {}
+
+void Reader::set_flags(uint32_t flags) {
+    _flags = flags;
+}
+
+template <typename Handler>
+bool Reader::parse(Handler& handler) {
+    skip_whitespace();
+    return parse_value(handler, 0);
+}
+
+bool Reader::read_value(ref_ptr<json_value>& obj) {
+    DomBuilder builder;
+    return read_value(builder, obj);
+}
+
+bool Reader::read_value(DomBuilder& builder, ref_ptr<json_value>& obj) {
+    if (_flags & kBorrowStrings) {
+        builder.borrow_from(_buff, _buff + _size);
+    }
+    if (!parse(builder)) {
+        return false;
+    }
+    obj = builder.root();
+    return true;
+}
+
+size_t Reader::current_position() const {
+    return _position;
+}
+
+void Reader::seek(size_t next) {
+    _next = next;
+}
+
+void Reader::skip_whitespace() {
+    if (_index) {
+        _position = (_next < _index_size) ? _index[_next++] : _size;
+        return;
+    }
+    while (_position < _size && is_whitespace(_buff[_position])) {
+        _position++;
+    }
+}
+
+template <typename Handler>
+bool Reader::parse_value(Handler& handler, int depth) {
+    if (_position >= _size) {
+        return false;
+    }
+
+    switch (_buff[_position]) {
+    case '{':
+        return parse_object(handler, depth + 1);
+    case '[':
+        return parse_array(handler, depth + 1);
+    case '"':
+    {
+        const char* ptr = nullptr;
+        size_t len = 0;
+        return read_string(&ptr, &len) && handler.on_string(ptr, len);
+    }
+    case 't':
+        if (!read_literal("true", 4) || !check_scalar_end()) {
+            return false;
+        }
+        return handler.on_bool(true);
+    case 'f':
+        if (!read_literal("false", 5) || !check_scalar_end()) {
+            return false;
+        }
+        return handler.on_bool(false);
+    case 'n':
+        if (!read_literal("null", 4) || !check_scalar_end()) {
+            return false;
+        }
+        return handler.on_null();
+    default:
+        return parse_number(handler);
+    }
+}
+
+template <typename Handler>
+bool Reader::parse_array(Handler& handler, int depth) {
+    if (depth > max_nesting_depth) {
+        return false;
+    }
+    _position++;  // '['
+    if (!handler.on_start_array()) {
+        return false;
+    }
+    skip_whitespace();
+    if (_position < _size && _buff[_position] == ']') {
+        _position++;
+        return handler.on_end_array();
+    }
+
+    while (true) {
+        if (!parse_value(handler, depth)) {
+            return false;
+        }
+
+        skip_whitespace();
+        if (_position >= _size) {
+            return false;
+        }
+        char c = _buff[_position++];
+        if (c == ']') {
+            break;
+        }
+        if (c != ',') {
+            return false;
+        }
+        skip_whitespace();
+    }
+    return handler.on_end_array();
+}
+
+template <typename Handler>
+bool Reader::parse_object(Handler& handler, int depth) {
+    if (depth > max_nesting_depth) {
+        return false;
+    }
+    _position++;  // '{'
+    if (!handler.on_start_object()) {
+        return false;
+    }
+    skip_whitespace();
+    if (_position < _size && _buff[_position] == '}') {
+        _position++;
+        return handler.on_end_object();
+    }
+
+    while (true) {
+        const char* key = nullptr;
+        size_t key_len = 0;
+        if (_position >= _size || _buff[_position] != '"' || !read_string(&key, &key_len)) {
+            return false;
+        }
+        if (!handler.on_key(key, key_len)) {
+            return false;
+        }
+        skip_whitespace();
+        if (_position >= _size || _buff[_position] != ':') {
+            return false;
+        }
+        _position++;
+        skip_whitespace();
+
+        if (!parse_value(handler, depth)) {
+            return false;
+        }
+
+        skip_whitespace();
+        if (_position >= _size) {
+            return false;
+        }
+        char c = _buff[_position++];
+        if (c == '}') {
+            break;
+        }
+        if (c != ',') {
+            return false;
+        }
+        skip_whitespace();
+    }
+    return handler.on_end_object();
+}
+
+bool Reader::read_string(std::string& s) {
+    const char* ptr = nullptr;
+    size_t len = 0;
+    if (!read_string(&ptr, &len)) {
+        return false;
+    }
+    s.assign(ptr, len);
+    return true;
+}
+
+bool Reader::read_string(const char** ptr, size_t* len) {
+    _position++;  // '"'
+
+    // fast path: no escape sequence, hand out the input itself
+    size_t start = _position;
+    while (_position < _size) {
+        char c = _buff[_position];
+        if (c == '"') {
+            *ptr = _buff + start;
+            *len = _position - start;
+            _position++;
+            return true;
+        }
+        if (c == '\\') {
+            break;
+        }
+        _position++;
+    }
+    if (_position >= _size) {
+        return false;
+    }
+
+    std::string& s = _scratch;
+    s.assign(_buff + start, _position - start);
+    while (_position < _size) {
+        char c = _buff[_position++];
+        if (c == '"') {
+            *ptr = s.data();
+            *len = s.size();
+            return true;
+        }
+        if (c != '\\') {
+            s.push_back(c);
+            continue;
+        }
+        if (_position >= _size) {
+            return false;
+        }
+        c = _buff[_position++];
+        switch (c) {
+        case '"':  s.push_back('"');  break;
+        case '\\': s.push_back('\\'); break;
+        case '/':  s.push_back('/');  break;
+        case 'b':  s.push_back('\b'); break;
+        case 'f':  s.push_back('\f'); break;
+        case 'n':  s.push_back('\n'); break;
+        case 'r':  s.push_back('\r'); break;
+        case 't':  s.push_back('\t'); break;
+        case 'u':
+        {
+            uint32_t code = 0;
+            if (!read_hex4(code)) {
+                return false;
+            }
+            if (code >= 0xDC00 && code <= 0xDFFF) {
+                return false;  // unpaired low surrogate
+            }
+            if (code >= 0xD800 && code <= 0xDBFF) {
+                uint32_t low = 0;
+                if (_position + 2 > _size ||
+                    _buff[_position] != '\\' || _buff[_position + 1] != 'u') {
+                    return false;
+                }
+                _position += 2;
+                if (!read_hex4(low) || low < 0xDC00 || low > 0xDFFF) {
+                    return false;
+                }
+                code = 0x10000 + (((code & 0x3FF) << 10) | (low & 0x3FF));
+            }
+            append_utf8(code, s);
+        }
+            break;
+        default:
+            return false;
+        }
+    }
+    return false;
+}
+
+bool Reader::read_hex4(uint32_t& code) {
+    if (_position + 4 > _size) {
+        return false;
+    }
+    code = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = _buff[_position++];
+        code <<= 4;
+        if (c >= '0' && c <= '9') {
+            code |= static_cast<uint32_t>(c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            code |= static_cast<uint32_t>(c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            code |= static_cast<uint32_t>(c - 'A' + 10);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename Handler>
+bool Reader::parse_number(Handler& handler) {
+    size_t consumed = 0;
+    json_number number;
+    if (!numeric::parse_number(_buff + _position, _size - _position, &consumed, number)) {
+        return false;
+    }
+    _position += consumed;
+    if (!check_scalar_end()) {
+        return false;
+    }
+    if (number.is_float()) {
+        return handler.on_double(static_cast<double>(number));
+    }
+    if (number.is_signed()) {
+        return handler.on_int64(static_cast<int64_t>(number));
+    }
+    return handler.on_uint64(static_cast<uint64_t>(number));
+}
+
+bool Reader::check_scalar_end() const {
+    // A scalar must be followed by whitespace, an operator or a quote,
+    // otherwise input like "truex" or "1.5.2" would slip through (stage 1
+    // only indexes the first byte of a scalar).
+    return _position >= _size || is_delimiter(_buff[_position]);
+}
+
+bool Reader::read_literal(const char* literal, size_t len) {
+    if (_position + len > _size || memcmp(_buff + _position, literal, len) != 0) {
+        return false;
+    }
+    _position += len;
+    return true;
+}
+
+// -------------------------------------------------------------
+
+PushReader::PushReader() {
+    reset();
+}
+
+void PushReader::reset() {
+    _state = state::kValue;
+    _builder.reset();
+    _token.clear();
+    _in_token = false;
+    _token_is_string = false;
+    _token_is_key = false;
+    _escaped = false;
+}
+
+bool PushReader::done() const {
+    return _state == state::kDone;
+}
+
+bool PushReader::fail() {
+    _state = state::kError;
+    _builder.reset();
+    _token.clear();
+    return false;
+}
+
+bool PushReader::feed(const char* ptr, size_t len) {
+    if (_state == state::kError) {
+        return false;
+    }
+    size_t pos = 0;
+
+    // finish the token left over by the previous chunk
+    if (_in_token) {
+        size_t end = 0;
+        bool complete = scan_token(ptr, len, &end);
+        _token.append(ptr, end);
+        if (!complete) {
+            return true;
+        }
+        _in_token = false;
+        if (!complete_token(_token.data(), _token.size())) {
+            return fail();
+        }
+        _token.clear();
+        pos = end;
+    }
+
+    while (pos < len && _state != state::kDone) {
+        char c = ptr[pos];
+        if (is_whitespace(c)) {
+            pos++;
+            continue;
+        }
+
+        switch (_state) {
+        case state::kColon:
+            if (c != ':') {
+                return fail();
+            }
+            _state = state::kValue;
+            pos++;
+            continue;
+        case state::kCommaOrEnd:
+            if (c == ',') {
+                _state = _builder.in_object() ? state::kKey : state::kValue;
+                pos++;
+                continue;
+            }
+            if (!end_container(c)) {
+                return fail();
+            }
+            pos++;
+            continue;
+        case state::kArrayFirst:
+        case state::kObjectFirst:
+            if (c == ']' || c == '}') {
+                if (!end_container(c)) {
+                    return fail();
+                }
+                pos++;
+                continue;
+            }
+            break;
+        default:
+            break;
+        }
+
+        // a key or a value starts here
+        bool want_key = (_state == state::kKey || _state == state::kObjectFirst);
+        if (want_key && c != '"') {
+            return fail();
+        }
+        if (c == '{' || c == '[') {
+            if (!begin_container(c == '{')) {
+                return fail();
+            }
+            pos++;
+            continue;
+        }
+        if (c == ']' || c == '}' || c == ':' || c == ',') {
+            return fail();
+        }
+
+        _token_is_string = (c == '"');
+        _token_is_key = want_key;
+        _escaped = false;
+        size_t end = 0;
+        if (!scan_token(ptr + pos + 1, len - pos - 1, &end)) {
+            // runs into the next chunk
+            _in_token = true;
+            _token.assign(ptr + pos, len - pos);
+            return true;
+        }
+        end += pos + 1;
+        if (!complete_token(ptr + pos, end - pos)) {
+            return fail();
+        }
+        pos = end;
+    }
+    return true;
+}
+
+bool PushReader::scan_token(const char* ptr, size_t len, size_t* end) {
+    if (_token_is_string) {
+        for (size_t i = 0; i < len; i++) {
+            if (_escaped) {
+                _escaped = false;
+            } else if (ptr[i] == '\\') {
+                _escaped = true;
+            } else if (ptr[i] == '"') {
+                *end = i + 1;
+                return true;
+            }
+        }
+        *end = len;
+        return false;
+    }
+
+    // numbers and literals run up to the next delimiter
+    for (size_t i = 0; i < len; i++) {
+        if (is_delimiter(ptr[i])) {
+            *end = i;
+            return true;
+        }
+    }
+    *end = len;
+    return false;
+}
+
+bool PushReader::complete_token(const char* ptr, size_t len) {
+    Reader rder(ptr, len);
+    if (_token_is_key) {
+        std::string key;
+        if (!rder.read_string(key) || rder.current_position() != len) {
+            return false;
+        }
+        _builder.on_key(key.data(), key.size());
+        _state = state::kColon;
+        return true;
+    }
+    if (!rder.parse(_builder) || rder.current_position() != len) {
+        return false;
+    }
+    value_added();
+    return true;
+}
+
+bool PushReader::begin_container(bool is_object) {
+    if (_builder.depth() >= static_cast<size_t>(max_nesting_depth)) {
+        return false;
+    }
+    if (is_object) {
+        _builder.on_start_object();
+        _state = state::kObjectFirst;
+    } else {
+        _builder.on_start_array();
+        _state = state::kArrayFirst;
+    }
+    return true;
+}
+
+bool PushReader::end_container(char c) {
+    if (_builder.depth() == 0 || c != (_builder.in_object() ? '}' : ']')) {
+        return false;
+    }
+    if (c == '}') {
+        _builder.on_end_object();
+    } else {
+        _builder.on_end_array();
+    }
+    value_added();
+    return true;
+}
+
+void PushReader::value_added() {
+    _state = _builder.done() ? state::kDone : state::kCommaOrEnd;
+}
+
+ref_ptr<json_value> PushReader::finish() {
+    // a number or literal at the very end has no delimiter after it
+    if (_in_token && !_token_is_string && _state != state::kError) {
+        _in_token = false;
+        if (!complete_token(_token.data(), _token.size())) {
+            fail();
+        }
+        _token.clear();
+    }
+    if (_state != state::kDone) {
+        fail();
+        return nullptr;
+    }
+    return _builder.root();
+}
+
+// -------------------------------------------------------------
+
+namespace {
+template <typename Handler>
+bool parse_events(const char* ptr, size_t len, uint32_t flags,
+                  Handler& handler, size_t* transfer_bytes) {
+    bool ok;
+    std::vector<uint32_t> index;
+    if (!build_structural_index(ptr, len, index)) {
+        // unterminated string or a huge input: fall back to the
+        // plain scanner, it finds the error (or the first value) itself
+        Reader rder(ptr, len);
+        rder.set_flags(flags);
+        ok = rder.parse(handler);
+        if (transfer_bytes) {
+            *transfer_bytes = rder.current_position();
+        }
+        return ok;
+    }
+
+    Reader rder(ptr, len, index);
+    rder.set_flags(flags);
+    ok = rder.parse(handler);
+    if (transfer_bytes) {
+        *transfer_bytes = rder.current_position();
+    }
+    return ok;
+}
+}  // namespace
+
+ref_ptr<json_value>
+parse_into_json_value(const char* ptr, size_t len, size_t* transfer_bytes, uint32_t flags,
+                      string_pool* pool) {
+    DomBuilder builder;
+    builder.use_pool(pool);
+    if (flags & kBorrowStrings) {
+        builder.borrow_from(ptr, ptr + len);
+    }
+    if (flags & kArenaValues) {
+        // the tree takes several times the size of the text
+        builder.use_arena(New<memory::Arena>(len * 4));
+    }
+    if (!parse_events(ptr, len, flags, builder, transfer_bytes)) {
+        return nullptr;
+    }
+    return builder.root();
+}
+
+bool parse_into_handler(const char* ptr, size_t len, sax_handler& handler, size_t* transfer_bytes) {
+    return parse_events(ptr, len, 0, handler, transfer_bytes);
+}
+
+ref_ptr<tape::Document> parse_into_tape(const char* ptr, size_t len) {
+    auto doc = New<tape::Document>();
+    tape::Builder builder(doc.get());
+    if (!parse_events(ptr, len, 0, builder, nullptr)) {
+        return nullptr;
+    }
+    // the document is read-only from now on, drop the growth slack
+    doc->values.shrink_to_fit();
+    doc->strings.shrink_to_fit();
+    doc->elements.shrink_to_fit();
+    return doc;
+}
+
+namespace {
+// for every '[' and '{' of the first value in 'index', store the index
+// position of the matching bracket at the same position in 'close'
+bool match_brackets(const char* text, const std::vector<uint32_t>& index,
+                    std::vector<uint32_t>& close) {
+    close.assign(index.size(), 0);
+    std::vector<uint32_t> stack;
+    for (uint32_t p = 0; p < index.size(); p++) {
+        char c = text[index[p]];
+        if (c == '[' || c == '{') {
+            if (stack.size() >= static_cast<size_t>(max_nesting_depth)) {
+                return false;
+            }
+            stack.push_back(p);
+        } else if (c == ']' || c == '}') {
+            if (stack.empty() || text[index[stack.back()]] != (c == ']' ? '[' : '{')) {
+                return false;
+            }
+            close[stack.back()] = p;
+            stack.pop_back();
+        }
+        if (stack.empty()) {
+            break;
+        }
+    }
+    return stack.empty();
+}
+
+// read the value at index position 'p' and move 'p' past it,
+// containers are not read but become lazy
+bool read_lazy_value(const std::shared_ptr<LazyDocument>& doc, uint32_t& p,
+                     ref_ptr<json_value>& value) {
+    size_t offset = doc->index[p];
+    switch (doc->text[offset]) {
+    case '[':
+    {
+        auto arr = New<json_array>();
+        arr->set_lazy(doc, p);
+        value = arr;
+        p = doc->close[p] + 1;
+        return true;
+    }
+    case '{':
+    {
+        auto obj = New<json_object>();
+        obj->set_lazy(doc, p);
+        value = obj;
+        p = doc->close[p] + 1;
+        return true;
+    }
+    default:
+    {
+        // a scalar takes one index entry: its first byte
+        Reader rder(doc->text.data() + offset, doc->text.size() - offset);
+        p++;
+        return rder.read_value(value);
+    }
+    }
+}
+}  // namespace
+
+ref_ptr<json_value> parse_lazy(const char* ptr, size_t len) {
+    auto doc = New<LazyDocument>();
+    doc->text.assign(ptr, len);
+    if (!build_structural_index(doc->text.data(), len, doc->index) || doc->index.empty()) {
+        return nullptr;
+    }
+
+    if (!match_brackets(doc->text.data(), doc->index, doc->close)) {
+        return nullptr;
+    }
+
+    uint32_t p = 0;
+    ref_ptr<json_value> root;
+    if (!read_lazy_value(doc, p, root)) {
+        return nullptr;
+    }
+    return root;
+}
+
+bool expand_lazy_array(const std::shared_ptr<LazyDocument>& doc, uint32_t at, json_array& arr) {
+    const uint32_t end = doc->close[at];
+    uint32_t p = at + 1;
+    if (p == end) {
+        return true;
+    }
+    while (true) {
+        ref_ptr<json_value> value;
+        if (!read_lazy_value(doc, p, value)) {
+            return false;
+        }
+        arr.append(std::move(value));
+        if (p == end) {
+            return true;
+        }
+        if (p > end || doc->text[doc->index[p]] != ',') {
+            return false;
+        }
+        p++;
+    }
+}
+
+bool expand_lazy_object(const std::shared_ptr<LazyDocument>& doc, uint32_t at, json_object& obj) {
+    const uint32_t end = doc->close[at];
+    const std::string& text = doc->text;
+    uint32_t p = at + 1;
+    if (p == end) {
+        return true;
+    }
+    while (true) {
+        std::string key;
+        size_t offset = doc->index[p];
+        Reader rder(text.data() + offset, text.size() - offset);
+        if (p >= end || text[offset] != '"' || !rder.read_string(key)) {
+            return false;
+        }
+        p++;
+        if (p >= end || text[doc->index[p]] != ':') {
+            return false;
+        }
+        p++;
+
+        ref_ptr<json_value> value;
+        if (!read_lazy_value(doc, p, value)) {
+            return false;
+        }
+        obj.set_value(std::move(key), std::move(value));
+        if (p == end) {
+            return true;
+        }
+        if (p > end || text[doc->index[p]] != ',') {
+            return false;
+        }
+        p++;
+    }
+}
+
+namespace {
+// projection paths as a tree, one level per path segment
+struct PathNode {
+    bool leaf = false;  // the whole value is kept
+    std::unordered_map<std::string, std::unique_ptr<PathNode>> children;
+    std::unique_ptr<PathNode> any;  // "*"
+};
+
+typedef std::vector<const PathNode*> PathNodes;
+
+// "/a~1b/~0c" => { "a/b", "~c" }
+void add_path(PathNode* root, const std::string& path) {
+    PathNode* node = root;
+    size_t pos = 0;
+    while (pos < path.size()) {
+        if (path[pos] != '/') {
+            return;  // not a json pointer, it selects nothing
+        }
+        size_t end = path.find('/', pos + 1);
+        if (end == std::string::npos) {
+            end = path.size();
+        }
+        std::string name;
+        for (size_t i = pos + 1; i < end; i++) {
+            if (path[i] == '~' && i + 1 < end && (path[i + 1] == '0' || path[i + 1] == '1')) {
+                name.push_back(path[i + 1] == '0' ? '~' : '/');
+                i++;
+            } else {
+                name.push_back(path[i]);
+            }
+        }
+        std::unique_ptr<PathNode>& next = (name == "*") ? node->any : node->children[name];
+        if (!next) {
+            next.reset(new PathNode());
+        }
+        node = next.get();
+        pos = end;
+    }
+    node->leaf = true;
+}
+
+// the nodes of the next level that a member name or element index selects
+void match_path(const PathNodes& nodes, const std::string& name, PathNodes& out) {
+    for (const PathNode* node : nodes) {
+        auto it = node->children.find(name);
+        if (it != node->children.end()) {
+            out.push_back(it->second.get());
+        }
+        if (node->any) {
+            out.push_back(node->any.get());
+        }
+    }
+}
+
+// Base of the walkers that move over the structural index, jumping over
+// whole containers with the bracket table instead of reading every token.
+class IndexWalker {
+protected:
+    IndexWalker(const char* ptr, size_t len, const std::vector<uint32_t>& index,
+                const std::vector<uint32_t>& close)
+        : _text(ptr), _size(len), _index(index), _close(close) {}
+
+    // Reads whole values for one thread. The builder is kept from one
+    // value to the next, so sibling records share their object shapes.
+    class ValueReader {
+    public:
+        explicit ValueReader(const IndexWalker& walker)
+            : _reader(walker._text, walker._size, walker._index) {}
+
+        bool read(uint32_t p, ref_ptr<json_value>& out) {
+            _reader.seek(p);
+            return _reader.read_value(_builder, out);
+        }
+
+    private:
+        Reader _reader;
+        DomBuilder _builder;
+    };
+
+    char byte_at(uint32_t p) const {
+        return _text[_index[p]];
+    }
+
+    // move 'p' past the value at 'p'
+    void skip(uint32_t& p) const {
+        char c = byte_at(p);
+        p = (c == '{' || c == '[') ? _close[p] + 1 : p + 1;
+    }
+
+    // read the whole value at 'p' and move 'p' past it
+    bool read_value(uint32_t& p, ValueReader& values, ref_ptr<json_value>& out) const {
+        const uint32_t at = p;
+        skip(p);
+        return values.read(at, out);
+    }
+
+    // read '"key" :' at 'p', stopping at the value
+    bool read_key(uint32_t& p, uint32_t end, std::string& key) const {
+        size_t offset = _index[p];
+        Reader rder(_text + offset, _size - offset);
+        if (_text[offset] != '"' || !rder.read_string(key)) {
+            return false;
+        }
+        return ++p < end && byte_at(p) == ':' && ++p < end;
+    }
+
+    // after a member: ',' and another one, or the closing bracket
+    bool next_member(uint32_t& p, uint32_t end) const {
+        if (p == end) {
+            return true;
+        }
+        return p < end && byte_at(p) == ',' && ++p < end;
+    }
+
+    const char* _text;
+    size_t _size;
+    const std::vector<uint32_t>& _index;
+    const std::vector<uint32_t>& _close;
+};
+
+class ProjectionWalker final : public IndexWalker {
+public:
+    ProjectionWalker(const char* ptr, size_t len, const std::vector<uint32_t>& index,
+                     const std::vector<uint32_t>& close)
+        : IndexWalker(ptr, len, index, close), _values(*this) {}
+
+    // read the value at index position 'p' and move 'p' past it,
+    // 'out' stays empty if nothing of the value is selected
+    bool walk(uint32_t& p, const PathNodes& nodes, ref_ptr<json_value>& out) {
+        for (const PathNode* node : nodes) {
+            if (node->leaf) {
+                return read_value(p, _values, out);
+            }
+        }
+        switch (byte_at(p)) {
+        case '{':
+            return walk_object(p, nodes, out);
+        case '[':
+            return walk_array(p, nodes, out);
+        default:
+            p++;  // a scalar can not hold the rest of the path
+            return true;
+        }
+    }
+
+private:
+    bool walk_object(uint32_t& p, const PathNodes& nodes, ref_ptr<json_value>& out) {
+        const uint32_t end = _close[p];
+        auto obj = New<json_object>();
+        p++;
+        PathNodes next;
+        while (p != end) {
+            std::string key;
+            if (!read_key(p, end, key)) {
+                return false;
+            }
+            next.clear();
+            match_path(nodes, key, next);
+            if (next.empty()) {
+                skip(p);
+            } else {
+                ref_ptr<json_value> value;
+                if (!walk(p, next, value)) {
+                    return false;
+                }
+                if (value) {
+                    obj->set_value(std::move(key), std::move(value));
+                }
+            }
+            if (!next_member(p, end)) {
+                return false;
+            }
+        }
+        p = end + 1;
+        out = obj;
+        return true;
+    }
+
+    bool walk_array(uint32_t& p, const PathNodes& nodes, ref_ptr<json_value>& out) {
+        const uint32_t end = _close[p];
+        auto arr = New<json_array>();
+        p++;
+        PathNodes next;
+        for (size_t i = 0; p != end; i++) {
+            next.clear();
+            match_path(nodes, std::to_string(i), next);
+            if (next.empty()) {
+                skip(p);
+            } else {
+                ref_ptr<json_value> value;
+                if (!walk(p, next, value)) {
+                    return false;
+                }
+                if (value) {
+                    arr->append(std::move(value));
+                }
+            }
+            if (!next_member(p, end)) {
+                return false;
+            }
+        }
+        p = end + 1;
+        out = arr;
+        return true;
+    }
+
+    ValueReader _values;
+};
+
+// arrays smaller than this are not worth splitting
+const size_t kParallelMinBytes = 256 * 1024;
+// element ranges handed to the workers are about this size
+const size_t kParallelRangeBytes = 64 * 1024;
+
+class ParallelWalker final : public IndexWalker {
+public:
+    ParallelWalker(const char* ptr, size_t len, const std::vector<uint32_t>& index,
+                   const std::vector<uint32_t>& close, size_t threads, int split_depth)
+        : IndexWalker(ptr, len, index, close), _values(*this)
+        , _threads(threads), _split_depth(split_depth) {}
+
+    // read the value at 'p' and move 'p' past it, 'depth' is its nesting level
+    bool walk(uint32_t& p, int depth, ref_ptr<json_value>& out) {
+        char c = byte_at(p);
+        if (c == '[' && depth == _split_depth) {
+            return split_array(p, out);
+        }
+        if (depth < _split_depth) {
+            if (c == '{') {
+                return walk_object(p, depth, out);
+            }
+            if (c == '[') {
+                return walk_array(p, depth, out);
+            }
+        }
+        return read_value(p, _values, out);
+    }
+
+private:
+    bool walk_object(uint32_t& p, int depth, ref_ptr<json_value>& out) {
+        const uint32_t end = _close[p];
+        auto obj = New<json_object>();
+        p++;
+        while (p != end) {
+            std::string key;
+            ref_ptr<json_value> value;
+            if (!read_key(p, end, key) || !walk(p, depth + 1, value)) {
+                return false;
+            }
+            obj->set_value(std::move(key), std::move(value));
+            if (!next_member(p, end)) {
+                return false;
+            }
+        }
+        p = end + 1;
+        out = obj;
+        return true;
+    }
+
+    bool walk_array(uint32_t& p, int depth, ref_ptr<json_value>& out) {
+        const uint32_t end = _close[p];
+        auto arr = New<json_array>();
+        p++;
+        while (p != end) {
+            ref_ptr<json_value> value;
+            if (!walk(p, depth + 1, value)) {
+                return false;
+            }
+            arr->append(std::move(value));
+            if (!next_member(p, end)) {
+                return false;
+            }
+        }
+        p = end + 1;
+        out = arr;
+        return true;
+    }
+
+    bool split_array(uint32_t& p, ref_ptr<json_value>& out) {
+        const uint32_t end = _close[p];
+        if (_index[end] - _index[p] < kParallelMinBytes) {
+            return read_value(p, _values, out);
+        }
+
+        // element boundaries come from the bracket table, nothing is read yet
+        std::vector<uint32_t> starts;
+        uint32_t q = p + 1;
+        while (q != end) {
+            starts.push_back(q);
+            skip(q);
+            if (!next_member(q, end)) {
+                return false;
+            }
+        }
+
+        // cut the elements into ranges of about kParallelRangeBytes
+        std::vector<size_t> ranges(1, 0);
+        for (size_t i = 1; i < starts.size(); i++) {
+            if (_index[starts[i]] - _index[starts[ranges.back()]] >= kParallelRangeBytes) {
+                ranges.push_back(i);
+            }
+        }
+        ranges.push_back(starts.size());
+
+        sequence items(starts.size());
+        std::atomic<bool> ok(true);
+        parallel::for_each_index(ranges.size() - 1, _threads, [&](size_t r) {
+            ValueReader values(*this);
+            for (size_t i = ranges[r]; i < ranges[r + 1] && ok; i++) {
+                uint32_t at = starts[i];
+                if (!read_value(at, values, items[i])) {
+                    ok = false;
+                }
+            }
+        });
+        if (!ok) {
+            return false;
+        }
+
+        // stitch the subtrees together in order
+        auto arr = New<json_array>();
+        arr->resize(items.size());
+        for (size_t i = 0; i < items.size(); i++) {
+            (*arr)[i] = std::move(items[i]);
+        }
+        p = end + 1;
+        out = arr;
+        return true;
+    }
+
+    ValueReader _values;
+    size_t _threads;
+    int _split_depth;
+};
+}  // namespace
+
+ref_ptr<json_value>
+parse_projection(const char* ptr, size_t len, const std::vector<std::string>& paths) {
+    std::vector<uint32_t> index;
+    std::vector<uint32_t> close;
+    if (!build_structural_index(ptr, len, index) || index.empty() ||
+        !match_brackets(ptr, index, close)) {
+        return nullptr;
+    }
+
+    if (ptr[index[0]] != '{' && ptr[index[0]] != '[') {
+        // nothing to project, let the caller see the scalar
+        ref_ptr<json_value> obj;
+        Reader rder(ptr, len, index);
+        return rder.read_value(obj) ? obj : nullptr;
+    }
+
+    PathNode root;
+    for (const std::string& path : paths) {
+        add_path(&root, path);
+    }
+    PathNodes nodes(1, &root);
+    ProjectionWalker walker(ptr, len, index, close);
+    uint32_t p = 0;
+    ref_ptr<json_value> obj;
+    if (!walker.walk(p, nodes, obj)) {
+        return nullptr;
+    }
+    return obj;
+}
+
+ref_ptr<json_value>
+parse_parallel(const char* ptr, size_t len, size_t threads, int split_depth) {
+    std::vector<uint32_t> index;
+    std::vector<uint32_t> close;
+    if (!build_structural_index(ptr, len, index)) {
+        // unterminated string or a huge input, one thread finds out
+        return parse_into_json_value(ptr, len, nullptr);
+    }
+    if (index.empty() || !match_brackets(ptr, index, close)) {
+        return nullptr;
+    }
+    ParallelWalker walker(ptr, len, index, close, threads, split_depth);
+    uint32_t p = 0;
+    ref_ptr<json_value> obj;
+    if (!walker.walk(p, 0, obj)) {
+        return nullptr;
+    }
+    return obj;
+}
+
+namespace {
+bool starts_value(char c) {
+    return c == '{' || c == '[' || c == '"' || c == '-' || (c >= '0' && c <= '9') ||
+        c == 't' || c == 'f' || c == 'n';
+}
+
+// A container that goes on after a line break continues with a byte that
+// can follow 'prev' inside it ('open' is the innermost bracket). Anything
+// else starts a new document, the one before is broken (a truncated json
+// lines record).
+bool continues_container(char open, char prev, char next) {
+    switch (prev) {
+    case ',':
+        return open == '{' ? next == '"' : starts_value(next);
+    case ':':
+        return starts_value(next);
+    case '[':
+        return next == ']' || starts_value(next);
+    case '{':
+        return next == '}' || next == '"';
+    default:
+        // after a value
+        return next == ',' || next == '}' || next == ']' || next == ':';
+    }
+}
+}  // namespace
+
+void split_documents(const char* ptr, size_t len, std::vector<size_t>& offsets) {
+    // the open brackets
+    std::vector<char> open;
+    // the first line break at or after the last string read
+    size_t line_end = 0;
+    size_t i = 0;
+    while (i < len) {
+        switch (ptr[i]) {
+        case '\n': {
+            // a container that goes on on the next line, strings have no
+            // line breaks so the last byte before it is not in one
+            size_t last = i;
+            i++;
+            while (i < len && is_whitespace(ptr[i])) {
+                i++;
+            }
+            if (i == len || open.empty()) {
+                break;
+            }
+            while (is_whitespace(ptr[last])) {
+                last--;
+            }
+            if (!continues_container(open.back(), ptr[last], ptr[i])) {
+                open.clear();
+            }
+            break;
+        }
+        case ' ': case '\t': case '\r':
+            i++;
+            break;
+        case '"':
+            if (open.empty()) {
+                offsets.push_back(i);
+            }
+            // jump to the closing quote, skipping the escaped ones
+            while (true) {
+                size_t begin = i + 1;
+                auto quote = static_cast<const char*>(memchr(ptr + begin, '"', len - begin));
+                size_t end = quote ? quote - ptr : len;
+                // json strings have no line breaks: at one the string is
+                // broken and the next document starts on the next line
+                if (line_end < begin) {
+                    auto newline = static_cast<const char*>(memchr(ptr + begin, '\n', len - begin));
+                    line_end = newline ? newline - ptr : len;
+                }
+                if (line_end < end) {
+                    open.clear();
+                    i = line_end;
+                    break;
+                }
+                if (!quote) {
+                    return;
+                }
+                i = end;
+                size_t slashes = 0;
+                while (ptr[i - 1 - slashes] == '\\') {
+                    slashes++;
+                }
+                if ((slashes & 1) == 0) {
+                    i++;
+                    break;
+                }
+            }
+            break;
+        case '{': case '[':
+            if (open.empty()) {
+                offsets.push_back(i);
+            }
+            open.push_back(ptr[i]);
+            i++;
+            break;
+        case '}': case ']':
+            if (open.empty()) {
+                offsets.push_back(i);  // stray, fails on its own
+            } else {
+                open.pop_back();
+            }
+            i++;
+            break;
+        default:
+            if (open.empty()) {
+                // a top level scalar runs up to the next delimiter
+                offsets.push_back(i);
+                i++;
+                while (i < len && !is_delimiter(ptr[i])) {
+                    i++;
+                }
+            } else {
+                i++;
+            }
+            break;
+        }
+    }
+}
+
+ref_ptr<json_value> DocumentReader::read(const char* ptr, size_t len) {
+    if (!build_structural_index(ptr, len, _index)) {
+        return parse_into_json_value(ptr, len, nullptr);
+    }
+    Reader rder(ptr, len, _index);
+    ref_ptr<json_value> obj;
+    if (!rder.read_value(_builder, obj)) {
+        // drop the half built containers, the shapes go with them
+        _builder.reset();
+        return nullptr;
+    }
+    return obj;
+}
+
+// -------------------------------------------------------------
+
+namespace {
+// indentation is copied from here in slices
+const char kSpaces[] = "                                                                ";
+
+const char kHexDigits[] = "0123456789abcdef";
+
+// the escape of a byte found by scan_unescaped, 0 for the \u00XX form
+char short_escape(uint8_t c) {
+    switch (c) {
+    case '"': return '"';
+    case '\\': return '\\';
+    case '\b': return 'b';
+    case '\f': return 'f';
+    case '\n': return 'n';
+    case '\r': return 'r';
+    case '\t': return 't';
+    default: return 0;
+    }
+}
+}  // namespace
+
+Writer::Writer(std::string* out, int indent)
+    : _out(out)
+    , _indent(indent)
+    , _begin(nullptr)
+    , _pos(nullptr)
+    , _end(nullptr)
+    , _stopped(false) {}
+
+Writer::Writer(write_sink sink, int indent)
+    : _out(nullptr)
+    , _indent(indent)
+    , _sink(std::move(sink))
+    , _buffer(new char[write_buffer_size])
+    , _begin(_buffer.get())
+    , _pos(_begin)
+    , _end(_begin + write_buffer_size)
+    , _stopped(false) {}
+
+Writer::Writer(char* buff, size_t capacity, int indent)
+    : _out(nullptr)
+    , _indent(indent)
+    , _begin(buff)
+    , _pos(buff)
+    , _end(buff + capacity)
+    , _stopped(false) {}
+
+bool Writer::write(const json_value* value, int prefix) {
+    start();
+    write_value(value, prefix);
+    return finish();
+}
+
+bool Writer::write(const tape::Document* doc, size_t p, int prefix) {
+    start();
+    write_tape(doc, p, prefix);
+    return finish();
+}
+
+void Writer::start() {
+    if (_out) {
+        // the text is written after what 'out' holds, into its spare
+        // capacity first, the string is cut to the text at the end
+        size_t used = _out->size();
+        _out->resize(std::max(_out->capacity(), used + 64));
+        _begin = &(*_out)[0];
+        _pos = _begin + used;
+        _end = _begin + _out->size();
+    }
+}
+
+bool Writer::finish() {
+    if (_out) {
+        _out->resize(static_cast<size_t>(_pos - _begin));
+    } else if (_sink) {
+        flush();
+    }
+    return !_stopped;
+}
+
+size_t Writer::size() const {
+    return static_cast<size_t>(_pos - _begin);
+}
+
+inline void Writer::put(const char* ptr, size_t len) {
+    if (len <= static_cast<size_t>(_end - _pos)) {
+        memcpy(_pos, ptr, len);
+        _pos += len;
+    } else {
+        overflow(ptr, len);
+    }
+}
+
+inline void Writer::put(char c) {
+    if (_pos != _end) {
+        *_pos++ = c;
+    } else {
+        overflow(&c, 1);
+    }
+}
+
+void Writer::overflow(const char* ptr, size_t len) {
+    for (;;) {
+        size_t room = static_cast<size_t>(_end - _pos);
+        if (len <= room) {
+            memcpy(_pos, ptr, len);
+            _pos += len;
+            return;
+        }
+        if (_out) {
+            size_t used = static_cast<size_t>(_pos - _begin);
+            _out->resize(std::max(_out->size() * 2, used + len));
+            _begin = &(*_out)[0];
+            _pos = _begin + used;
+            _end = _begin + _out->size();
+            continue;
+        }
+        if (!_sink || _stopped) {
+            // the caller's buffer is full or the sink stopped, the rest
+            // of the text is dropped
+            _stopped = true;
+            return;
+        }
+        // a long string goes out in slices of the buffer size
+        memcpy(_pos, ptr, room);
+        _pos += room;
+        ptr += room;
+        len -= room;
+        flush();
+    }
+}
+
+void Writer::flush() {
+    if (!_stopped && _pos != _begin) {
+        _stopped = !_sink(_begin, static_cast<size_t>(_pos - _begin));
+    }
+    _pos = _begin;
+}
+
+void Writer::write_value(const json_value* value, int prefix) {
+    if (!value) {
+        put("null", 4);
+        return;
+    }
+    switch (value->type()) {
+    case value_type::kNull:
+        put("null", 4);
+        break;
+    case value_type::kBoolean:
+        if (static_cast<const json_boolean*>(value)->value()) {
+            put("true", 4);
+        } else {
+            put("false", 5);
+        }
+        break;
+    case value_type::kNumber:
+        write_number(static_cast<const json_number*>(value));
+        break;
+    case value_type::kString:
+    {
+        auto str = static_cast<const json_string*>(value);
+        write_string(str->data(), str->size());
+    }
+        break;
+    case value_type::kArray:
+        write_array(static_cast<const json_array*>(value), prefix);
+        break;
+    case value_type::kObject:
+        write_object(static_cast<const json_object*>(value), prefix);
+        break;
+    }
+}
+
+void Writer::write_array(const json_array* arr, int prefix) {
+    // the packed elements are read without making their nodes
+    bool packed = arr->is_packed();
+    size_t size = arr->size();
+    if (size == 0) {
+        put("[]", 2);
+        return;
+    }
+    put('[');
+    int inner = prefix + _indent;
+    if (_indent >= 0 && !packed) {
+        // a container as the first element starts after one more
+        // indentation, as dump(indent) always wrote it
+        json_value* first = arr->at(0);
+        if (first && (first->type() == value_type::kArray || first->type() == value_type::kObject)) {
+            write_indent(inner);
+        }
+    }
+    for (size_t i = 0; i < size && !_stopped; i++) {
+        if (_indent >= 0) {
+            put('\n');
+            write_indent(inner);
+        } else if (i) {
+            put(',');
+        }
+        if (packed) {
+            write_packed(arr->packed(), arr->packed_at(i));
+        } else {
+            write_value(arr->at(i), inner);
+        }
+        if (_indent >= 0) {
+            put(i + 1 != size ? ',' : '\n');
+        }
+    }
+    if (_indent >= 0) {
+        write_indent(prefix);
+    }
+    put(']');
+}
+
+void Writer::write_object(const json_object* obj, int prefix) {
+    size_t size = obj->size();
+    if (size == 0) {
+        put("{}", 2);
+        return;
+    }
+    put('{');
+    int inner = prefix + _indent;
+    for (size_t i = 0; i < size && !_stopped; i++) {
+        if (_indent >= 0) {
+            put(",\n" + (i ? 0 : 1), i ? 2 : 1);
+            write_indent(inner);
+        } else if (i) {
+            put(',');
+        }
+        const object_key& key = obj->key_at(i);
+        write_string(key.data(), key.size());
+        if (_indent >= 0) {
+            put(": ", 2);
+        } else {
+            put(':');
+        }
+        write_value(obj->value_at(i).get(), inner);
+    }
+    if (_indent >= 0) {
+        put('\n');
+        write_indent(prefix);
+    }
+    put('}');
+}
+
+void Writer::write_tape(const tape::Document* doc, size_t p, int prefix) {
+    const tape::Value& v = doc->values[p];
+    json_array::packed_number n;
+    switch (v.type) {
+    case tape::tag::kNull:
+        put("null", 4);
+        break;
+    case tape::tag::kFalse:
+        put("false", 5);
+        break;
+    case tape::tag::kTrue:
+        put("true", 4);
+        break;
+    case tape::tag::kInt64:
+        n.i64 = v.i64;
+        write_packed(json_array::packed_kind::kInt64, n);
+        break;
+    case tape::tag::kUint64:
+        n.u64 = v.u64;
+        write_packed(json_array::packed_kind::kUint64, n);
+        break;
+    case tape::tag::kDouble:
+        n.d = v.d;
+        write_packed(json_array::packed_kind::kDouble, n);
+        break;
+    case tape::tag::kShortString:
+    case tape::tag::kString:
+        write_string(doc->string_data(p), doc->string_size(p));
+        break;
+    case tape::tag::kArray:
+        write_tape_array(doc, p, prefix);
+        break;
+    case tape::tag::kObject:
+        if (doc->unique_keys(p)) {
+            write_tape_object(doc, p, prefix);
+        } else {
+            write_value(doc->to_json_value(p).get(), prefix);
+        }
+        break;
+    }
+}
+
+// the same layout as write_array and write_object
+void Writer::write_tape_array(const tape::Document* doc, size_t p, int prefix) {
+    size_t size = doc->size(p);
+    if (size == 0) {
+        put("[]", 2);
+        return;
+    }
+    put('[');
+    int inner = prefix + _indent;
+    size_t q = doc->first_child(p);
+    if (_indent >= 0) {
+        value_type first = doc->type(q);
+        if (first == value_type::kArray || first == value_type::kObject) {
+            write_indent(inner);
+        }
+    }
+    for (size_t i = 0; i < size && !_stopped; i++, q = doc->next(q)) {
+        if (_indent >= 0) {
+            put('\n');
+            write_indent(inner);
+        } else if (i) {
+            put(',');
+        }
+        write_tape(doc, q, inner);
+        if (_indent >= 0) {
+            put(i + 1 != size ? ',' : '\n');
+        }
+    }
+    if (_indent >= 0) {
+        write_indent(prefix);
+    }
+    put(']');
+}
+
+void Writer::write_tape_object(const tape::Document* doc, size_t p, int prefix) {
+    size_t size = doc->size(p);
+    if (size == 0) {
+        put("{}", 2);
+        return;
+    }
+    put('{');
+    int inner = prefix + _indent;
+    // members are a key followed by its value
+    size_t q = p + 1;
+    for (size_t i = 0; i < size && !_stopped; i++, q = doc->next(q + 1)) {
+        if (_indent >= 0) {
+            put(",\n" + (i ? 0 : 1), i ? 2 : 1);
+            write_indent(inner);
+        } else if (i) {
+            put(',');
+        }
+        write_string(doc->string_data(q), doc->string_size(q));
+        if (_indent >= 0) {
+            put(": ", 2);
+        } else {
+            put(':');
+        }
+        write_tape(doc, q + 1, inner);
+    }
+    if (_indent >= 0) {
+        put('\n');
+        write_indent(prefix);
+    }
+    put('}');
+}
+
+void Writer::write_number(const json_number* number) {
+    json_array::packed_number n;
+    if (number->is_signed()) {
+        n.i64 = static_cast<int64_t>(*number);
+        write_packed(json_array::packed_kind::kInt64, n);
+    } else if (number->is_unsigned()) {
+        n.u64 = static_cast<uint64_t>(*number);
+        write_packed(json_array::packed_kind::kUint64, n);
+    } else {
+        n.d = static_cast<double>(*number);
+        write_packed(json_array::packed_kind::kDouble, n);
+    }
+}
+
+void Writer::write_string(const char* ptr, size_t len) {
+    put('"');
+    // runs without anything to escape are copied as they are, '/' and
+    // utf-8 sequences included
+    size_t i = 0;
+    while (i < len) {
+        const size_t run = scan_unescaped(ptr + i, len - i);
+        put(ptr + i, run);
+        i += run;
+        if (i == len) {
+            break;
+        }
+        const uint8_t c = static_cast<uint8_t>(ptr[i++]);
+        const char e = short_escape(c);
+        if (e) {
+            const char escape[2] = { '\\', e };
+            put(escape, 2);
+        } else {
+            const char escape[6] = { '\\', 'u', '0', '0', kHexDigits[c >> 4], kHexDigits[c & 15] };
+            put(escape, 6);
+        }
+    }
+    put('"');
+}
+
+void Writer::write_packed(json_array::packed_kind kind, json_array::packed_number n) {
+    // formatted in place when the number surely fits
+    char buff[numeric::max_number_size];
+    const bool direct = static_cast<size_t>(_end - _pos) >= numeric::max_number_size;
+    char* out = direct ? _pos : buff;
+    size_t len;
+    switch (kind) {
+    case json_array::packed_kind::kInt64:
+        len = numeric::format_int64(n.i64, out);
+        break;
+    case json_array::packed_kind::kUint64:
+        len = numeric::format_uint64(n.u64, out);
+        break;
+    default:
+        len = numeric::format_double(n.d, out);
+        break;
+    }
+    if (direct) {
+        _pos += len;
+    } else {
+        put(buff, len);
+    }
+}
+
+void Writer::write_indent(size_t count) {
+    const size_t run = sizeof(kSpaces) - 1;
+    while (count > run) {
+        put(kSpaces, run);
+        count -= run;
+    }
+    put(kSpaces, count);
+}
+
+// -------------------------------------------------------------
+
+namespace {
+size_t number_size(json_array::packed_kind kind, json_array::packed_number n) {
+    char buff[numeric::max_number_size];
+    switch (kind) {
+    case json_array::packed_kind::kInt64:
+        return numeric::format_int64(n.i64, buff);
+    case json_array::packed_kind::kUint64:
+        return numeric::format_uint64(n.u64, buff);
+    default:
+        return numeric::format_double(n.d, buff);
+    }
+}
+
+size_t string_size(const char* ptr, size_t len) {
+    size_t size = len + 2;
+    size_t i = 0;
+    while (i < len) {
+        i += scan_unescaped(ptr + i, len - i);
+        if (i == len) {
+            break;
+        }
+        // \x or \u00XX in place of one byte
+        size += short_escape(static_cast<uint8_t>(ptr[i++])) ? 1 : 5;
+    }
+    return size;
+}
+
+// the same layout as Writer::write_array and Writer::write_object
+size_t value_size(const json_value* value, int indent, int prefix) {
+    if (!value) {
+        return 4;
+    }
+    switch (value->type()) {
+    case value_type::kNull:
+        return 4;
+    case value_type::kBoolean:
+        return static_cast<const json_boolean*>(value)->value() ? 4 : 5;
+    case value_type::kNumber:
+    {
+        auto number = static_cast<const json_number*>(value);
+        json_array::packed_number n;
+        if (number->is_signed()) {
+            n.i64 = static_cast<int64_t>(*number);
+            return number_size(json_array::packed_kind::kInt64, n);
+        }
+        if (number->is_unsigned()) {
+            n.u64 = static_cast<uint64_t>(*number);
+            return number_size(json_array::packed_kind::kUint64, n);
+        }
+        n.d = static_cast<double>(*number);
+        return number_size(json_array::packed_kind::kDouble, n);
+    }
+    case value_type::kString:
+    {
+        auto str = static_cast<const json_string*>(value);
+        return string_size(str->data(), str->size());
+    }
+    case value_type::kArray:
+    {
+        auto arr = static_cast<const json_array*>(value);
+        bool packed = arr->is_packed();
+        size_t count = arr->size();
+        if (count == 0) {
+            return 2;
+        }
+        int inner = prefix + indent;
+        size_t size = 2;
+        if (indent >= 0) {
+            // a newline, the indentation and ',' or a newline per element
+            size += count * (2 + inner) + prefix;
+            json_value* first = packed ? nullptr : arr->at(0);
+            if (first && (first->type() == value_type::kArray || first->type() == value_type::kObject)) {
+                size += inner;
+            }
+        } else {
+            size += count - 1;
+        }
+        for (size_t i = 0; i < count; i++) {
+            size += packed ? number_size(arr->packed(), arr->packed_at(i))
+                           : value_size(arr->at(i), indent, inner);
+        }
+        return size;
+    }
+    case value_type::kObject:
+    {
+        auto obj = static_cast<const json_object*>(value);
+        size_t count = obj->size();
+        if (count == 0) {
+            return 2;
+        }
+        int inner = prefix + indent;
+        size_t size = 2;
+        if (indent >= 0) {
+            // ",\n", the indentation and ": " per member (the first has no
+            // ','), then a newline and the indentation of the '}'
+            size += count * (4 + inner) + prefix;
+        } else {
+            // ',' and ':' per member, one ',' less
+            size += count * 2 - 1;
+        }
+        for (size_t i = 0; i < count; i++) {
+            const object_key& key = obj->key_at(i);
+            size += string_size(key.data(), key.size());
+            size += value_size(obj->value_at(i).get(), indent, inner);
+        }
+        return size;
+    }
+    }
+    return 0;
+}
+
+// value_size for the value at 'p' of a compact document
+size_t tape_size(const tape::Document* doc, size_t p, int indent, int prefix) {
+    const tape::Value& v = doc->values[p];
+    json_array::packed_number n;
+    switch (v.type) {
+    case tape::tag::kNull:
+    case tape::tag::kTrue:
+        return 4;
+    case tape::tag::kFalse:
+        return 5;
+    case tape::tag::kInt64:
+        n.i64 = v.i64;
+        return number_size(json_array::packed_kind::kInt64, n);
+    case tape::tag::kUint64:
+        n.u64 = v.u64;
+        return number_size(json_array::packed_kind::kUint64, n);
+    case tape::tag::kDouble:
+        n.d = v.d;
+        return number_size(json_array::packed_kind::kDouble, n);
+    case tape::tag::kShortString:
+    case tape::tag::kString:
+        return string_size(doc->string_data(p), doc->string_size(p));
+    case tape::tag::kArray:
+    {
+        size_t count = doc->size(p);
+        if (count == 0) {
+            return 2;
+        }
+        int inner = prefix + indent;
+        size_t size = 2;
+        size_t q = doc->first_child(p);
+        if (indent >= 0) {
+            size += count * (2 + inner) + prefix;
+            value_type first = doc->type(q);
+            if (first == value_type::kArray || first == value_type::kObject) {
+                size += inner;
+            }
+        } else {
+            size += count - 1;
+        }
+        for (size_t i = 0; i < count; i++, q = doc->next(q)) {
+            size += tape_size(doc, q, indent, inner);
+        }
+        return size;
+    }
+    case tape::tag::kObject:
+    {
+        if (!doc->unique_keys(p)) {
+            return value_size(doc->to_json_value(p).get(), indent, prefix);
+        }
+        size_t count = doc->size(p);
+        if (count == 0) {
+            return 2;
+        }
+        int inner = prefix + indent;
+        size_t size = 2;
+        if (indent >= 0) {
+            size += count * (4 + inner) + prefix;
+        } else {
+            size += count * 2 - 1;
+        }
+        size_t q = p + 1;
+        for (size_t i = 0; i < count; i++, q = doc->next(q + 1)) {
+            size += string_size(doc->string_data(q), doc->string_size(q));
+            size += tape_size(doc, q + 1, indent, inner);
+        }
+        return size;
+    }
+    }
+    return 0;
+}
+}  // namespace
+
+size_t measure_text(const json_value* value, int indent) {
+    return value_size(value, indent, 0);
+}
+
+size_t measure_text(const tape::Document* doc, size_t p, int indent) {
+    return tape_size(doc, p, indent, 0);
+}
+}  // namespace text
+}  // namespace karl
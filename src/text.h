@@ -0,0 +1,373 @@
+// Copyright (c) 2019 shadow-yuan. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "LICENSE");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// An easy to use c++ json library
+// Version 1.0.0
+// https://github.com/shadow-yuan/karl
+//
+// Authors: Shadow Yuan (shadow_yuan@qq.com)
+//
+
+#pragma once
+#include "karl.h"
+#include "arena.h"
+#include "tape.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// https://www.rfc-editor.org/rfc/rfc8259.txt
+
+namespace karl {
+namespace text {
+
+// Nesting deeper than this is rejected instead of overflowing the stack.
+const int max_nesting_depth = 1000;
+
+// Reader flags.
+enum : uint32_t {
+    // strings without escapes refer to the input instead of copying it,
+    // the input must outlive the values (see json::parse_borrowed)
+    kBorrowStrings = 1u << 0,
+    // the tree is allocated from an arena (see json::parse_arena)
+    kArenaValues = 1u << 1,
+};
+
+// Handler that builds the json_value tree from the reader events,
+// it has the same interface as sax_handler (see karl/json.hxx).
+class DomBuilder final {
+public:
+    DomBuilder();
+    ~DomBuilder() = default;
+
+    // strings inside [begin, end) are borrowed instead of copied
+    void borrow_from(const char* begin, const char* end);
+
+    // allocate the values, strings and containers from 'arena'
+    void use_arena(ref_ptr<memory::Arena> arena);
+
+    // share long keys and short string values through 'pool'
+    void use_pool(string_pool* pool);
+
+    bool on_null();
+    bool on_bool(bool value);
+    bool on_int64(int64_t value);
+    bool on_uint64(uint64_t value);
+    bool on_double(double value);
+    bool on_string(const char* ptr, size_t len);
+    bool on_key(const char* ptr, size_t len);
+    bool on_start_object();
+    bool on_end_object();
+    bool on_start_array();
+    bool on_end_array();
+
+    // the root value is complete
+    bool done() const;
+    // number of open containers and the kind of the innermost one
+    size_t depth() const;
+    bool in_object() const;
+
+    ref_ptr<json_value> root() const;
+    void reset();
+
+private:
+    struct Frame {
+        ref_ptr<json_array> array;    // set for arrays
+        bool object = false;
+        size_t mark = 0;              // first member of the object in _keys
+    };
+
+    bool add_value(ref_ptr<json_value> obj);
+    // numbers of an array go to its packed storage while they can
+    template <typename T>
+    bool add_number(T value);
+    template <typename T, typename... Args>
+    ref_ptr<T> make(Args&&... args);
+
+    std::vector<Frame> _stack;
+    // the members of the open objects, an object is made with its shape
+    // once all of them are read
+    std::vector<object_key> _keys;
+    std::vector<ref_ptr<json_value>> _values;
+    shape_table _shapes;
+    ref_ptr<json_value> _root;
+    const char* _borrow_begin;
+    const char* _borrow_end;
+    ref_ptr<memory::Arena> _arena;
+    string_pool* _pool;
+};
+
+// Json text reader, the events of a value are sent to the handler while
+// the input is scanned (DomBuilder or sax_handler). The input does not
+// need to be NUL terminated.
+//
+// When a structural index (see structural.h) is given, the reader
+// works as stage 2: instead of skipping whitespace byte by byte it
+// jumps from one indexed token to the next.
+class Reader final {
+public:
+    Reader(const char* ptr, size_t size);
+    Reader(const char* ptr, size_t size, const std::vector<uint32_t>& index);
+    ~Reader() = default;
+
+    void set_flags(uint32_t flags);
+
+    // skip leading whitespace and read exactly one json value,
+    // false if the text is invalid or a handler callback returns false
+    template <typename Handler>
+    bool parse(Handler& handler);
+
+    // same as parse(), building the json_value tree
+    bool read_value(ref_ptr<json_value>& obj);
+    // same with the caller's builder, objects of the values read through
+    // one builder share their shapes
+    bool read_value(DomBuilder& builder, ref_ptr<json_value>& obj);
+
+    // read the string token at the current position (the opening quote)
+    bool read_string(std::string& s);
+
+    size_t current_position() const;
+
+    // with a structural index: continue at index entry 'next'
+    void seek(size_t next);
+
+private:
+    void skip_whitespace();
+    template <typename Handler>
+    bool parse_value(Handler& handler, int depth);
+    template <typename Handler>
+    bool parse_array(Handler& handler, int depth);
+    template <typename Handler>
+    bool parse_object(Handler& handler, int depth);
+    template <typename Handler>
+    bool parse_number(Handler& handler);
+
+    // 'ptr' points into the input when there is nothing to unescape,
+    // otherwise to the decoded copy which lives until the next string
+    bool read_string(const char** ptr, size_t* len);
+    bool read_literal(const char* literal, size_t len);
+    bool read_hex4(uint32_t& code);
+    bool check_scalar_end() const;
+
+    const char* _buff;
+    const size_t _size;
+    size_t _position;
+    uint32_t _flags;
+    std::string _scratch;
+
+    const uint32_t* _index;
+    size_t _index_size;
+    size_t _next;
+};
+
+// Push style reader, the input arrives in chunks of any size.
+//
+// Open containers live on the stack of a DomBuilder, so the state survives
+// between feed() calls and the tree grows while the data comes in. The only
+// input that is buffered is a token (string, number or literal) split across
+// two chunks; complete tokens are read straight from the caller's chunk.
+class PushReader final {
+public:
+    PushReader();
+    ~PushReader() = default;
+
+    // returns false once the input is known to be invalid
+    bool feed(const char* ptr, size_t len);
+
+    // end of input, returns nullptr if the document is invalid or truncated.
+    // bytes following the first value are ignored.
+    ref_ptr<json_value> finish();
+
+    // a complete value has been read
+    bool done() const;
+    void reset();
+
+private:
+    enum class state {
+        kValue,         // expect a value
+        kArrayFirst,    // after '[', expect a value or ']'
+        kObjectFirst,   // after '{', expect a key or '}'
+        kKey,           // expect a key
+        kColon,         // expect ':'
+        kCommaOrEnd,    // expect ',' or the end of the container
+        kDone,
+        kError,
+    };
+
+    bool scan_token(const char* ptr, size_t len, size_t* end);
+    bool complete_token(const char* ptr, size_t len);
+    bool begin_container(bool is_object);
+    bool end_container(char c);
+    void value_added();
+    bool fail();
+
+    state _state;
+    DomBuilder _builder;
+
+    // token split across chunks
+    std::string _token;
+    bool _in_token;
+    bool _token_is_string;
+    bool _token_is_key;
+    bool _escaped;
+};
+
+// Receives the text of a streaming Writer piece by piece, returns false
+// to stop the writer.
+typedef std::function<bool(const char* ptr, size_t len)> write_sink;
+
+// Size of the buffer a streaming Writer hands to its sink.
+const size_t write_buffer_size = 64 * 1024;
+
+// Json text writer behind json_value::dump(). A value and everything
+// below it are written into one buffer, no string is made per node. With
+// an indent >= 0 the elements and members go one per line, the
+// indentation is copied from a run of spaces made once.
+//
+// The buffer is one of:
+// - a string, the text is appended to it and it grows as needed
+// - a buffer of write_buffer_size bytes handed to a sink every time it
+//   fills up, so the memory used does not depend on the size of the output
+// - the caller's memory, the writer stops once it is full
+class Writer final {
+public:
+    // compact output for a negative indent
+    Writer(std::string* out, int indent);
+    Writer(write_sink sink, int indent);
+    Writer(char* buff, size_t capacity, int indent);
+    ~Writer() = default;
+
+    // 'prefix' is the indentation of the line the value starts on.
+    // false if the sink stopped the writer or the caller's buffer is too
+    // small, the text is incomplete then
+    bool write(const json_value* value, int prefix = 0);
+    // same for the value at 'p' of a compact document, read from its tape
+    bool write(const tape::Document* doc, size_t p, int prefix = 0);
+
+    // bytes in the caller's buffer
+    size_t size() const;
+
+private:
+    void start();
+    bool finish();
+
+    void write_value(const json_value* value, int prefix);
+    void write_tape(const tape::Document* doc, size_t p, int prefix);
+    void write_tape_array(const tape::Document* doc, size_t p, int prefix);
+    void write_tape_object(const tape::Document* doc, size_t p, int prefix);
+    void write_array(const json_array* arr, int prefix);
+    void write_object(const json_object* obj, int prefix);
+    void write_number(const json_number* number);
+    void write_string(const char* ptr, size_t len);
+    void write_packed(json_array::packed_kind kind, json_array::packed_number n);
+    void write_indent(size_t count);
+
+    void put(const char* ptr, size_t len);
+    void put(char c);
+    // [_pos, _end) is too small for 'len' bytes: grow the string, hand
+    // the buffer to the sink or stop
+    void overflow(const char* ptr, size_t len);
+    void flush();
+
+    std::string* _out;
+    int _indent;
+    write_sink _sink;
+    std::unique_ptr<char[]> _buffer;
+    char* _begin;
+    char* _pos;
+    char* _end;
+    bool _stopped;
+};
+
+// Exact size of the text Writer makes for 'value', the strings are
+// scanned for escapes and the doubles formatted but nothing is written.
+size_t measure_text(const json_value* value, int indent);
+size_t measure_text(const tape::Document* doc, size_t p, int indent);
+
+// Returns nullptr if the text is not valid json, 'transfer_bytes'
+// receives the number of bytes consumed by the first value.
+ref_ptr<json_value>
+ parse_into_json_value(const char* ptr, size_t len, size_t* transfer_bytes, uint32_t flags = 0,
+                       string_pool* pool = nullptr);
+
+// Send the events of the first value to 'handler', no tree is built.
+// Returns false if the text is not valid json or the handler stopped.
+bool parse_into_handler(const char* ptr, size_t len, sax_handler& handler, size_t* transfer_bytes);
+
+// Parse the first value into a compact document (json::parse_compact),
+// returns nullptr if the text is not valid json.
+ref_ptr<tape::Document> parse_into_tape(const char* ptr, size_t len);
+
+// Input of a lazy document (json::parse_lazy): the text, its structural
+// index and, for every '[' and '{' in the index, the index position of
+// the matching ']' or '}'.
+struct LazyDocument {
+    std::string text;
+    std::vector<uint32_t> index;
+    std::vector<uint32_t> close;
+};
+
+// Build the lazy root container of the text, brackets are checked but
+// the tokens between them are not. Returns nullptr on error.
+ref_ptr<json_value> parse_lazy(const char* ptr, size_t len);
+
+// Fill one level of a lazy container, 'at' is the index position of its
+// opening bracket. Nested containers become lazy themselves.
+bool expand_lazy_array(const std::shared_ptr<LazyDocument>& doc, uint32_t at, json_array& arr);
+bool expand_lazy_object(const std::shared_ptr<LazyDocument>& doc, uint32_t at, json_object& obj);
+
+// Keep only the values on 'paths' (json pointers, "*" matches every
+// member or element of a level), the containers leading to them are kept
+// too. Everything else is skipped through the bracket table without
+// being read or validated. Returns nullptr if the text is not valid json.
+ref_ptr<json_value>
+ parse_projection(const char* ptr, size_t len, const std::vector<std::string>& paths);
+
+// Same result as parse_into_json_value, using 'threads' threads (0: one
+// per core) for the arrays nested 'split_depth' levels deep. Their element
+// boundaries are found with the structural index and bracket table, ranges
+// of elements are read concurrently and stitched back in order.
+ref_ptr<json_value>
+ parse_parallel(const char* ptr, size_t len, size_t threads, int split_depth);
+
+// Split a stream of json texts separated by whitespace (json lines or
+// concatenated documents). 'offsets' receives the start of every
+// document, each one runs up to the start of the next. Only strings and
+// nesting are tracked, validating the documents is left to the reader.
+// A string that runs into a line break, or a container that goes on on a
+// new line with a byte that cannot follow inside it, is a broken document
+// (a truncated json lines record): the next one starts on that line.
+void split_documents(const char* ptr, size_t len, std::vector<size_t>& offsets);
+
+// Reads the documents of a stream one after another with the same builder
+// and structural index, so the objects of documents with the same keys
+// share one shape and the index is allocated once. One reader per thread.
+class DocumentReader final {
+public:
+    DocumentReader() = default;
+    ~DocumentReader() = default;
+
+    // same as parse_into_json_value
+    ref_ptr<json_value> read(const char* ptr, size_t len);
+
+private:
+    DomBuilder _builder;
+    std::vector<uint32_t> _index;
+};
+
+}  // namespace text
+}  // namespace karl